@@ -0,0 +1,164 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+
+#include "arena.h"
+#include "gcode.h"
+
+/*
+ * Boot-time bump allocator over the part of CCM that follows the
+ * static .ccm section. All runtime objects are allocated before
+ * arena_seal(); nothing is ever freed.
+ */
+
+#define	ARENA_ALIGN		8
+#define	ARENA_STACK_FILL	0xa5
+#define	ARENA_STACK_SLACK	256	/* Below sp, for the fill itself. */
+
+extern uint8_t _sccm[];
+extern uint8_t _eccm[];
+extern uint8_t _ccm_end[];
+
+struct arena_stack {
+	const char *name;
+	uint8_t *base;
+	size_t size;
+	uint8_t fill;
+};
+
+static struct arena_stack arena_stacks[ARENA_NSTACKS];
+static int arena_nstacks;
+static uint8_t *arena_ptr;
+static int arena_sealed;
+
+void
+arena_init(void)
+{
+
+	bzero(_sccm, _ccm_end - _sccm);
+	arena_ptr = _eccm;
+}
+
+void *
+arena_alloc(size_t size)
+{
+	void *ret;
+
+	if (arena_sealed)
+		panic("%s: allocation after init", __func__);
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (arena_ptr + size > _ccm_end)
+		panic("%s: out of memory (%d bytes)", __func__, size);
+
+	ret = arena_ptr;
+	arena_ptr += size;
+
+	return (ret);
+}
+
+/*
+ * Thread stack, filled with a pattern for the high-water mark.
+ */
+void *
+arena_alloc_stack(const char *name, size_t size)
+{
+	struct arena_stack *st;
+
+	if (arena_nstacks == ARENA_NSTACKS)
+		panic("%s: too many stacks", __func__);
+
+	st = &arena_stacks[arena_nstacks++];
+	st->name = name;
+	st->size = size;
+	st->base = arena_alloc(size);
+	st->fill = ARENA_STACK_FILL;
+	memset(st->base, ARENA_STACK_FILL, size);
+
+	return (st->base);
+}
+
+/*
+ * A stack set up outside the arena that is already in use. Only the
+ * part well below sp is filled. Without sp the stack is not written
+ * and untouched bytes are the zeroes of .bss.
+ */
+void
+arena_add_stack(const char *name, uint8_t *base, size_t size, uint8_t *sp)
+{
+	struct arena_stack *st;
+
+	if (arena_nstacks == ARENA_NSTACKS)
+		panic("%s: too many stacks", __func__);
+
+	st = &arena_stacks[arena_nstacks++];
+	st->name = name;
+	st->base = base;
+	st->size = size;
+	st->fill = 0;
+
+	if (sp != NULL && sp - base > ARENA_STACK_SLACK) {
+		st->fill = ARENA_STACK_FILL;
+		memset(base, ARENA_STACK_FILL, sp - base - ARENA_STACK_SLACK);
+	}
+}
+
+void
+arena_seal(void)
+{
+
+	arena_sealed = 1;
+}
+
+/*
+ * Static CCM section and arena usage, then the high-water mark of each
+ * stack (stacks grow down, so count untouched bytes from the base).
+ */
+void
+arena_report(void)
+{
+	struct arena_stack *st;
+	size_t unused;
+	int i;
+
+	gcode_out_lock();
+	printf("ok M:ccm S:%u A:%u T:%u\n", _eccm - _sccm,
+	    arena_ptr - _eccm, _ccm_end - _sccm);
+	gcode_out_unlock();
+
+	for (i = 0; i < arena_nstacks; i++) {
+		st = &arena_stacks[i];
+		for (unused = 0; unused < st->size; unused++)
+			if (st->base[unused] != st->fill)
+				break;
+		gcode_out_lock();
+		printf("ok M:stack \"%s\" U:%u T:%u\n", st->name,
+		    st->size - unused, st->size);
+		gcode_out_unlock();
+	}
+}
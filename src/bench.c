@@ -0,0 +1,206 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmarks of the hot paths. Each function is called
+ * BENCH_NSAMPLES times, with the sample number to pick an input, and
+ * every call is timed on its own. The cost of reading the counter is
+ * taken out. One line per function:
+ * ok B:<name> N:<calls> m:<min> d:<median> M:<max>
+ * in counter ticks, F in the header line gives their frequency.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+
+#include "bench.h"
+#include "config.h"
+#include "dwt.h"
+#include "gcode.h"
+#include "planner.h"
+#include "pnp.h"
+#include "trig.h"
+
+static uint32_t bench_samples[BENCH_NSAMPLES];
+static uint32_t bench_overhead;
+
+static struct planner_profile bench_prof[PNP_NAXES];
+static struct planner_feed bench_feed;
+static volatile uint32_t bench_sink;
+
+static inline uint32_t
+bench_cycles(void)
+{
+
+#ifdef BENCH_HOST
+	return (bench_host_cycles());
+#else
+	return (dwt_cycles());
+#endif
+}
+
+static void
+bench_sort(uint32_t *v, int n)
+{
+	uint32_t tmp;
+	int i, j;
+
+	for (i = 1; i < n; i++) {
+		tmp = v[i];
+		for (j = i; j > 0 && v[j - 1] > tmp; j--)
+			v[j] = v[j - 1];
+		v[j] = tmp;
+	}
+}
+
+static void
+bench_sample(void (*fn)(int i))
+{
+	uint32_t start;
+	uint32_t cycles;
+	int i;
+
+	for (i = 0; i < BENCH_NSAMPLES; i++) {
+		start = bench_cycles();
+		fn(i);
+		cycles = bench_cycles() - start;
+		bench_samples[i] = cycles > bench_overhead ?
+		    cycles - bench_overhead : 0;
+	}
+
+	bench_sort(bench_samples, BENCH_NSAMPLES);
+}
+
+void
+bench_measure(const char *name, void (*fn)(int i))
+{
+
+	bench_sample(fn);
+
+	printf("ok B:%s N:%u m:%u d:%u M:%u\n", name, BENCH_NSAMPLES,
+	    bench_samples[0], bench_samples[BENCH_NSAMPLES / 2],
+	    bench_samples[BENCH_NSAMPLES - 1]);
+}
+
+static void
+bench_empty(int i)
+{
+
+}
+
+/* Z positions across the whole cam, both nozzles. */
+static void
+bench_translate_z(int i)
+{
+	int64_t deg;
+	int64_t z;
+
+	z = config.axis[PNP_AXIS_Z].cam_radius * 2 * i / BENCH_NSAMPLES;
+	if (i & 1)
+		z = -z;
+	trig_translate_z(z, config.axis[PNP_AXIS_Z].cam_radius, &deg);
+	bench_sink = deg;
+}
+
+static void
+bench_untranslate_z(int i)
+{
+	int64_t z;
+
+	trig_untranslate_z((int64_t)i * 180000000 / BENCH_NSAMPLES - 90000000,
+	    config.axis[PNP_AXIS_Z].cam_radius, &z);
+	bench_sink = z;
+}
+
+static void
+bench_isqrt(int i)
+{
+
+	bench_sink = trig_isqrt64((uint64_t)i * 0x123456789ULL + 1);
+}
+
+/* Moves from a few steps up to the full travel, XY and rotation. */
+static void
+bench_plan(int i)
+{
+	int steps[PNP_NAXES];
+	int n;
+
+	n = 1 << (i % 16);
+	steps[PNP_AXIS_X] = n;
+	steps[PNP_AXIS_Y] = (i & 1) ? -n / 3 : n / 2;
+	steps[PNP_AXIS_Z] = 0;
+	steps[PNP_AXIS_H1] = (i & 2) ? n / 8 : 0;
+	steps[PNP_AXIS_H2] = 0;
+	planner_plan(steps, &bench_feed, bench_prof);
+}
+
+/* Steps of a 20000 step X move, through the ramps and the cruise. */
+static void
+bench_step_rate(int i)
+{
+
+	bench_sink = planner_step_rate(&bench_prof[PNP_AXIS_X],
+	    i * 20000 / BENCH_NSAMPLES, 20000);
+}
+
+static void
+bench_stop_rate(int i)
+{
+
+	bench_sink = planner_stop_rate(&bench_prof[PNP_AXIS_X],
+	    bench_prof[PNP_AXIS_X].rate_max, i * 50);
+}
+
+void
+bench_run(void)
+{
+	int steps[PNP_NAXES];
+
+	bench_sample(bench_empty);
+	bench_overhead = bench_samples[0];
+
+	printf("ok B:F:%u O:%u\n", BENCH_FREQ, bench_overhead);
+
+	bench_measure("trig_translate_z", bench_translate_z);
+	bench_measure("trig_untranslate_z", bench_untranslate_z);
+	bench_measure("trig_isqrt64", bench_isqrt);
+	planner_feed(&bench_feed);
+	bench_measure("planner_plan", bench_plan);
+
+	bzero(steps, sizeof(steps));
+	steps[PNP_AXIS_X] = 20000;
+	planner_plan(steps, &bench_feed, bench_prof);
+	bench_measure("planner_step_rate", bench_step_rate);
+	bench_measure("planner_stop_rate", bench_stop_rate);
+
+	gcode_bench();
+	pnp_bench();
+
+#ifdef BENCH_HOST
+	bench_host_done();
+#endif
+}
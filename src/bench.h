@@ -0,0 +1,53 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_BENCH_H_
+#define	_SRC_BENCH_H_
+
+#define	BENCH_NSAMPLES		101	/* Calls timed per function. */
+
+/*
+ * Run the microbenchmarks from pnp_main() instead of starting the
+ * machine. The host simulator times them with the host clock, see
+ * tools/sim.
+ */
+#ifdef BENCH_HOST
+int bench_host_enabled(void);
+uint32_t bench_host_cycles(void);
+void bench_host_done(void);
+#define	BENCH_AT_BOOT		bench_host_enabled()
+#define	BENCH_FREQ		1000000000
+#else
+#ifndef BENCH_AT_BOOT
+#define	BENCH_AT_BOOT		0
+#endif
+#define	BENCH_FREQ		DWT_CPU_FREQ
+#endif
+
+void bench_measure(const char *name, void (*fn)(int i));
+void bench_run(void);
+
+#endif /* !_SRC_BENCH_H_ */
@@ -27,7 +27,7 @@
 #include <sys/cdefs.h>
 #include <sys/console.h>
 #include <sys/systm.h>
-#include <sys/malloc.h>
+#include <sys/pcpu.h>
 #include <sys/thread.h>
 
 #include <dev/display/panel.h>
@@ -37,13 +37,14 @@
 #include <arm/stm/stm32f4.h>
 #include <arm/arm/nvic.h>
 
+#include "arena.h"
 #include "board.h"
+#include "dwt.h"
 #include "gpio.h"
 #include "gcode.h"
 #include "pnp.h"
 
 static struct stm32f4_usart_softc usart_sc;
-static struct stm32f4_flash_softc flash_sc;
 static struct stm32f4_pwr_softc pwr_sc;
 static struct stm32f4_rcc_softc rcc_sc;
 static struct stm32f4_timer_softc timer_sc;
@@ -51,6 +52,22 @@ static struct stm32f4_rng_softc rng_sc;
 static struct arm_nvic_softc nvic_sc;
 static struct mdx_device dev_nvic = { .sc = &nvic_sc };
 
+/*
+ * NVIC priorities, lower value is higher priority. STM32F4 implements
+ * the upper 4 bits of each priority byte.
+ * Every handler below posts semaphores or runs the scheduler timer, so
+ * they share one level: none preempts another in the middle of a kernel
+ * call. Pending ones are taken by IRQ number, the step timers of X and
+ * Y before the console and the system timer. A step ISR only latches
+ * the timer and posts, so it delays the others by a few hundred cycles.
+ */
+#define	NVIC_IPR(n)		(0xE000E400 + (n))
+#define	BOARD_PRIO_KERNEL	1
+
+#define	BOARD_CCMDATARAMEN	(1 << 20)
+#define	BOARD_CONTROL_SPSEL	(1 << 1)	/* Thread mode on PSP. */
+
+struct stm32f4_flash_softc flash_sc;
 struct stm32f4_dma_softc dma1_sc;
 struct stm32f4_dma_softc dma2_sc;
 struct stm32f4_gpio_softc gpio_sc;
@@ -91,6 +108,28 @@ uart_putchar(int c, void *arg)
 	stm32f4_usart_putc(sc, c);
 }
 
+/*
+ * Raw console output for binary frames, no line ending translation.
+ */
+void
+board_console_write(const uint8_t *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		stm32f4_usart_putc(&usart_sc, buf[i]);
+}
+
+static void
+board_irq_setup(int irq, void (*handler)(void *arg, int irq), void *arg,
+    int prio)
+{
+
+	mdx_intc_setup(&dev_nvic, irq, handler, arg);
+	*(volatile uint8_t *)NVIC_IPR(irq) = (prio << 4);
+	mdx_intc_enable(&dev_nvic, irq);
+}
+
 uint32_t
 board_get_random(void)
 {
@@ -106,6 +145,32 @@ board_get_random(void)
 	return (data);
 }
 
+/*
+ * The main thread and interrupt stacks come from mdepx, not the arena.
+ * Add them to the M918 report. Handlers run on MSP while threads are on
+ * PSP, so in a thread MSP is at the top of the interrupt stack.
+ */
+void
+board_stacks(void)
+{
+	struct thread *td;
+	uint32_t control;
+	uint8_t *msp;
+
+	td = curthread;
+
+	critical_enter();
+	arena_add_stack("main", (uint8_t *)td->td_stack, td->td_stack_size,
+	    (uint8_t *)&td);
+	__asm __volatile("mrs %0, control" : "=r" (control));
+	if (control & BOARD_CONTROL_SPSEL) {
+		__asm __volatile("mrs %0, msp" : "=r" (msp));
+		arena_add_stack("intr", msp - MDX_ARM_INTR_STACK_SIZE,
+		    MDX_ARM_INTR_STACK_SIZE, NULL);
+	}
+	critical_exit();
+}
+
 void
 board_init(void)
 {
@@ -126,10 +191,11 @@ board_init(void)
 
 	stm32f4_flash_setup(&flash_sc);
 	reg = (GPIOAEN | GPIOBEN | GPIOCEN | GPIODEN | GPIOEEN);
-	reg |= DMA1EN | DMA2EN;
+	reg |= DMA1EN | DMA2EN | BOARD_CCMDATARAMEN;
 	stm32f4_rcc_setup(&rcc_sc, reg, RNGEN, 0,
 	    (TIM12EN | TIM13EN | TIM14EN | TIM4EN),
 	    (TIM1EN | TIM8EN | TIM10EN | USART1EN));
+	arena_init();
 	stm32f4_gpio_init(&gpio_sc, GPIO_BASE);
 	gpio_config(&gpio_sc);
 
@@ -139,6 +205,7 @@ board_init(void)
 
 	printf("MDEPX is starting up\n");
 
+	dwt_init();
 	stm32f4_rng_init(&rng_sc, RNG_BASE);
 	arm_nvic_init(&dev_nvic, NVIC_BASE);
 
@@ -155,40 +222,35 @@ board_init(void)
 	mdx_intc_enable(&dev_nvic, 70);
 #endif
 
-	malloc_init();
-	malloc_add_region((void *)MALLOC_REGION_START, MALLOC_REGION_SIZE);
-
 	/*
 	 * All timers: (168MHz / PPRE2_4) * 2 = 84MHz.
 	 */
 
+	/* USART1 and its receive DMA: real-time characters, see gcode.c. */
+	board_irq_setup(37, gcode_usart_intr, NULL, BOARD_PRIO_KERNEL);
+	board_irq_setup(58, gcode_dma_intr, NULL, BOARD_PRIO_KERNEL);
+
 	/* System timer: TIM8 */
 	stm32f4_timer_init(&timer_sc, TIM8_BASE, 84000000);
-	mdx_intc_setup(&dev_nvic, 46, stm32f4_timer_intr, &timer_sc);
-	mdx_intc_enable(&dev_nvic, 46);
+	board_irq_setup(46, stm32f4_timer_intr, &timer_sc, BOARD_PRIO_KERNEL);
 
 	/* X Motor: TIM10 CH1 */
 	stm32f4_pwm_init(&pwm_x_sc, TIM10_BASE, 84000000);
-	mdx_intc_setup(&dev_nvic, 25, pnp_pwm_x_intr, &pwm_x_sc);
-	mdx_intc_enable(&dev_nvic, 25);
+	board_irq_setup(25, pnp_pwm_x_intr, &pwm_x_sc, BOARD_PRIO_KERNEL);
 
 	/* Y L/R Motors: TIM4 CH1,CH2 */
 	stm32f4_pwm_init(&pwm_y_sc, TIM4_BASE, 84000000);
-	mdx_intc_setup(&dev_nvic, 30, pnp_pwm_y_intr, &pwm_y_sc);
-	mdx_intc_enable(&dev_nvic, 30);
+	board_irq_setup(30, pnp_pwm_y_intr, &pwm_y_sc, BOARD_PRIO_KERNEL);
 
 	/* Z Motors: TIM14 CH1 */
 	stm32f4_pwm_init(&pwm_z_sc, TIM14_BASE, 84000000);
-	mdx_intc_setup(&dev_nvic, 45, pnp_pwm_z_intr, &pwm_z_sc);
-	mdx_intc_enable(&dev_nvic, 45);
+	board_irq_setup(45, pnp_pwm_z_intr, &pwm_z_sc, BOARD_PRIO_KERNEL);
 
 	/* Head 1: TIM13 CH1 */
 	stm32f4_pwm_init(&pwm_h1_sc, TIM13_BASE, 84000000);
-	mdx_intc_setup(&dev_nvic, 44, pnp_pwm_h1_intr, &pwm_h1_sc);
-	mdx_intc_enable(&dev_nvic, 44);
+	board_irq_setup(44, pnp_pwm_h1_intr, &pwm_h1_sc, BOARD_PRIO_KERNEL);
 
 	/* Head 2: TIM12 CH1 */
 	stm32f4_pwm_init(&pwm_h2_sc, TIM12_BASE, 84000000);
-	mdx_intc_setup(&dev_nvic, 43, pnp_pwm_h2_intr, &pwm_h2_sc);
-	mdx_intc_enable(&dev_nvic, 43);
+	board_irq_setup(43, pnp_pwm_h2_intr, &pwm_h2_sc, BOARD_PRIO_KERNEL);
 }
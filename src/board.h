@@ -27,9 +27,7 @@
 #ifndef _SRC_BOARD_H_
 #define	_SRC_BOARD_H_
 
-#define	MALLOC_REGION_START	0x20010000
-#define	MALLOC_REGION_SIZE	0x00010000 /* 64kb */
-
+extern struct stm32f4_flash_softc flash_sc;
 extern struct stm32f4_dma_softc dma1_sc;
 extern struct stm32f4_dma_softc dma2_sc;
 extern struct stm32f4_gpio_softc gpio_sc;
@@ -40,5 +38,7 @@ extern struct stm32f4_pwm_softc pwm_h1_sc;
 extern struct stm32f4_pwm_softc pwm_h2_sc;
 
 uint32_t board_get_random(void);
+void board_console_write(const uint8_t *buf, int len);
+void board_stacks(void);
 
 #endif /* !_SRC_BOARD_H_ */
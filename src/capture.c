@@ -0,0 +1,129 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+
+#include "arena.h"
+#include "capture.h"
+#include "dwt.h"
+#include "gcode.h"
+
+/*
+ * Step waveform capture: a one-shot RAM ring of step events, filled
+ * by the motor workers once the trigger condition is met.
+ */
+
+static struct capture_event capture_events[CAPTURE_NEVENTS] __ccm;
+static uint32_t capture_count;
+static int capture_trig;
+int capture_state;
+
+void
+capture_arm(int trigger)
+{
+
+	critical_enter();
+	capture_trig = trigger;
+	if (trigger == CAPTURE_TRIG_OFF) {
+		capture_state = CAPTURE_STATE_IDLE;
+	} else {
+		capture_count = 0;
+		if (trigger == CAPTURE_TRIG_NOW)
+			capture_state = CAPTURE_STATE_RUNNING;
+		else
+			capture_state = CAPTURE_STATE_ARMED;
+	}
+	critical_exit();
+}
+
+/*
+ * Called on a trigger condition. Starts the capture if armed for it.
+ */
+void
+capture_trigger(int trigger)
+{
+
+	critical_enter();
+	if (capture_state == CAPTURE_STATE_ARMED && capture_trig == trigger)
+		capture_state = CAPTURE_STATE_RUNNING;
+	critical_exit();
+}
+
+void
+capture_step(int axis, int dir, uint32_t index, uint32_t time)
+{
+	struct capture_event *ev;
+
+	if (capture_state != CAPTURE_STATE_RUNNING)
+		return;
+
+	critical_enter();
+	if (capture_count == CAPTURE_NEVENTS) {
+		/* Full, one-shot. */
+		capture_state = CAPTURE_STATE_IDLE;
+		critical_exit();
+		return;
+	}
+	ev = &capture_events[capture_count++];
+	ev->time = time;
+	ev->info = (axis << CAPTURE_AXIS_S) | (index & CAPTURE_INDEX_M);
+	if (dir)
+		ev->info |= CAPTURE_DIR;
+	critical_exit();
+}
+
+/*
+ * Header with the event count and the timestamp frequency, then one
+ * event per line: time (hex cycles), axis, direction, step index.
+ * tools/capvcd.py converts this into a VCD file.
+ */
+void
+capture_dump(void)
+{
+	struct capture_event *ev;
+	uint32_t count;
+	uint32_t i;
+
+	critical_enter();
+	if (capture_state == CAPTURE_STATE_RUNNING)
+		capture_state = CAPTURE_STATE_IDLE;
+	count = capture_count;
+	critical_exit();
+
+	gcode_out_lock();
+	printf("ok K:N:%u F:%u\n", count, DWT_CPU_FREQ);
+	gcode_out_unlock();
+	for (i = 0; i < count; i++) {
+		ev = &capture_events[i];
+		gcode_out_lock();
+		printf("ok K:%08x %u %u %u\n", ev->time,
+		    (ev->info & CAPTURE_AXIS_M) >> CAPTURE_AXIS_S,
+		    (ev->info & CAPTURE_DIR) ? 1 : 0,
+		    ev->info & CAPTURE_INDEX_M);
+		gcode_out_unlock();
+	}
+}
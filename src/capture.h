@@ -0,0 +1,56 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_CAPTURE_H_
+#define	_SRC_CAPTURE_H_
+
+#define	CAPTURE_NEVENTS		1024
+
+#define	CAPTURE_TRIG_OFF	0	/* Stop capturing. */
+#define	CAPTURE_TRIG_NOW	1	/* Start immediately. */
+#define	CAPTURE_TRIG_MOVE	2	/* Start of the next motor task. */
+#define	CAPTURE_TRIG_HOME	3	/* Home sensor edge on any axis. */
+
+struct capture_event {
+	uint32_t time;		/* CYCCNT at step ISR entry. */
+	uint32_t info;
+#define	CAPTURE_AXIS_S		29
+#define	CAPTURE_AXIS_M		(0x7 << CAPTURE_AXIS_S)
+#define	CAPTURE_DIR		(1 << 28)
+#define	CAPTURE_INDEX_M		0x0fffffff	/* Step index in the task. */
+};
+
+extern int capture_state;
+#define	CAPTURE_STATE_IDLE	0
+#define	CAPTURE_STATE_ARMED	1
+#define	CAPTURE_STATE_RUNNING	2
+
+void capture_arm(int trigger);
+void capture_trigger(int trigger);
+void capture_step(int axis, int dir, uint32_t index, uint32_t time);
+void capture_dump(void);
+
+#endif /* !_SRC_CAPTURE_H_ */
@@ -0,0 +1,474 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+
+#include <arm/stm/stm32f4.h>
+
+#include "board.h"
+#include "config.h"
+#include "dwt.h"
+#include "gcode.h"
+#include "job.h"
+#include "log.h"
+#include "pnp.h"
+
+/*
+ * Configuration records are appended to flash sector 7, one after
+ * another. The last record with a valid CRC wins. The sector is erased
+ * only when it is full, so each save programs a few hundred bytes.
+ */
+#define	CONFIG_BASE		0x08060000
+#define	CONFIG_SIZE		(128 * 1024)
+#define	CONFIG_SECTOR		7
+#define	CONFIG_MAGIC		0x43504e50	/* PNPC */
+#define	CONFIG_NONE		0xffffffff
+
+/* Flash interface registers. */
+#define	CONFIG_FLASH_ACR	0x00
+#define	CONFIG_ACR_DCEN		(1 << 10)
+#define	CONFIG_ACR_DCRST	(1 << 12)
+#define	CONFIG_FLASH_KEYR	0x04
+#define	CONFIG_FLASH_KEY1	0x45670123
+#define	CONFIG_FLASH_KEY2	0xCDEF89AB
+#define	CONFIG_FLASH_SR		0x0C
+#define	CONFIG_SR_ERR		(0xf << 4)	/* PGSERR..WRPERR */
+#define	CONFIG_SR_BSY		(1 << 16)
+#define	CONFIG_FLASH_CR		0x10
+#define	CONFIG_CR_PG		(1 << 0)
+#define	CONFIG_CR_SER		(1 << 1)
+#define	CONFIG_CR_SNB_S		3
+#define	CONFIG_CR_PSIZE_32	(2 << 8)
+#define	CONFIG_CR_STRT		(1 << 16)
+#define	CONFIG_CR_LOCK		(1U << 31)
+
+#define	CONFIG_FLASH_REG(off)		\
+	(*(volatile uint32_t *)(flash_sc.base + (off)))
+
+struct config_hdr {
+	uint32_t magic;		/* Programmed last. */
+	uint16_t version;
+	uint16_t size;		/* Payload size. */
+	uint32_t seq;
+	uint32_t crc;		/* CRC-32 of the payload. */
+};
+
+struct config config;
+static uint32_t config_seq;
+
+/* Payload size of each record version. */
+static const uint16_t config_sizes[CONFIG_VERSION + 1] = {
+	[1] = sizeof(struct config),
+};
+
+/* CRC-32 (IEEE 802.3), 4 bits at a time. */
+static const uint32_t config_crc_table[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+static uint32_t
+config_crc32(const uint8_t *buf, uint32_t len)
+{
+	uint32_t crc;
+
+	crc = 0xffffffff;
+	while (len--) {
+		crc ^= *buf++;
+		crc = (crc >> 4) ^ config_crc_table[crc & 0xf];
+		crc = (crc >> 4) ^ config_crc_table[crc & 0xf];
+	}
+
+	return (~crc);
+}
+
+static uint32_t
+config_record_size(uint32_t size)
+{
+
+	return (sizeof(struct config_hdr) + ((size + 3) & ~3));
+}
+
+/*
+ * Walk the record headers. Returns the offset of the free space, or
+ * CONFIG_SIZE if the sector is full or holds garbage, and the offsets
+ * of the last two records found.
+ */
+static uint32_t
+config_scan(uint32_t *last, uint32_t *prev)
+{
+	const struct config_hdr *hdr;
+	uint32_t off;
+
+	*last = *prev = CONFIG_NONE;
+
+	off = 0;
+	while (off + sizeof(struct config_hdr) <= CONFIG_SIZE) {
+		hdr = (const struct config_hdr *)(CONFIG_BASE + off);
+		if (hdr->magic == 0xffffffff)
+			return (off);
+		if (hdr->magic != CONFIG_MAGIC ||
+		    off + config_record_size(hdr->size) > CONFIG_SIZE)
+			break;
+		*prev = *last;
+		*last = off;
+		off += config_record_size(hdr->size);
+	}
+
+	return (CONFIG_SIZE);
+}
+
+static int
+config_valid(uint32_t off)
+{
+	const struct config_hdr *hdr;
+
+	if (off == CONFIG_NONE)
+		return (0);
+
+	hdr = (const struct config_hdr *)(CONFIG_BASE + off);
+
+	return (hdr->crc == config_crc32((const uint8_t *)(hdr + 1),
+	    hdr->size));
+}
+
+static int
+config_blank(uint32_t off, uint32_t size)
+{
+	const uint32_t *p;
+	uint32_t i;
+
+	p = (const uint32_t *)(CONFIG_BASE + off);
+	for (i = 0; i < size / 4; i++)
+		if (p[i] != 0xffffffff)
+			return (0);
+
+	return (1);
+}
+
+static int
+config_flash_wait(void)
+{
+	uint32_t sr;
+
+	do
+		sr = CONFIG_FLASH_REG(CONFIG_FLASH_SR);
+	while (sr & CONFIG_SR_BSY);
+
+	if (sr & CONFIG_SR_ERR) {
+		CONFIG_FLASH_REG(CONFIG_FLASH_SR) = CONFIG_SR_ERR;
+		return (-1);
+	}
+
+	return (0);
+}
+
+static void
+config_flash_unlock(void)
+{
+
+	if (CONFIG_FLASH_REG(CONFIG_FLASH_CR) & CONFIG_CR_LOCK) {
+		CONFIG_FLASH_REG(CONFIG_FLASH_KEYR) = CONFIG_FLASH_KEY1;
+		CONFIG_FLASH_REG(CONFIG_FLASH_KEYR) = CONFIG_FLASH_KEY2;
+	}
+}
+
+static void
+config_flash_lock(void)
+{
+
+	CONFIG_FLASH_REG(CONFIG_FLASH_CR) = CONFIG_CR_LOCK;
+}
+
+/*
+ * Erase the sector. The CPU stalls on instruction fetches from flash
+ * until the erase completes (about a second), so this is only done
+ * when the sector is full.
+ */
+static int
+config_flash_erase(void)
+{
+	uint32_t acr;
+	int error;
+
+	error = config_flash_wait();
+	if (error)
+		return (error);
+
+	CONFIG_FLASH_REG(CONFIG_FLASH_CR) = CONFIG_CR_PSIZE_32 | CONFIG_CR_SER |
+	    (CONFIG_SECTOR << CONFIG_CR_SNB_S);
+	CONFIG_FLASH_REG(CONFIG_FLASH_CR) |= CONFIG_CR_STRT;
+	error = config_flash_wait();
+	CONFIG_FLASH_REG(CONFIG_FLASH_CR) = 0;
+
+	/* Drop stale lines of the sector from the data cache. */
+	acr = CONFIG_FLASH_REG(CONFIG_FLASH_ACR);
+	if (acr & CONFIG_ACR_DCEN) {
+		CONFIG_FLASH_REG(CONFIG_FLASH_ACR) = acr & ~CONFIG_ACR_DCEN;
+		CONFIG_FLASH_REG(CONFIG_FLASH_ACR) = (acr & ~CONFIG_ACR_DCEN) |
+		    CONFIG_ACR_DCRST;
+		CONFIG_FLASH_REG(CONFIG_FLASH_ACR) = acr;
+	}
+
+	return (error);
+}
+
+static int
+config_flash_program(uint32_t addr, const uint32_t *data, uint32_t nwords)
+{
+	uint32_t i;
+	int error;
+
+	error = 0;
+
+	CONFIG_FLASH_REG(CONFIG_FLASH_CR) = CONFIG_CR_PSIZE_32 | CONFIG_CR_PG;
+	for (i = 0; i < nwords; i++) {
+		*(volatile uint32_t *)(addr + i * 4) = data[i];
+		error = config_flash_wait();
+		if (error)
+			break;
+	}
+	CONFIG_FLASH_REG(CONFIG_FLASH_CR) = 0;
+
+	return (error);
+}
+
+/*
+ * A version we know has its own size, a newer one has at least ours.
+ */
+static int
+config_check_version(const struct config_hdr *hdr)
+{
+
+	if (hdr->version == 0)
+		return (-1);
+	if (hdr->version <= CONFIG_VERSION)
+		return (hdr->size == config_sizes[hdr->version] ? 0 : -1);
+
+	return (hdr->size >= sizeof(struct config) ? 0 : -1);
+}
+
+/*
+ * Values the motors and the planner divide by or rely on.
+ */
+int
+config_check(const struct config *c)
+{
+	const struct config_axis *ca;
+	int i;
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		ca = &c->axis[i];
+		if (ca->revo_nm <= 0 || ca->revo_steps <= 0 ||
+		    ca->steps_min >= ca->steps_max)
+			return (-1);
+		if (ca->vmax <= 0 || ca->accel <= 0 || ca->jerk <= 0 ||
+		    ca->jerk > ca->vmax)
+			return (-1);
+		if (ca->cam_radius < 0 || ca->home_backoff <= 0 ||
+		    ca->home_into <= 0)
+			return (-1);
+	}
+
+	if (c->home_rate_fast <= 0 || c->home_rate_fast > 100 ||
+	    c->home_rate_slow <= 0 || c->home_rate_slow > 100)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Load the last valid record over the defaults in config. A record
+ * written by another firmware version is loaded up to the size both
+ * know about. Without a usable record config is reset to the defaults.
+ */
+int
+config_load(void)
+{
+	const struct config_hdr *hdr;
+	struct config c;
+	uint32_t last, prev, off;
+	uint32_t start;
+	uint32_t size;
+
+	start = dwt_cycles();
+
+	config_scan(&last, &prev);
+	if (config_valid(last))
+		off = last;
+	else if (config_valid(prev))
+		off = prev;
+	else {
+		log_info(LOG_CONFIG, "no valid record, using defaults\n");
+		pnp_config_defaults();
+		return (-1);
+	}
+
+	hdr = (const struct config_hdr *)(CONFIG_BASE + off);
+	if (config_check_version(hdr)) {
+		log_err(LOG_CONFIG, "record %u version %u size %u, "
+		    "using defaults\n", hdr->seq, hdr->version, hdr->size);
+		pnp_config_defaults();
+		return (-1);
+	}
+
+	/* Fields the record does not have keep their defaults. */
+	pnp_config_defaults();
+	c = config;
+	size = hdr->size;
+	if (size > sizeof(struct config))
+		size = sizeof(struct config);
+	memcpy(&c, hdr + 1, size);
+	if (config_check(&c)) {
+		log_err(LOG_CONFIG, "record %u out of range, using defaults\n",
+		    hdr->seq);
+		return (-1);
+	}
+	config = c;
+	config_seq = hdr->seq;
+
+	log_info(LOG_CONFIG, "loaded record %u version %u in %u us\n",
+	    hdr->seq, hdr->version, dwt_cycles_to_us(dwt_cycles() - start));
+
+	return (0);
+}
+
+int
+config_save(void)
+{
+	struct config_hdr hdr;
+	uint32_t last, prev, off;
+	uint32_t size;
+	int error;
+
+	size = config_record_size(sizeof(struct config));
+
+	hdr.magic = CONFIG_MAGIC;
+	hdr.version = CONFIG_VERSION;
+	hdr.size = sizeof(struct config);
+	hdr.seq = config_seq + 1;
+	hdr.crc = config_crc32((const uint8_t *)&config,
+	    sizeof(struct config));
+
+	off = config_scan(&last, &prev);
+
+	config_flash_unlock();
+
+	if (off + size > CONFIG_SIZE || !config_blank(off, size)) {
+		log_info(LOG_CONFIG, "erasing sector %d\n", CONFIG_SECTOR);
+		error = config_flash_erase();
+		if (error)
+			goto out;
+		off = 0;
+	}
+
+	/* Payload and header, the magic goes last. */
+	error = config_flash_program(CONFIG_BASE + off + sizeof(hdr),
+	    (const uint32_t *)&config, sizeof(struct config) / 4);
+	if (error == 0)
+		error = config_flash_program(CONFIG_BASE + off + 4,
+		    (const uint32_t *)&hdr + 1, sizeof(hdr) / 4 - 1);
+	if (error == 0)
+		error = config_flash_program(CONFIG_BASE + off,
+		    &hdr.magic, 1);
+
+out:
+	config_flash_lock();
+
+	if (error == 0 && !config_valid(off))
+		error = -1;
+	if (error) {
+		log_err(LOG_CONFIG, "failed to write record at %x\n", off);
+		return (error);
+	}
+
+	config_seq = hdr.seq;
+	log_info(LOG_CONFIG, "saved record %u at %x\n", hdr.seq, off);
+
+	return (0);
+}
+
+static void
+config_report(void)
+{
+	static const char letters[PNP_NAXES] = { 'X', 'Y', 'Z', 'I', 'J' };
+	struct config_axis *ca;
+	int i;
+
+	gcode_out_lock();
+	printf("ok V:%d R:%u F:%d S:%d\n", CONFIG_VERSION, config_seq,
+	    config.home_rate_fast, config.home_rate_slow);
+	gcode_out_unlock();
+
+	/* Lengths in um (or 10^-3 deg), velocities in mm (or deg). */
+	for (i = 0; i < PNP_NAXES; i++) {
+		ca = &config.axis[i];
+		gcode_out_lock();
+		printf("ok %c R:%d N:%d L:%d:%d V:%d A:%d J:%d C:%d B:%d"
+		    " I:%d\n", letters[i],
+		    (int)(ca->revo_nm / 1000), ca->revo_steps,
+		    ca->steps_min, ca->steps_max,
+		    (int)(ca->vmax / GCODE_FIXED_ONE),
+		    (int)(ca->accel / GCODE_FIXED_ONE),
+		    (int)(ca->jerk / GCODE_FIXED_ONE),
+		    (int)(ca->cam_radius / 1000),
+		    (int)(ca->home_backoff / 1000),
+		    (int)(ca->home_into / 1000));
+		gcode_out_unlock();
+	}
+}
+
+void
+config_command(struct gcode_command *cmd)
+{
+
+	switch (cmd->code) {
+	case 500:
+		/* The CPU stalls on flash during an erase. */
+		if (!pnp_idle() || job_running()) {
+			gcode_out_lock();
+			printf("ERR: moving\n");
+			gcode_out_unlock();
+			break;
+		}
+		config_save();
+		break;
+	case 501:
+		config_load();
+		pnp_config_apply();
+		break;
+	case 502:
+		pnp_config_defaults();
+		pnp_config_apply();
+		break;
+	case 503:
+		config_report();
+		break;
+	}
+}
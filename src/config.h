@@ -0,0 +1,71 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_CONFIG_H_
+#define	_SRC_CONFIG_H_
+
+/*
+ * Bump when fields are appended to struct config. Fields are never
+ * removed or reordered, so the prefix stored by an older firmware is
+ * still loaded and only the new fields keep their defaults. Each
+ * version has its payload size in config_sizes[].
+ */
+#define	CONFIG_VERSION		1
+
+/* Stored layout, at least PNP_NAXES. */
+#define	CONFIG_NAXES		5
+
+/* Lengths in nm (X, Y) or 10^-6 degrees (Z cam, nozzles). */
+struct config_axis {
+	int64_t revo_nm;	/* per revo_steps steps */
+	int64_t vmax;		/* per s */
+	int64_t accel;		/* per s^2 */
+	int64_t jerk;		/* per s, start and stop velocity */
+	int64_t cam_radius;	/* nm, 0 unless translated into rotation */
+	int64_t home_backoff;	/* Back-off from the home switch. */
+	int64_t home_into;	/* Final move into the home switch. */
+	int32_t revo_steps;
+	int32_t steps_min;
+	int32_t steps_max;
+	int32_t reserved;
+};
+
+struct config {
+	struct config_axis axis[CONFIG_NAXES];
+	int32_t home_rate_fast;	/* Percent of the maximum step rate. */
+	int32_t home_rate_slow;
+};
+
+extern struct config config;
+
+struct gcode_command;
+
+int config_check(const struct config *c);
+int config_load(void);
+int config_save(void);
+void config_command(struct gcode_command *cmd);
+
+#endif /* !_SRC_CONFIG_H_ */
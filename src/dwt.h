@@ -0,0 +1,67 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_DWT_H_
+#define	_SRC_DWT_H_
+
+/*
+ * Cortex-M4 Data Watchpoint and Trace unit: free running CPU cycle counter.
+ */
+
+#define	DWT_BASE		0xE0001000
+#define	 DWT_CTRL		0x00
+#define	  CTRL_CYCCNTENA	(1 << 0)
+#define	 DWT_CYCCNT		0x04
+#define	SCB_DEMCR		0xE000EDFC
+#define	 DEMCR_TRCENA		(1 << 24)
+
+#define	DWT_CPU_FREQ		168000000
+#define	DWT_CYCLES_PER_US	(DWT_CPU_FREQ / 1000000)
+
+static inline void
+dwt_init(void)
+{
+
+	*(volatile uint32_t *)SCB_DEMCR |= DEMCR_TRCENA;
+	*(volatile uint32_t *)(DWT_BASE + DWT_CYCCNT) = 0;
+	*(volatile uint32_t *)(DWT_BASE + DWT_CTRL) |= CTRL_CYCCNTENA;
+}
+
+static inline uint32_t
+dwt_cycles(void)
+{
+
+	return (*(volatile uint32_t *)(DWT_BASE + DWT_CYCCNT));
+}
+
+static inline uint32_t
+dwt_cycles_to_us(uint32_t cycles)
+{
+
+	return (cycles / DWT_CYCLES_PER_US);
+}
+
+#endif /* !_SRC_DWT_H_ */
@@ -0,0 +1,745 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+
+#include "arena.h"
+#include "board.h"
+#include "dwt.h"
+#include "frame.h"
+#include "gcode.h"
+#include "job.h"
+#include "pnp.h"
+
+/*
+ * Binary frames sharing the console with G-code. The main loop feeds
+ * the bytes of a frame here one by one, the command is run once the
+ * frame is complete and its CRC checks out.
+ *
+ * The step scheduling frames let a host drive the steppers directly:
+ * the host syncs to the CYCCNT clock, computes step times itself and
+ * sends them compressed into segments of steps with a constant change
+ * of interval, which the step timer interrupt replays (pnp_sched_*).
+ *
+ * A batch frame carries the moves and actuations of a placement in a
+ * fraction of the bytes of the G-code lines, and takes one short reply
+ * instead of OK and COMPLETE per line.
+ * Macros go further: defined once per session, a placement step is
+ * then a call with its coordinates.
+ *
+ * In a job the firmware runs the placements on its own, see job.c.
+ */
+
+int frame_enabled;
+
+static uint8_t frame_buf[FRAME_MAXLEN + 4] __ccm;
+static int frame_ptr;		/* Bytes received after the sync. */
+static int frame_len;		/* Bytes expected after the sync. */
+
+/*
+ * CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF.
+ */
+uint16_t
+frame_crc16(uint16_t crc, const uint8_t *buf, int len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= (uint16_t)*buf++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return (crc);
+}
+
+static inline uint32_t
+frame_get32(const uint8_t *p)
+{
+
+	return (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static inline uint16_t
+frame_get16(const uint8_t *p)
+{
+
+	return (p[0] | (p[1] << 8));
+}
+
+static inline void
+frame_put32(uint8_t *p, uint32_t val)
+{
+
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
+
+void
+frame_send(int type, const uint8_t *payload, int len)
+{
+	uint8_t buf[FRAME_MAXLEN + FRAME_OVERHEAD];
+	uint16_t crc;
+
+	buf[0] = FRAME_SYNC;
+	buf[1] = len;
+	buf[2] = type;
+	if (len > 0)
+		memcpy(&buf[3], payload, len);
+	crc = frame_crc16(0xffff, &buf[1], len + 2);
+	buf[len + 3] = crc;
+	buf[len + 4] = crc >> 8;
+
+	gcode_out_lock();
+	board_console_write(buf, len + FRAME_OVERHEAD);
+	gcode_out_unlock();
+}
+
+static void
+frame_nak(int type, int err, int index)
+{
+	uint8_t reply[3];
+
+	reply[0] = type;
+	reply[1] = err;
+	reply[2] = index;
+
+	frame_send(FRAME_NAK | FRAME_REPLY, reply, sizeof(reply));
+}
+
+/*
+ * Two clock samples bracket the reply so that the host can take the
+ * one-way delay out of its clock estimate.
+ */
+static void
+frame_clock(void)
+{
+	uint8_t reply[8];
+
+	frame_put32(&reply[0], dwt_cycles());
+	frame_put32(&reply[4], DWT_CPU_FREQ);
+
+	frame_send(FRAME_CLOCK | FRAME_REPLY, reply, sizeof(reply));
+}
+
+static void
+frame_step_clock(const uint8_t *p, int len)
+{
+
+	if (len != 5 || p[0] >= PNP_NAXES) {
+		frame_nak(FRAME_STEP_CLOCK, FRAME_ERR_ARG, 0);
+		return;
+	}
+
+	if (pnp_sched_start(p[0], frame_get32(&p[1])) != 0) {
+		frame_nak(FRAME_STEP_CLOCK, FRAME_ERR_BUSY, 0);
+		return;
+	}
+
+	frame_send(FRAME_STEP_CLOCK | FRAME_REPLY, NULL, 0);
+}
+
+/*
+ * Segments are queued in order up to the first one refused, whose index
+ * comes with the NAK so the host can resend from there.
+ */
+static void
+frame_queue_step(const uint8_t *p, int len)
+{
+	uint8_t reply[1];
+	int err;
+	int i;
+
+	if (len == 0 || len % FRAME_SEG_LEN) {
+		frame_nak(FRAME_QUEUE_STEP, FRAME_ERR_ARG, 0);
+		return;
+	}
+
+	for (i = 0; i < len / FRAME_SEG_LEN; i++, p += FRAME_SEG_LEN) {
+		err = pnp_sched_queue(p[0] & 0x7f, p[0] >> 7,
+		    frame_get32(&p[1]), frame_get16(&p[5]),
+		    (int16_t)frame_get16(&p[7]));
+		if (err == 0)
+			continue;
+		if (err == -1)
+			err = FRAME_ERR_ARG;
+		else if (err == -2)
+			err = FRAME_ERR_BUSY;
+		else
+			err = FRAME_ERR_FULL;
+		frame_nak(FRAME_QUEUE_STEP, err, i);
+		return;
+	}
+
+	reply[0] = i;
+	frame_send(FRAME_QUEUE_STEP | FRAME_REPLY, reply, sizeof(reply));
+}
+
+/*
+ * Reply: u8 axis, u8 free segments, u8 active, i32 position,
+ * u32 late steps, u32 schedules stopped at a travel limit.
+ */
+static void
+frame_sched_status(const uint8_t *p, int len)
+{
+	struct pnp_sched_stat st;
+	uint8_t reply[15];
+
+	if (len != 1 || p[0] >= PNP_NAXES) {
+		frame_nak(FRAME_SCHED_STATUS, FRAME_ERR_ARG, 0);
+		return;
+	}
+
+	pnp_sched_stat(p[0], &st);
+
+	reply[0] = p[0];
+	reply[1] = st.free;
+	reply[2] = st.active;
+	frame_put32(&reply[3], st.steps);
+	frame_put32(&reply[7], st.late);
+	frame_put32(&reply[11], st.stopped);
+
+	frame_send(FRAME_SCHED_STATUS | FRAME_REPLY, reply, sizeof(reply));
+}
+
+/*
+ * Zigzag LEB128 of up to 32 bits, returns the bytes used or -1.
+ */
+static int
+frame_varint(const uint8_t *p, int len, int64_t *val)
+{
+	uint32_t v;
+	int i;
+
+	v = 0;
+	for (i = 0; i < len && i < 5; i++) {
+		v |= (uint32_t)(p[i] & 0x7f) << (7 * i);
+		if ((p[i] & 0x80) == 0) {
+			*val = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+			return (i + 1);
+		}
+	}
+
+	return (-1);
+}
+
+/*
+ * Decode one batch record into a command, returns its length or -1.
+ * A SENSE record leaves the command type 0. Moves of a macro take the
+ * fields marked in the argument mask from args.
+ */
+static int
+frame_record(const uint8_t *p, int len, const int64_t *args, int nargs,
+    struct gcode_command *cmd)
+{
+	int64_t *val[6];
+	int *set[6];
+	int argmask;
+	int target;
+	int op;
+	int n;
+	int k;
+	int i;
+
+	bzero(cmd, sizeof(struct gcode_command));
+
+	op = p[0];
+	if (op & FRAME_OP_MOVE) {
+		val[0] = &cmd->x;
+		val[1] = &cmd->y;
+		val[2] = &cmd->z;
+		val[3] = &cmd->h1;
+		val[4] = &cmd->h2;
+		val[5] = &cmd->f;
+		set[0] = &cmd->x_set;
+		set[1] = &cmd->y_set;
+		set[2] = &cmd->z_set;
+		set[3] = &cmd->h1_set;
+		set[4] = &cmd->h2_set;
+		set[5] = &cmd->f_set;
+		cmd->type = CMD_TYPE_MOVE;
+		cmd->letter = 'G';
+		n = 1;
+		argmask = 0;
+		if (op & FRAME_MOVE_ARGS) {
+			if (len < 2 || (p[1] & ~op & 0x3f) != 0)
+				return (-1);
+			argmask = p[1];
+			n = 2;
+		}
+		for (i = 0; i < 6; i++) {
+			if ((op & (1 << i)) == 0)
+				continue;
+			if (argmask & (1 << i)) {
+				if (n >= len || p[n] >= nargs)
+					return (-1);
+				*val[i] = args[p[n]];
+				k = 1;
+			} else {
+				k = frame_varint(&p[n], len - n, val[i]);
+				if (k < 0)
+					return (-1);
+			}
+			*val[i] *= (i == 5) ? GCODE_FIXED_ONE :
+			    GCODE_FIXED_ONE / 1000;
+			*set[i] = 1;
+			n += k;
+		}
+		return (n);
+	}
+
+	if ((op & ~0x0f) == FRAME_OP_ACTUATE) {
+		target = (op >> 1) & 0x7;
+		if (target < PNP_ACTUATE_TARGET_PUMP ||
+		    target > PNP_ACTUATE_TARGET_PEEL)
+			return (-1);
+		cmd->type = CMD_TYPE_ACTUATE;
+		cmd->letter = 'M';
+		cmd->code = 800;
+		cmd->actuate_target = target;
+		cmd->actuate_value = op & 1;
+		return (1);
+	}
+
+	if (op == FRAME_OP_WAIT) {
+		cmd->type = CMD_TYPE_WAIT;
+		cmd->letter = 'M';
+		cmd->code = 400;
+		return (1);
+	}
+
+	if (op == FRAME_OP_SENSE)
+		return (1);
+
+	return (-1);
+}
+
+/*
+ * Check records, returns the index of the first bad one or -1.
+ */
+static int
+frame_check(const uint8_t *p, int len, int nargs)
+{
+	struct gcode_command cmd;
+	int64_t args[FRAME_MACRO_ARGS];
+	int off;
+	int i;
+	int n;
+
+	bzero(args, sizeof(args));
+
+	for (off = 0, i = 0; off < len; off += n, i++)
+		if ((n = frame_record(&p[off], len - off, args, nargs,
+		    &cmd)) < 0)
+			return (i);
+
+	return (-1);
+}
+
+/*
+ * Run checked records and send the reply of a batch. An abort ends
+ * them after the record in progress.
+ */
+static void
+frame_run(const uint8_t *seq, const uint8_t *p, int len,
+    const int64_t *args, int nargs, int err)
+{
+	struct gcode_command cmd;
+	uint8_t reply[5];
+	int sensed;
+	int done;
+	int off;
+	int n;
+
+	done = 0;
+	sensed = -1;
+
+	for (off = 0; err == 0 && off < len; off += n) {
+		if (pnp_feed_state() == PNP_CTL_ABORT) {
+			err = FRAME_ERR_ABORT;
+			break;
+		}
+		n = frame_record(&p[off], len - off, args, nargs, &cmd);
+		if (cmd.type != 0)
+			gcode_execute(&cmd);
+		else
+			sensed = gcode_vacuum();
+		done += 1;
+	}
+
+	reply[0] = seq != NULL ? seq[0] : 0;
+	reply[1] = seq != NULL ? seq[1] : 0;
+	reply[2] = done;
+	reply[3] = err;
+	reply[4] = sensed >= 0 ? sensed : gcode_vacuum();
+
+	frame_send(FRAME_BATCH | FRAME_REPLY, reply, sizeof(reply));
+}
+
+/*
+ * The whole batch is checked before anything runs.
+ */
+static void
+frame_batch(const uint8_t *p, int len)
+{
+	int err;
+
+	err = 0;
+	if (len < 2 || frame_check(&p[2], len - 2, 0) >= 0)
+		err = FRAME_ERR_ARG;
+
+	frame_run(len >= 2 ? p : NULL, &p[2], len >= 2 ? len - 2 : 0,
+	    NULL, 0, err);
+}
+
+/*
+ * Macros: the records of a placement step stored once, with the values
+ * that change from one component to the next left as arguments. They
+ * are checked when defined and kept in RAM until reset or redefined.
+ */
+struct frame_macro {
+	uint8_t len;		/* Of the records, 0 if undefined. */
+	uint8_t nargs;
+	uint8_t rec[FRAME_MACRO_LEN];
+};
+
+static struct frame_macro frame_macros[FRAME_MACRO_N] __ccm;
+
+static void
+frame_macro_define(const uint8_t *p, int len)
+{
+	struct frame_macro *m;
+	uint8_t reply[2];
+	int bad;
+	int i;
+
+	if (len < 2 || p[0] >= FRAME_MACRO_N || p[1] > FRAME_MACRO_ARGS) {
+		frame_nak(FRAME_MACRO_DEFINE, FRAME_ERR_ARG, 0);
+		return;
+	}
+
+	bad = frame_check(&p[2], len - 2, p[1]);
+	if (bad >= 0) {
+		frame_nak(FRAME_MACRO_DEFINE, FRAME_ERR_ARG, bad);
+		return;
+	}
+
+	m = &frame_macros[p[0]];
+	m->len = len - 2;
+	m->nargs = p[1];
+	memcpy(m->rec, &p[2], len - 2);
+
+	reply[0] = p[0];
+	reply[1] = 0;
+	for (i = 0; i < FRAME_MACRO_N; i++)
+		if (frame_macros[i].len == 0)
+			reply[1] += 1;
+
+	frame_send(FRAME_MACRO_DEFINE | FRAME_REPLY, reply, sizeof(reply));
+}
+
+static void
+frame_macro_call(const uint8_t *p, int len)
+{
+	int64_t args[FRAME_MACRO_ARGS];
+	struct frame_macro *m;
+	int nargs;
+	int err;
+	int off;
+	int n;
+
+	m = NULL;
+	err = 0;
+	nargs = 0;
+	if (len < 3)
+		err = FRAME_ERR_ARG;
+	else if (p[2] >= FRAME_MACRO_N || frame_macros[p[2]].len == 0)
+		err = FRAME_ERR_MACRO;
+	else
+		m = &frame_macros[p[2]];
+
+	for (off = 3; err == 0 && off < len; off += n) {
+		if (nargs == m->nargs) {
+			err = FRAME_ERR_ARG;
+			break;
+		}
+		n = frame_varint(&p[off], len - off, &args[nargs]);
+		if (n < 0) {
+			err = FRAME_ERR_ARG;
+			break;
+		}
+		nargs += 1;
+	}
+	if (err == 0 && nargs != m->nargs)
+		err = FRAME_ERR_ARG;
+
+	if (m == NULL)
+		frame_run(len >= 2 ? p : NULL, NULL, 0, NULL, 0, err);
+	else
+		frame_run(p, m->rec, m->len, args, nargs, err);
+}
+
+static int
+frame_varints(const uint8_t *p, int len, int32_t *val, int n)
+{
+	int64_t v;
+	int off;
+	int k;
+	int i;
+
+	for (off = 0, i = 0; i < n; i++, off += k) {
+		if ((k = frame_varint(&p[off], len - off, &v)) < 0)
+			return (-1);
+		val[i] = v;
+	}
+
+	return (off);
+}
+
+static void
+frame_job_start(const uint8_t *p, int len)
+{
+	struct job_conf conf;
+	int32_t val[4];
+
+	if (len < 3 || frame_varints(&p[3], len - 3, val, 4) != len - 3) {
+		frame_nak(FRAME_JOB_START, FRAME_ERR_ARG, 0);
+		return;
+	}
+
+	conf.count = frame_get16(p);
+	conf.retries = p[2];
+	conf.camera_x = val[0];
+	conf.camera_y = val[1];
+	conf.discard_x = val[2];
+	conf.discard_y = val[3];
+
+	if (job_start(&conf)) {
+		frame_nak(FRAME_JOB_START, FRAME_ERR_BUSY, 0);
+		return;
+	}
+
+	frame_send(FRAME_JOB_START | FRAME_REPLY, p, 2);
+}
+
+static void
+frame_job_load(const uint8_t *p, int len)
+{
+	struct job_part part;
+	uint8_t reply[4];
+	int32_t val[7];
+	int loaded;
+	int index;
+	int next;
+	int err;
+	int off;
+	int i;
+	int n;
+
+	if (len < 2) {
+		frame_nak(FRAME_JOB_LOAD, FRAME_ERR_ARG, 0);
+		return;
+	}
+
+	index = frame_get16(p);
+	for (off = 2, i = 0; off < len; off += n + 1, i++) {
+		n = frame_varints(&p[off + 1], len - off - 1, val, 7);
+		part.flags = p[off];
+		part.pick_x = val[0];
+		part.pick_y = val[1];
+		part.pick_z = val[2];
+		part.place_x = val[3];
+		part.place_y = val[4];
+		part.place_z = val[5];
+		part.rot = val[6];
+		if (n < 0 || (part.flags & JOB_NOZZLE) == 0 ||
+		    (part.flags & JOB_NOZZLE) == JOB_NOZZLE ||
+		    part.pick_z < 0 || part.place_z < 0)
+			err = -1;
+		else
+			err = job_load(index + i, &part);
+		if (err) {
+			frame_nak(FRAME_JOB_LOAD, err == -2 ? FRAME_ERR_FULL :
+			    FRAME_ERR_ARG, i);
+			return;
+		}
+	}
+
+	job_progress(&loaded, &next);
+	reply[0] = loaded;
+	reply[1] = loaded >> 8;
+	reply[2] = next;
+	reply[3] = next >> 8;
+
+	frame_send(FRAME_JOB_LOAD | FRAME_REPLY, reply, sizeof(reply));
+}
+
+static void
+frame_job_correct(const uint8_t *p, int len)
+{
+	int32_t val[3];
+
+	val[0] = val[1] = val[2] = 0;
+	if (len < 3 || (p[2] == 0 &&
+	    frame_varints(&p[3], len - 3, val, 3) != len - 3) ||
+	    (p[2] != 0 && len != 3) ||
+	    job_correct(frame_get16(p), p[2], val[0], val[1], val[2])) {
+		frame_nak(FRAME_JOB_CORRECT, FRAME_ERR_ARG, 0);
+		return;
+	}
+
+	frame_send(FRAME_JOB_CORRECT | FRAME_REPLY, p, 2);
+}
+
+/*
+ * M926: report the frame protocol, S1 turns frames on, S0 off. The host
+ * waits for COMPLETE before sending the first frame.
+ */
+void
+frame_command(struct gcode_command *cmd)
+{
+
+	if (cmd->s_set)
+		frame_enabled = cmd->s ? 1 : 0;
+
+	gcode_out_lock();
+	printf("ok P:%d L:%d S:%d\n", FRAME_VERSION, FRAME_MAXLEN,
+	    frame_enabled);
+	gcode_out_unlock();
+}
+
+static void
+frame_execute(int type, const uint8_t *p, int len)
+{
+
+	/* The job has the machine. */
+	if (job_running() && (type == FRAME_STEP_CLOCK ||
+	    type == FRAME_QUEUE_STEP || type == FRAME_BATCH ||
+	    type == FRAME_MACRO_CALL)) {
+		frame_nak(type, FRAME_ERR_BUSY, 0);
+		return;
+	}
+
+	switch (type) {
+	case FRAME_CLOCK:
+		frame_clock();
+		break;
+	case FRAME_STEP_CLOCK:
+		frame_step_clock(p, len);
+		break;
+	case FRAME_QUEUE_STEP:
+		frame_queue_step(p, len);
+		break;
+	case FRAME_SCHED_STATUS:
+		frame_sched_status(p, len);
+		break;
+	case FRAME_BATCH:
+		frame_batch(p, len);
+		break;
+	case FRAME_MACRO_DEFINE:
+		frame_macro_define(p, len);
+		break;
+	case FRAME_MACRO_CALL:
+		frame_macro_call(p, len);
+		break;
+	case FRAME_JOB_START:
+		frame_job_start(p, len);
+		break;
+	case FRAME_JOB_LOAD:
+		frame_job_load(p, len);
+		break;
+	case FRAME_JOB_CORRECT:
+		frame_job_correct(p, len);
+		break;
+	default:
+		frame_nak(type, FRAME_ERR_TYPE, 0);
+	}
+}
+
+/*
+ * Feed one byte of the input, the sync byte included. Returns 1 once
+ * the frame is complete. The length byte alone decides where a frame
+ * ends, as in gcode_usart_intr(), so both stay in step whatever the
+ * content.
+ */
+int
+frame_input(uint8_t ch)
+{
+	uint16_t crc;
+	int len;
+
+	if (frame_len == 0) {
+		/* The sync byte. */
+		frame_len = -1;
+		return (0);
+	}
+
+	if (frame_len < 0) {
+		frame_len = ch + 4;
+		frame_ptr = 0;
+	}
+
+	if (frame_ptr < (int)sizeof(frame_buf))
+		frame_buf[frame_ptr] = ch;
+	frame_ptr += 1;
+	if (frame_ptr < frame_len)
+		return (0);
+
+	len = frame_buf[0];
+	frame_len = 0;
+
+	if (len > FRAME_MAXLEN) {
+		frame_nak(0, FRAME_ERR_LEN, 0);
+		return (1);
+	}
+
+	crc = frame_crc16(0xffff, frame_buf, len + 2);
+	if (crc != frame_get16(&frame_buf[len + 2])) {
+		frame_nak(frame_buf[1], FRAME_ERR_CRC, 0);
+		return (1);
+	}
+
+	frame_execute(frame_buf[1], &frame_buf[2], len);
+
+	return (1);
+}
+
+int
+frame_busy(void)
+{
+
+	return (frame_len != 0);
+}
+
+void
+frame_reset(void)
+{
+
+	frame_len = 0;
+}
@@ -0,0 +1,130 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_FRAME_H_
+#define	_SRC_FRAME_H_
+
+/*
+ * Binary frames on the G-code console:
+ *
+ *   sync, len, type, payload[len], crc16
+ *
+ * The CRC is CRC-16/CCITT-FALSE over len, type and the payload, sent
+ * low byte first, as are all multibyte fields. A frame starts with the
+ * sync byte at the beginning of a line and counts as one line. Replies
+ * have the top bit of the type set. Frames are off until M926 S1.
+ */
+#define	FRAME_VERSION		1
+#define	FRAME_SYNC		0xA5
+#define	FRAME_MAXLEN		120	/* Payload. */
+#define	FRAME_OVERHEAD		5
+
+#define	FRAME_CLOCK		0x01	/* Reply: u32 clock, u32 freq */
+#define	FRAME_STEP_CLOCK	0x02	/* u8 axis, u32 clock */
+#define	FRAME_QUEUE_STEP	0x03	/* Step segments, see below. */
+#define	FRAME_SCHED_STATUS	0x04	/* u8 axis, see frame.c */
+#define	FRAME_BATCH		0x05	/* u16 seq, records, see below */
+#define	FRAME_MACRO_DEFINE	0x06	/* u8 id, u8 args, records */
+#define	FRAME_MACRO_CALL	0x07	/* u16 seq, u8 id, args */
+#define	FRAME_JOB_START		0x08	/* See below. */
+#define	FRAME_JOB_LOAD		0x09
+#define	FRAME_JOB_CORRECT	0x0A
+#define	FRAME_JOB_EVENT		0x0B	/* Sent by the job, see job.h */
+#define	FRAME_NAK		0x7F	/* u8 type, u8 error, u8 index */
+#define	FRAME_REPLY		0x80
+
+/*
+ * QUEUE_STEP payload: one or more segments of
+ *   u8 axis | dir << 7, u32 interval, u16 count, i16 add
+ * The n-th step of a segment comes interval + n * add cycles after the
+ * previous one.
+ */
+#define	FRAME_SEG_LEN		9
+
+/*
+ * BATCH records, run in order as the equivalent G-code lines. A move
+ * is followed by the fields in its mask as zigzag LEB128 varints:
+ * positions in 10^-3 mm or degrees, the feedrate in mm/min.
+ * Reply: u16 seq, u8 records done, u8 error, u8 gcode_vacuum() at the
+ * last SENSE or at the end.
+ *
+ * MACRO_DEFINE stores records in RAM under an id, empty to delete it.
+ * In a macro, a move may take fields from the arguments of the call:
+ * with FRAME_MOVE_ARGS the mask is followed by a mask of the fields
+ * given as an u8 argument number instead of a varint. MACRO_CALL
+ * passes the arguments as varints and is answered as a batch.
+ * Reply to MACRO_DEFINE: u8 id, u8 macros free.
+ */
+/*
+ * Autonomous job (job.c), positions as varints in 10^-3 mm or degrees.
+ * JOB_START: u16 parts, u8 pick retries, camera X, Y, discard X, Y.
+ *   Reply: u16 parts.
+ * JOB_LOAD: u16 index of the first part, parts of
+ *   u8 nozzle | flags, pick X, Y, depth, place X, Y, depth, rotation.
+ *   Parts are loaded in order up to the first one refused, whose index
+ *   comes with the NAK. Reply: u16 parts loaded, u16 parts taken.
+ * JOB_CORRECT: u16 index, u8 flags, and unless flags are set dX, dY
+ *   and the rotation. Reply: u16 index.
+ * JOB_EVENT: u16 index, u8 event, u8 pick tries.
+ */
+
+#define	FRAME_MACRO_N		16
+#define	FRAME_MACRO_ARGS	16
+#define	FRAME_MACRO_LEN		(FRAME_MAXLEN - 2)
+
+#define	FRAME_OP_WAIT		0x01	/* M400 */
+#define	FRAME_OP_SENSE		0x02	/* M105 */
+#define	FRAME_OP_ACTUATE	0x20	/* | target << 1 | value, as M800 */
+#define	FRAME_OP_MOVE		0x40	/* | mask */
+#define	 FRAME_MOVE_X		(1 << 0)
+#define	 FRAME_MOVE_Y		(1 << 1)
+#define	 FRAME_MOVE_Z		(1 << 2)
+#define	 FRAME_MOVE_I		(1 << 3)
+#define	 FRAME_MOVE_J		(1 << 4)
+#define	 FRAME_MOVE_F		(1 << 5)
+#define	 FRAME_MOVE_ARGS	(1 << 7)
+
+#define	FRAME_ERR_CRC		1
+#define	FRAME_ERR_LEN		2
+#define	FRAME_ERR_TYPE		3
+#define	FRAME_ERR_ARG		4
+#define	FRAME_ERR_BUSY		5
+#define	FRAME_ERR_FULL		6
+#define	FRAME_ERR_ABORT		7
+#define	FRAME_ERR_MACRO		8
+
+struct gcode_command;
+
+extern int frame_enabled;
+
+uint16_t frame_crc16(uint16_t crc, const uint8_t *buf, int len);
+int frame_input(uint8_t ch);
+int frame_busy(void);
+void frame_reset(void);
+void frame_send(int type, const uint8_t *payload, int len);
+void frame_command(struct gcode_command *cmd);
+
+#endif /* !_SRC_FRAME_H_ */
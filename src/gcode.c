@@ -33,9 +33,20 @@
 
 #include <arm/stm/stm32f4.h>
 
+#include "arena.h"
 #include "board.h"
+#include "bench.h"
+#include "capture.h"
+#include "config.h"
+#include "dwt.h"
+#include "frame.h"
 #include "gcode.h"
+#include "gpio.h"
+#include "job.h"
+#include "log.h"
+#include "planner.h"
 #include "pnp.h"
+#include "telemetry.h"
 
 #define	GCODE_DEBUG
 #undef	GCODE_DEBUG
@@ -46,13 +57,97 @@
 #define	dprintf(fmt, ...)
 #endif
 
+/* Saturate the integer part, times GCODE_FIXED_ONE it fits int64_t. */
+#define	GCODE_FIXED_INT_MAX	1000000000000LL
+
 #define	DMA_BUF_SIZE	4096
 #define	MAX_GCODE_LEN	256
 
+/* Bytes a host may have sent ahead of the lines acknowledged. */
+#define	GCODE_WINDOW	(DMA_BUF_SIZE - MAX_GCODE_LEN)
+
+/* Real-time characters, acted upon in the receive interrupt. */
+#define	GCODE_RT_STATUS		'?'
+#define	GCODE_RT_HOLD		'!'
+#define	GCODE_RT_RESUME		'~'
+#define	GCODE_RT_ABORT		0x18	/* Ctrl-X */
+#define	GCODE_IS_RT(ch)		((ch) == GCODE_RT_STATUS ||		\
+				 (ch) == GCODE_RT_HOLD ||		\
+				 (ch) == GCODE_RT_RESUME ||		\
+				 (ch) == GCODE_RT_ABORT)
+
+#define	GCODE_USART_SR		0x00
+#define	GCODE_SR_TC		(1 << 6)
+#define	GCODE_USART_BRR		0x08
+#define	GCODE_USART_CR1		0x0C
+#define	GCODE_CR1_IDLEIE	(1 << 4)
+#define	GCODE_USART_REG(off)	\
+	(*(volatile uint32_t *)(USART1_BASE + (off)))
+
+/* DMA2 stream 2 receives the console, half and full buffer interrupts. */
+#define	GCODE_DMA_LIFCR		0x08
+#define	GCODE_DMA_LIFCR_S2	(0x3d << 16)	/* All stream 2 flags. */
+#define	GCODE_DMA_S2CR		0x40
+#define	GCODE_DMA_CR_HTIE	(1 << 3)
+#define	GCODE_DMA_CR_TCIE	(1 << 4)
+#define	GCODE_DMA_REG(off)	\
+	(*(volatile uint32_t *)(DMA2_BASE + (off)))
+
+#define	GCODE_THREAD_STACK_SIZE	2048
+
+/* Console rate, M927. USART1 is clocked as set up in board_init(). */
+#define	GCODE_USART_CLK		42000000
+#define	GCODE_BAUD_DEFAULT	115200
+#define	GCODE_BAUD_TIMEOUT	(500 * 1000 * DWT_CYCLES_PER_US)
+
+/* Input is looked at on IDLE, or at this interval at the latest. */
+#define	GCODE_POLL_US		10000
+
+/* DMA target, must stay in SRAM. */
 static uint8_t dma_buffer[DMA_BUF_SIZE];
-static uint8_t cmd_buffer[MAX_GCODE_LEN];
+static uint8_t cmd_buffer[MAX_GCODE_LEN] __ccm;
 static int cmd_buffer_ptr;
 
+static uint32_t gcode_rt_ptr;		/* Scanned for real-time chars. */
+static int gcode_rt_skip;		/* Frame bytes left, -1: length. */
+static int gcode_rt_bol;		/* At the beginning of a line. */
+static volatile uint32_t gcode_rx_lines;	/* Lines received. */
+static volatile uint32_t gcode_done_lines;	/* Lines executed. */
+static volatile int gcode_flush;	/* Abort received, drop the queue. */
+static uint32_t gcode_flush_ptr;	/* Receive position of the abort. */
+static uint32_t gcode_flush_lines;	/* Lines received before it. */
+static mdx_sem_t gcode_status_sem;
+static mdx_sem_t gcode_out_sem;
+static mdx_sem_t gcode_rx_sem;
+
+static uint32_t gcode_baud = GCODE_BAUD_DEFAULT;
+static uint32_t gcode_baud_prev;	/* Rate to fall back to. */
+static uint32_t gcode_baud_next;	/* Switch after COMPLETE. */
+static uint32_t gcode_baud_deadline;
+static volatile int gcode_baud_pending;	/* Waiting for the host. */
+
+static uint32_t gcode_line_last;	/* Last numbered line run. */
+static int gcode_line_resend;		/* Waiting for gcode_line_last + 1. */
+static int gcode_line_numbered;		/* The host numbers its lines. */
+
+/*
+ * Serializes replies of the main loop and the status reporter so that
+ * lines are not interleaved on the console.
+ */
+void
+gcode_out_lock(void)
+{
+
+	mdx_sem_wait(&gcode_out_sem);
+}
+
+void
+gcode_out_unlock(void)
+{
+
+	mdx_sem_post(&gcode_out_sem);
+}
+
 static void
 gcode_command_sensor_read(struct gcode_command *cmd)
 {
@@ -60,13 +155,32 @@ gcode_command_sensor_read(struct gcode_command *cmd)
 
 	if (cmd->sensor_read_target == 1) {
 		val = pin_get(&gpio_sc, PORT_B, 3) ? 0 : 1;
+		gcode_out_lock();
 		printf("ok V:%d\n", val);
+		gcode_out_unlock();
 	} else if (cmd->sensor_read_target == 2) {
 		val = pin_get(&gpio_sc, PORT_D, 4) ? 0 : 1;
+		gcode_out_lock();
 		printf("ok W:%d\n", val);
+		gcode_out_unlock();
 	}
 }
 
+/*
+ * Vacuum switches: bit 0 set when vacuum 1 holds a part, bit 1 for
+ * vacuum 2.
+ */
+int
+gcode_vacuum(void)
+{
+	int val;
+
+	val = pin_get(&gpio_sc, PORT_B, 3) ? 0 : 1;
+	val |= pin_get(&gpio_sc, PORT_D, 4) ? 0 : 2;
+
+	return (val);
+}
+
 static void
 gcode_command_actuate(struct gcode_command *cmd)
 {
@@ -91,9 +205,13 @@ gcode_command_actuate(struct gcode_command *cmd)
 	case PNP_ACTUATE_TARGET_NEEDLE:
 		cur = pin_get(&gpio_sc, PORT_B, 5);
 		if (cur && val) {
+			gcode_out_lock();
 			printf("ERR: needle already set\n");
+			gcode_out_unlock();
 		} else if (!cur && !val) {
+			gcode_out_lock();
 			printf("ERR: needle already cleared\n");
+			gcode_out_unlock();
 		} else {
 			pin_set(&gpio_sc, PORT_E, 0, val);
 			mdx_usleep(150000);
@@ -121,141 +239,599 @@ gcode_command_actuate(struct gcode_command *cmd)
 	}
 }
 
+/*
+ * Program the rate once the last character has left.
+ */
 static void
-gcode_command(char *line, int len)
+gcode_baud_set(uint32_t rate)
+{
+
+	while ((GCODE_USART_REG(GCODE_USART_SR) & GCODE_SR_TC) == 0)
+		continue;
+
+	GCODE_USART_REG(GCODE_USART_BRR) = (GCODE_USART_CLK + rate / 2) / rate;
+	gcode_baud = rate;
+}
+
+/*
+ * M927 S<rate> switches the console rate after its COMPLETE. The host
+ * then confirms with M927 at the new rate, which is answered with
+ * ok S:<rate>. Without it the old rate is back after
+ * GCODE_BAUD_TIMEOUT. The rate must be within 2% of what the divider
+ * gives, with 16x oversampling: up to 2.625 Mbaud.
+ */
+static void
+gcode_command_baud(struct gcode_command *cmd)
+{
+	uint32_t rate;
+	uint32_t real;
+	uint32_t brr;
+
+	if (cmd->s_set == 0) {
+		gcode_baud_pending = 0;
+		gcode_out_lock();
+		printf("ok S:%u\n", gcode_baud);
+		gcode_out_unlock();
+		return;
+	}
+
+	rate = cmd->s;
+	if (cmd->s <= 0 || rate > GCODE_USART_CLK / 16) {
+		gcode_out_lock();
+		printf("ERR: baud rate %d\n", cmd->s);
+		gcode_out_unlock();
+		return;
+	}
+
+	brr = (GCODE_USART_CLK + rate / 2) / rate;
+	real = GCODE_USART_CLK / brr;
+	if ((real > rate ? real - rate : rate - real) > rate / 50) {
+		gcode_out_lock();
+		printf("ERR: baud rate %d\n", cmd->s);
+		gcode_out_unlock();
+		return;
+	}
+
+	gcode_baud_next = rate;
+	gcode_out_lock();
+	printf("ok S:%u\n", rate);
+	gcode_out_unlock();
+}
+
+/*
+ * Parse a decimal number into fixed point with GCODE_FIXED_ONE units:
+ * mm into nanometers, degrees into 10^-6 degrees. Digits beyond the
+ * 6th fractional are rounded.
+ */
+static char *
+gcode_parse_fixed(char *p, char *end, int64_t *result)
+{
+	int64_t scale;
+	int64_t val;
+	int neg;
+
+	neg = 0;
+	if (p < end && (*p == '+' || *p == '-')) {
+		neg = (*p == '-');
+		p += 1;
+	}
+
+	val = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		val = val * 10 + (*p - '0');
+		if (val > GCODE_FIXED_INT_MAX)
+			val = GCODE_FIXED_INT_MAX;
+		p += 1;
+	}
+	val *= GCODE_FIXED_ONE;
+
+	if (p < end && *p == '.') {
+		p += 1;
+		scale = GCODE_FIXED_ONE;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (scale > 1) {
+				scale /= 10;
+				val += (*p - '0') * scale;
+			} else if (scale == 1) {
+				/* Round on the seventh digit. */
+				if (*p >= '5')
+					val += 1;
+				scale = 0;
+			}
+			p += 1;
+		}
+	}
+
+	*result = neg ? -val : val;
+
+	return (p);
+}
+
+static int
+gcode_parse(char *line, int len, struct gcode_command *cmd)
 {
-	struct gcode_command cmd;
 	uint8_t letter;
-	char *endp;
+	int64_t value;
 	char *end;
-	float value;
-
-#ifdef GCODE_DEBUG
-	int i;
-	printf("GCODE: ");
-	for (i = 0; i < len; i++)
-		printf("%c", line[i]);
-	printf("\n");
-#endif
+	int ival;
 
-	bzero(&cmd, sizeof(struct gcode_command));
+	bzero(cmd, sizeof(struct gcode_command));
 
 	end = line + len;
 	while (line < end) {
 		letter = *line;
 
 		/* Skip spaces. */
-		if (letter == ' ') {
+		if (letter == ' ' || letter == '\t' || letter == '\r') {
 			line += 1;
 			continue;
 		}
 
-		if (letter < 'A' || letter > 'Z') {
-			printf("%s: Error: expected a letter.\n", __func__);
+		/* The rest is a comment. */
+		if (letter == ';')
 			break;
-		}
+
+		if (letter < 'A' || letter > 'Z')
+			return (-1);
 
 		/* Skip letter. */
 		line += 1;
 
 		/* Ensure we are dealing with digit, + or -. */
-		if ((*line < '0' || *line > '9') &&
+		if (line == end ||
+		    ((*line < '0' || *line > '9') &&
 		    (*line != '+') &&
-		    (*line != '-'))
+		    (*line != '-')))
 			break;
 
-		value = strtof(line, &endp);
-		line = endp;
+		line = gcode_parse_fixed(line, end, &value);
+		ival = value / GCODE_FIXED_ONE;
 
-		printf("%s: value %.3f\n", __func__, value);
+		log_debug(LOG_GCODE, "%c: %d.%06d\n", letter, ival,
+		    (int)(value < 0 ? -value : value) % GCODE_FIXED_ONE);
+
+		if ((letter == 'G' || letter == 'M') && cmd->letter == 0) {
+			cmd->letter = letter;
+			cmd->code = ival;
+		}
 
 		switch (letter) {
 		case 'M':
-			if (value == 800.0f)
-				cmd.type = CMD_TYPE_ACTUATE;
-			else if (value == 105.0f)
-				cmd.type = CMD_TYPE_SENSOR_READ;
+			switch (ival) {
+			case 800:
+				cmd->type = CMD_TYPE_ACTUATE;
+				break;
+			case 105:
+				cmd->type = CMD_TYPE_SENSOR_READ;
+				break;
+			case 110:
+				cmd->type = CMD_TYPE_LINE;
+				break;
+			case 910:
+				cmd->type = CMD_TYPE_MOVE_LOG;
+				break;
+			case 911:
+				cmd->type = CMD_TYPE_MOVE_STATS;
+				break;
+			case 912:
+				cmd->type = CMD_TYPE_STEP_HIST;
+				break;
+			case 913:
+				cmd->type = CMD_TYPE_CMD_STATS;
+				break;
+			case 914:
+				cmd->type = CMD_TYPE_CAPTURE_ARM;
+				break;
+			case 915:
+				cmd->type = CMD_TYPE_CAPTURE_DUMP;
+				break;
+			case 916:
+				cmd->type = CMD_TYPE_LOG_DRAIN;
+				break;
+			case 917:
+				cmd->type = CMD_TYPE_LOG_LEVEL;
+				break;
+			case 918:
+				cmd->type = CMD_TYPE_MEM_REPORT;
+				break;
+			case 201:
+			case 203:
+			case 204:
+			case 205:
+			case 220:
+				cmd->type = CMD_TYPE_PLANNER;
+				break;
+			case 92:
+			case 208:
+			case 210:
+			case 919:
+			case 920:
+				cmd->type = CMD_TYPE_CONFIG;
+				break;
+			case 500:
+			case 501:
+			case 502:
+			case 503:
+				cmd->type = CMD_TYPE_CONFIG_STORE;
+				break;
+			case 921:
+				cmd->type = CMD_TYPE_JOG_MODE;
+				break;
+			case 400:
+				cmd->type = CMD_TYPE_WAIT;
+				break;
+			case 922:
+				cmd->type = CMD_TYPE_CORRECT;
+				break;
+			case 923:
+			case 924:
+				cmd->type = CMD_TYPE_COMPARE;
+				break;
+			case 925:
+				cmd->type = CMD_TYPE_ESTIMATE;
+				break;
+			case 926:
+				cmd->type = CMD_TYPE_FRAME;
+				break;
+			case 927:
+				cmd->type = CMD_TYPE_BAUD;
+				break;
+			}
 			break;
 		case 'G':
-			if (value == 0.0f) /* Linear move. */
-				cmd.type = CMD_TYPE_MOVE;
+			if (ival == 0) /* Linear move. */
+				cmd->type = CMD_TYPE_MOVE;
 			break;
 		case 'X':
-			cmd.x = value * 1000000;
-			cmd.x_set = 1;
+			cmd->x = value;
+			cmd->x_set = 1;
 			break;
 		case 'Y':
-			cmd.y = value * 1000000;
-			cmd.y_set = 1;
+			cmd->y = value;
+			cmd->y_set = 1;
 			break;
 		case 'Z':
-			cmd.z = value * 1000000;
-			cmd.z_set = 1;
+			cmd->z = value;
+			cmd->z_set = 1;
 			break;
 		case 'I':
-			cmd.h1 = value * 1000000;
-			cmd.h1_set = 1;
+			cmd->h1 = value;
+			cmd->h1_set = 1;
 			break;
 		case 'J':
-			cmd.h2 = value * 1000000;
-			cmd.h2_set = 1;
+			cmd->h2 = value;
+			cmd->h2_set = 1;
 			break;
 		case 'P':
-			cmd.actuate_target |= PNP_ACTUATE_TARGET_PUMP;
-			cmd.actuate_value = value;
+			cmd->actuate_target |= PNP_ACTUATE_TARGET_PUMP;
+			cmd->actuate_value = ival;
 			break;
 		case 'V':
 			/* Air vacuum 1 */
-			cmd.actuate_target |= PNP_ACTUATE_TARGET_AVAC1;
-			cmd.actuate_value = value;
+			cmd->actuate_target |= PNP_ACTUATE_TARGET_AVAC1;
+			cmd->actuate_value = ival;
 			break;
 		case 'W':
 			/* Air vacuum 2 */
-			cmd.actuate_target |= PNP_ACTUATE_TARGET_AVAC2;
-			cmd.actuate_value = value;
+			cmd->actuate_target |= PNP_ACTUATE_TARGET_AVAC2;
+			cmd->actuate_value = ival;
 			break;
 		case 'N':
 			/* Air vac sensors read. */
-			cmd.sensor_read_target = value;
+			cmd->sensor_read_target = ival;
 			break;
 		case 'D':
 			/* Needle */
-			cmd.actuate_target |= PNP_ACTUATE_TARGET_NEEDLE;
-			cmd.actuate_value = value;
+			cmd->actuate_target |= PNP_ACTUATE_TARGET_NEEDLE;
+			cmd->actuate_value = ival;
 			break;
 		case 'O':
 			/* Peel */
-			cmd.actuate_target |= PNP_ACTUATE_TARGET_PEEL;
-			cmd.actuate_value = value;
+			cmd->actuate_target |= PNP_ACTUATE_TARGET_PEEL;
+			cmd->actuate_value = ival;
+			break;
+		case 'S':
+			cmd->s = ival;
+			cmd->s_set = 1;
+			break;
+		case 'L':
+			cmd->l = ival;
+			cmd->l_set = 1;
 			break;
 		case 'F':
+			cmd->f = value;
+			cmd->f_set = 1;
 			break;
 		default:
 			break;
 		}
 	}
 
-	/* Acknowledge the command. */
-	printf("OK\n");
+	return (0);
+}
+
+/*
+ * Commands take the output lock only around each reply line they print,
+ * so that a status report is not held up by a long dump or an erase.
+ */
+void
+gcode_execute(struct gcode_command *cmd)
+{
 
-	switch (cmd.type) {
+	switch (cmd->type) {
 	case CMD_TYPE_MOVE:
-		pnp_command_move(&cmd);
+		if (cmd->f_set)
+			planner_set_feedrate(cmd->f);
+		pnp_command_move(cmd);
 		break;
 	case CMD_TYPE_ACTUATE:
-		gcode_command_actuate(&cmd);
+		gcode_command_actuate(cmd);
 		break;
 	case CMD_TYPE_SENSOR_READ:
-		gcode_command_sensor_read(&cmd);
+		gcode_command_sensor_read(cmd);
+		break;
+	case CMD_TYPE_MOVE_LOG:
+		telemetry_dump();
+		break;
+	case CMD_TYPE_MOVE_STATS:
+		telemetry_stats();
+		break;
+	case CMD_TYPE_STEP_HIST:
+		telemetry_isr_dump();
+		break;
+	case CMD_TYPE_CMD_STATS:
+		telemetry_cmd_dump();
+		break;
+	case CMD_TYPE_CAPTURE_ARM:
+		capture_arm(cmd->s_set ? cmd->s : CAPTURE_TRIG_MOVE);
+		break;
+	case CMD_TYPE_CAPTURE_DUMP:
+		capture_dump();
+		break;
+	case CMD_TYPE_LOG_DRAIN:
+		log_drain();
+		break;
+	case CMD_TYPE_LOG_LEVEL:
+		if (cmd->l_set)
+			log_set_level(cmd->s_set ? cmd->s : -1, cmd->l);
+		break;
+	case CMD_TYPE_MEM_REPORT:
+		arena_report();
+		break;
+	case CMD_TYPE_PLANNER:
+		planner_command(cmd);
+		break;
+	case CMD_TYPE_CONFIG:
+		pnp_command_config(cmd);
+		break;
+	case CMD_TYPE_CONFIG_STORE:
+		config_command(cmd);
+		break;
+	case CMD_TYPE_JOG_MODE:
+		pnp_command_jog_mode(cmd);
+		break;
+	case CMD_TYPE_WAIT:
+		pnp_wait();
+		break;
+	case CMD_TYPE_CORRECT:
+		pnp_command_correct(cmd);
+		break;
+	case CMD_TYPE_COMPARE:
+		pnp_command_compare(cmd);
+		break;
+	case CMD_TYPE_ESTIMATE:
+		pnp_command_estimate(cmd);
+		break;
+	case CMD_TYPE_FRAME:
+		frame_command(cmd);
+		break;
+	case CMD_TYPE_BAUD:
+		gcode_command_baud(cmd);
+		break;
+	case CMD_TYPE_LINE:
+		/* The number, if any, was taken by gcode_line_check(). */
+		gcode_line_resend = 0;
+		gcode_out_lock();
+		printf("ok N:%u W:%d\n", gcode_line_last, GCODE_WINDOW);
+		gcode_out_unlock();
 		break;
 	};
+}
+
+static void
+gcode_line_error(const char *msg)
+{
+
+	gcode_out_lock();
+	if (msg != NULL)
+		printf("ERR: %s\n", msg);
+	printf("RESEND N:%u\n", gcode_line_last + 1);
+	gcode_out_unlock();
+
+	gcode_line_resend = 1;
+}
+
+/*
+ * Marlin style line numbers and checksums: N<line> <command>*<sum>,
+ * the sum being the XOR of the bytes before '*'. Numbered lines must
+ * come in sequence. On an error the host is asked to resend from the
+ * line expected. The lines already on their way are refused with a
+ * bare RESEND until that one arrives, so every line refused gets one
+ * and the host can tell them from a new error. N<line> M110 restarts
+ * the count. Once the host numbers lines, a line without a number is
+ * taken as corrupted, until a plain M110. The line comes without its
+ * comment and trailing CR. Returns 0 with the number and checksum
+ * stripped for a line to run.
+ */
+/*
+ * Cut a comment and the CR and blanks a host leaves before the LF.
+ */
+static int
+gcode_line_trim(char *line, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		if (line[i] == ';')
+			break;
+	len = i;
+	while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' ' ||
+	    line[len - 1] == '\t'))
+		len -= 1;
+
+	return (len);
+}
+
+static int
+gcode_line_check(char **linep, int *lenp)
+{
+	uint32_t num;
+	uint8_t sum;
+	char *line;
+	char *star;
+	char *end;
+	char *p;
+	int m110;
+	int val;
+
+	line = *linep;
+	end = line + *lenp;
+	if (line == end)
+		return (0);
+	if (*line != 'N') {
+		if (gcode_line_numbered == 0)
+			return (0);
+		if (end - line == 4 && line[0] == 'M' && line[1] == '1' &&
+		    line[2] == '1' && line[3] == '0') {
+			gcode_line_numbered = 0;
+			return (0);
+		}
+		gcode_line_error("line number");
+		return (-1);
+	}
+
+	sum = 0;
+	for (star = line; star < end && *star != '*'; star++)
+		sum ^= *star;
+
+	num = 0;
+	for (p = line + 1; p < star && *p >= '0' && *p <= '9'; p++)
+		num = num * 10 + (*p - '0');
+	while (p < star && *p == ' ')
+		p++;
+	m110 = (star - p >= 4 && p[0] == 'M' && p[1] == '1' && p[2] == '1' &&
+	    p[3] == '0' && (star - p == 4 || p[4] < '0' || p[4] > '9'));
+
+	if (star == end) {
+		gcode_line_error("no checksum");
+		return (-1);
+	}
+	val = 0;
+	while (++star < end && *star >= '0' && *star <= '9')
+		val = val * 10 + (*star - '0');
+	if (star != end || val != sum) {
+		gcode_line_error("checksum mismatch");
+		return (-1);
+	}
+
+	if (m110)
+		gcode_line_last = num - 1;
+	if (num != gcode_line_last + 1) {
+		/* A resend was asked for, refuse what was sent meanwhile. */
+		gcode_line_error(gcode_line_resend ? NULL : "line number");
+		return (-1);
+	}
+	gcode_line_last = num;
+	gcode_line_resend = 0;
+	gcode_line_numbered = 1;
+
+	for (star = p; *star != '*'; star++)
+		continue;
+	*linep = p;
+	*lenp = star - p;
+
+	return (0);
+}
+
+static void
+gcode_command(char *line, int len, uint32_t rx_time)
+{
+	struct gcode_command cmd;
+	int error;
+
+#ifdef GCODE_DEBUG
+	int i;
+	printf("GCODE: ");
+	for (i = 0; i < len; i++)
+		printf("%c", line[i]);
+	printf("\n");
+#endif
+
+	len = gcode_line_trim(line, len);
+
+	if (gcode_baud_pending == 0 && gcode_line_check(&line, &len) != 0)
+		return;
+
+	error = gcode_parse(line, len, &cmd);
+
+	/* Until the host confirms a new rate, anything else is noise. */
+	if (gcode_baud_pending && cmd.type != CMD_TYPE_BAUD)
+		return;
+
+	/* Taken off the queue but not run, as Marlin does for junk. */
+	if (error) {
+		gcode_out_lock();
+		printf("OK\n");
+		printf("ERR: expected a letter\n");
+		printf("COMPLETE\n");
+		gcode_out_unlock();
+		return;
+	}
+
+	/* The job has the machine, frames only. */
+	if (job_running()) {
+		gcode_out_lock();
+		printf("OK\n");
+		printf("ERR: job running\n");
+		printf("COMPLETE\n");
+		gcode_out_unlock();
+		return;
+	}
+
+	/* Only commands that run are timed. */
+	telemetry_cmd_begin(rx_time);
+	telemetry_cmd_stamp(TM_STAGE_PARSED);
+
+	/* Acknowledge the command. */
+	gcode_out_lock();
+	printf("OK\n");
+	gcode_out_unlock();
+	telemetry_cmd_stamp(TM_STAGE_ACK);
+
+	gcode_execute(&cmd);
 
 	/* TODO: check for errors. */
+	gcode_out_lock();
 	printf("COMPLETE\n");
+	if (gcode_baud_next) {
+		gcode_baud_prev = gcode_baud;
+		gcode_baud_set(gcode_baud_next);
+		gcode_baud_next = 0;
+		gcode_baud_deadline = dwt_cycles() + GCODE_BAUD_TIMEOUT;
+		gcode_baud_pending = 1;
+	}
+	gcode_out_unlock();
+	telemetry_cmd_stamp(TM_STAGE_COMPLETE);
+
+	telemetry_cmd_end(cmd.letter, cmd.code);
 }
 
-static void
-gcode_process_data(int ptr, int len)
+/*
+ * Run the lines in the len bytes at ptr. Returns the number of bytes
+ * taken, less than len once an abort came in while a line ran.
+ */
+static int
+gcode_process_data(int ptr, int len, uint32_t rx_time)
 {
 	uint8_t *start;
 	uint8_t ch;
@@ -265,13 +841,30 @@ gcode_process_data(int ptr, int len)
 	for (i = 0; i < len; i++) {
 		ch = start[i];
 		dprintf("ch %d\n", ch);
+		if (frame_busy() ||
+		    (frame_enabled && cmd_buffer_ptr == 0 && ch == FRAME_SYNC)) {
+			if (frame_input(ch)) {
+				gcode_done_lines += 1;
+				if (gcode_flush)
+					return (i + 1);
+			}
+			continue;
+		}
+		if (GCODE_IS_RT(ch))
+			continue;
 		cmd_buffer[cmd_buffer_ptr] = ch;
 		if (ch == '\n') { /* LF */
-			gcode_command(cmd_buffer, cmd_buffer_ptr);
+			gcode_command(cmd_buffer, cmd_buffer_ptr, rx_time);
 			cmd_buffer_ptr = 0;
+			gcode_done_lines += 1;
+			/* The rest is dealt with by gcode_abort(). */
+			if (gcode_flush)
+				return (i + 1);
 		} else
 			cmd_buffer_ptr += 1;
 	}
+
+	return (len);
 }
 
 static void
@@ -290,12 +883,342 @@ gcode_dmarecv_init(void)
 	conf.nbytes = DMA_BUF_SIZE;
 
 	stm32f4_dma_setup(&dma2_sc, &conf);
+	GCODE_DMA_REG(GCODE_DMA_S2CR) |= GCODE_DMA_CR_HTIE | GCODE_DMA_CR_TCIE;
 	stm32f4_dma_control(&dma2_sc, 2, 1);
+
+	/*
+	 * Scan for real-time characters once the line goes idle, and every
+	 * half buffer of a stream with no idle gap, so none is overwritten
+	 * before it was seen.
+	 */
+	gcode_rt_ptr = 0;
+	gcode_rt_skip = 0;
+	gcode_rt_bol = 1;
+	GCODE_USART_REG(GCODE_USART_CR1) |= GCODE_CR1_IDLEIE;
+}
+
+/*
+ * Look at what the DMA wrote since the last scan for real-time
+ * characters. Runs in an interrupt or with interrupts off. Returns the
+ * position scanned up to; the main loop does not read past it, so an
+ * abort is always seen before the lines that follow it.
+ */
+static uint32_t
+gcode_rt_scan(void)
+{
+	uint32_t cnt;
+	uint32_t ptr;
+	uint8_t ch;
+
+	cnt = DMA_BUF_SIZE - stm32f4_dma_getcnt(&dma2_sc, 2);
+	if (cnt == DMA_BUF_SIZE)
+		cnt = 0;
+
+	ptr = gcode_rt_ptr;
+	while (ptr != cnt) {
+		ch = dma_buffer[ptr];
+		ptr = (ptr + 1) % DMA_BUF_SIZE;
+
+		/* Binary frames are skipped by their length. */
+		if (gcode_rt_skip < 0) {
+			gcode_rt_skip = ch + 3;
+			continue;
+		}
+		if (gcode_rt_skip > 0) {
+			gcode_rt_skip -= 1;
+			if (gcode_rt_skip == 0) {
+				gcode_rx_lines += 1;
+				gcode_rt_bol = 1;
+			}
+			continue;
+		}
+		/* Line noise while the rate changes is not a command. */
+		if (gcode_baud_pending && GCODE_IS_RT(ch))
+			continue;
+
+		if (frame_enabled && gcode_rt_bol && ch == FRAME_SYNC) {
+			gcode_rt_skip = -1;
+			continue;
+		}
+
+		switch (ch) {
+		case GCODE_RT_STATUS:
+			mdx_sem_post(&gcode_status_sem);
+			break;
+		case GCODE_RT_HOLD:
+			pnp_feed_hold();
+			break;
+		case GCODE_RT_RESUME:
+			pnp_feed_resume();
+			break;
+		case GCODE_RT_ABORT:
+			pnp_feed_abort();
+			gcode_flush_ptr = ptr;
+			gcode_flush_lines = gcode_rx_lines;
+			gcode_flush = 1;
+			gcode_rt_bol = 1;
+			break;
+		case '\n':
+			gcode_rx_lines += 1;
+			gcode_rt_bol = 1;
+			break;
+		default:
+			gcode_rt_bol = 0;
+		}
+	}
+	gcode_rt_ptr = ptr;
+
+	return (ptr);
+}
+
+/*
+ * USART1 interrupt. The receiver is serviced by DMA, IDLE fires after a
+ * burst of characters: look at what arrived for real-time characters
+ * without waiting for the main loop, which may be blocked in a move.
+ */
+void
+gcode_usart_intr(void *arg, int irq)
+{
+
+	/* Reading SR then DR clears IDLE. */
+	(void)GCODE_USART_REG(GCODE_USART_SR);
+	(void)GCODE_USART_REG(USART_DR);
+
+	gcode_rt_scan();
+
+	mdx_sem_post(&gcode_rx_sem);
+}
+
+/*
+ * DMA2 stream 2 interrupt, half and full receive buffer. A host that
+ * streams without a pause never lets the line go idle.
+ */
+void
+gcode_dma_intr(void *arg, int irq)
+{
+
+	GCODE_DMA_REG(GCODE_DMA_LIFCR) = GCODE_DMA_LIFCR_S2;
+
+	gcode_rt_scan();
+
+	mdx_sem_post(&gcode_rx_sem);
+}
+
+/*
+ * Print a fixed point value as " <letter>:<value>" with three decimals.
+ */
+void
+gcode_print_fixed(char letter, int64_t val)
+{
+	int64_t a;
+
+	/* Round to 10^-3 units. */
+	a = val < 0 ? -val : val;
+	a = (a + 500) / 1000;
+
+	printf(" %c:%s%d.%03d", letter, (val < 0 && a) ? "-" : "",
+	    (int)(a / 1000), (int)(a % 1000));
+}
+
+/*
+ * Reply to the status character:
+ * ok X:<mm> Y:<mm> Z:<mm> I:<deg> J:<deg> Q:<lines queued> A:<outputs>
+ * S:<inputs> H:<feed state>, see README for the bits of A and S.
+ */
+static void
+gcode_status_report(void)
+{
+	int64_t pos[PNP_NAXES];
+	uint32_t outputs;
+	uint32_t inputs;
+	int queued;
+
+	pnp_status(&pos[0]);
+	queued = gcode_rx_lines - gcode_done_lines;
+	if (queued < 0)
+		queued = 0;
+
+	outputs = gpio_get(PORT_B, 13);			/* Pump */
+	outputs |= gpio_get(PORT_E, 2) << 1;		/* Vacuum 1 */
+	outputs |= gpio_get(PORT_E, 1) << 2;		/* Vacuum 2 */
+	outputs |= gpio_get(PORT_E, 0) << 3;		/* Needle */
+	outputs |= gpio_get(PORT_B, 12) << 4;		/* Peel */
+
+	inputs = !gpio_get(PORT_B, 3);			/* Vacuum 1 sensor */
+	inputs |= !gpio_get(PORT_D, 4) << 1;		/* Vacuum 2 sensor */
+	inputs |= gpio_get(PORT_B, 5) << 2;		/* Needle sensor */
+	inputs |= gpio_get(PORT_C, 6) << 3;		/* X home */
+	inputs |= gpio_get(PORT_C, 7) << 4;		/* Y home */
+	inputs |= gpio_get(PORT_B, 4) << 5;		/* Z home */
+
+	gcode_out_lock();
+	printf("ok");
+	gcode_print_fixed('X', pos[PNP_AXIS_X]);
+	gcode_print_fixed('Y', pos[PNP_AXIS_Y]);
+	gcode_print_fixed('Z', pos[PNP_AXIS_Z]);
+	gcode_print_fixed('I', pos[PNP_AXIS_H1]);
+	gcode_print_fixed('J', pos[PNP_AXIS_H2]);
+	printf(" Q:%d A:%x S:%x H:%d\n", queued, outputs, inputs,
+	    pnp_feed_state());
+	gcode_out_unlock();
+}
+
+static void
+gcode_status_thread(void *arg)
+{
+
+	while (1) {
+		mdx_sem_wait(&gcode_status_sem);
+		gcode_status_report();
+	}
+}
+
+/*
+ * Called before the arena is sealed.
+ */
+int
+gcode_initialize(void)
+{
+	struct thread *td;
+	int error;
+
+	mdx_sem_init(&gcode_status_sem, 0);
+	mdx_sem_init(&gcode_out_sem, 1);
+	mdx_sem_init(&gcode_rx_sem, 0);
+
+	td = arena_alloc(sizeof(struct thread));
+	td->td_stack = arena_alloc_stack("gcode status",
+	    GCODE_THREAD_STACK_SIZE);
+	td->td_stack_size = GCODE_THREAD_STACK_SIZE;
+
+	error = mdx_thread_setup(td, "gcode status", 1 /* prio */,
+	    500 /* quantum */, gcode_status_thread, NULL);
+	if (error) {
+		printf("%s: Failed to create status thread\n", __func__);
+		return (-1);
+	}
+
+	mdx_sched_add(td);
+
+	return (0);
+}
+
+static char *gcode_bench_lines[] = {
+	"G0 X123.456 Y78.9 F30000",
+	"G0 Z10",
+	"G0 I-90.125",
+	"G0 X170.059 Y169.983 J180",
+	"M800 V1",
+	"M105 N1",
+	"M204 S2000",
+};
+
+#define	GCODE_BENCH_NLINES	\
+	(sizeof(gcode_bench_lines) / sizeof(gcode_bench_lines[0]))
+
+static void
+gcode_bench_parse(int i)
+{
+	struct gcode_command cmd;
+	char *line;
+	int len;
+
+	line = gcode_bench_lines[i % GCODE_BENCH_NLINES];
+	for (len = 0; line[len] != '\0'; len++)
+		continue;
+	gcode_parse(line, len, &cmd);
+}
+
+static void
+gcode_bench_fixed(int i)
+{
+	char *line;
+	int64_t val;
+
+	line = gcode_bench_lines[i % GCODE_BENCH_NLINES] + 4;
+	gcode_parse_fixed(line, line + 6, &val);
+}
+
+void
+gcode_bench(void)
+{
+
+	bench_measure("gcode_parse", gcode_bench_parse);
+	bench_measure("gcode_parse_fixed", gcode_bench_fixed);
+}
+
+/*
+ * Called by the main loop once the command in progress returned after
+ * an abort: everything received before the abort character is dropped
+ * and the position the axes stopped at is reported. Reading resumes
+ * right after the abort character; the main loop never ran past it.
+ */
+static uint32_t
+gcode_abort(void)
+{
+	uint32_t ptr;
+
+	critical_enter();
+	ptr = gcode_flush_ptr;
+	gcode_done_lines = gcode_flush_lines;
+	gcode_flush = 0;
+	critical_exit();
+
+	cmd_buffer_ptr = 0;
+	frame_reset();
+	job_abort();
+	pnp_wait();
+	pnp_feed_clear();
+
+	log_info(LOG_GCODE, "aborted, queue flushed\n");
+
+	gcode_out_lock();
+	printf("ABORTED\n");
+	gcode_out_unlock();
+	gcode_status_report();
+
+	return (ptr);
+}
+
+/*
+ * No confirmation came at the new rate: go back to the old one and drop
+ * what was received meanwhile.
+ */
+static uint32_t
+gcode_baud_fallback(void)
+{
+	uint32_t cnt;
+
+	gcode_out_lock();
+	gcode_baud_set(gcode_baud_prev);
+
+	critical_enter();
+	cnt = DMA_BUF_SIZE - stm32f4_dma_getcnt(&dma2_sc, 2);
+	if (cnt == DMA_BUF_SIZE)
+		cnt = 0;
+	gcode_rt_ptr = cnt;
+	gcode_rt_skip = 0;
+	gcode_rt_bol = 1;
+	gcode_done_lines = gcode_rx_lines;
+	gcode_baud_pending = 0;
+	critical_exit();
+
+	cmd_buffer_ptr = 0;
+	frame_reset();
+
+	log_info(LOG_GCODE, "no reply at the new rate, back to %u\n",
+	    gcode_baud);
+
+	printf("ok S:%u\n", gcode_baud);
+	gcode_out_unlock();
+
+	return (cnt);
 }
 
 int
 gcode_mainloop(void)
 {
+	uint32_t rx_time;
 	uint32_t cnt;
 	int ptr;
 
@@ -304,22 +1227,32 @@ gcode_mainloop(void)
 
 	gcode_dmarecv_init();
 
-	/* Periodically poll for a new data. */
+	/* Woken up by the IDLE interrupt, or polls. */
 	while (1) {
-		cnt = stm32f4_dma_getcnt(&dma2_sc, 2);
-		cnt = DMA_BUF_SIZE - cnt;
+		/* Only what was looked at for real-time characters. */
+		critical_enter();
+		cnt = gcode_rt_scan();
+		critical_exit();
+		rx_time = dwt_cycles();
 
-		if (cnt > ptr) {
-			gcode_process_data(ptr, (cnt - ptr));
-			ptr = cnt;
-		} else if (cnt < ptr) {
+		if (gcode_flush == 0 && cnt < ptr) {
 			/* Buffer wrapped. */
-			gcode_process_data(ptr, DMA_BUF_SIZE - ptr);
-			gcode_process_data(0, cnt);
-			ptr = cnt;
+			ptr += gcode_process_data(ptr, DMA_BUF_SIZE - ptr,
+			    rx_time);
+			if (ptr == DMA_BUF_SIZE)
+				ptr = 0;
 		}
+		if (gcode_flush == 0 && cnt > ptr)
+			ptr += gcode_process_data(ptr, cnt - ptr, rx_time);
+
+		if (gcode_flush)
+			ptr = gcode_abort();
+
+		if (gcode_baud_pending &&
+		    (int32_t)(dwt_cycles() - gcode_baud_deadline) > 0)
+			ptr = gcode_baud_fallback();
 
-		mdx_usleep(10000);
+		mdx_sem_timedwait(&gcode_rx_sem, GCODE_POLL_US);
 	}
 
 	return (0);
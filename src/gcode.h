@@ -27,23 +27,53 @@
 #ifndef _SRC_GCODE_H_
 #define	_SRC_GCODE_H_
 
+/* Fixed point: coordinates are in 10^-6 mm (nm) or 10^-6 degrees. */
+#define	GCODE_FIXED_ONE		1000000
+
 struct gcode_command {
 	int type;
 #define	CMD_TYPE_MOVE		1
 #define	CMD_TYPE_ACTUATE	2
 #define	CMD_TYPE_SENSOR_READ	3
+#define	CMD_TYPE_MOVE_LOG	4
+#define	CMD_TYPE_MOVE_STATS	5
+#define	CMD_TYPE_STEP_HIST	6
+#define	CMD_TYPE_CMD_STATS	7
+#define	CMD_TYPE_CAPTURE_ARM	8
+#define	CMD_TYPE_CAPTURE_DUMP	9
+#define	CMD_TYPE_LOG_DRAIN	10
+#define	CMD_TYPE_LOG_LEVEL	11
+#define	CMD_TYPE_MEM_REPORT	12
+#define	CMD_TYPE_PLANNER	13
+#define	CMD_TYPE_CONFIG		14
+#define	CMD_TYPE_CONFIG_STORE	15
+#define	CMD_TYPE_JOG_MODE	16
+#define	CMD_TYPE_WAIT		17
+#define	CMD_TYPE_CORRECT	18
+#define	CMD_TYPE_COMPARE	19
+#define	CMD_TYPE_ESTIMATE	20
+#define	CMD_TYPE_FRAME		21
+#define	CMD_TYPE_BAUD		22
+#define	CMD_TYPE_LINE		23
+
+	/* First G or M word. */
+	char letter;
+	int code;
 
-	int x;
-	int y;
-	int z;
-	int h1;
-	int h2;
+	int64_t x;
+	int64_t y;
+	int64_t z;
+	int64_t h1;
+	int64_t h2;
 	int x_set;
 	int y_set;
 	int z_set;
 	int h1_set;
 	int h2_set;
 
+	int64_t f;	/* Feedrate, mm/min. */
+	int f_set;
+
 	int actuate_target;
 #define	PNP_ACTUATE_TARGET_PUMP		1
 #define	PNP_ACTUATE_TARGET_AVAC1	2
@@ -53,8 +83,23 @@ struct gcode_command {
 	int actuate_value;
 
 	int sensor_read_target;
+
+	/* S and L words, generic arguments of M commands. */
+	int s;
+	int s_set;
+	int l;
+	int l_set;
 };
 
+int gcode_initialize(void);
 int gcode_mainloop(void);
+void gcode_usart_intr(void *arg, int irq);
+void gcode_dma_intr(void *arg, int irq);
+void gcode_print_fixed(char letter, int64_t val);
+void gcode_out_lock(void);
+void gcode_out_unlock(void);
+void gcode_execute(struct gcode_command *cmd);
+int gcode_vacuum(void);
+void gcode_bench(void);
 
 #endif /* !_SRC_GCODE_H_ */
@@ -26,6 +26,7 @@
 
 #include <sys/cdefs.h>
 
+#include <arm/stm/stm32f4.h>
 #include <arm/stm/stm32f4_gpio.h>
 
 #include "gpio.h"
@@ -27,6 +27,31 @@
 #ifndef	_GPIO_H_
 #define	_GPIO_H_
 
+#define	GPIO_PORT_BASE(port)	(GPIO_BASE + (port) * 0x400)
+#define	GPIO_PORT_IDR		0x10
+#define	GPIO_PORT_BSRR		0x18
+
 void gpio_config(struct stm32f4_gpio_softc *sc);
 
+/*
+ * Direct register access for the step path. The low half of BSRR sets
+ * pins of the port, the high half resets them, in a single write.
+ */
+static inline void
+gpio_bsrr(int port, uint32_t val)
+{
+
+	*(volatile uint32_t *)(GPIO_PORT_BASE(port) + GPIO_PORT_BSRR) = val;
+}
+
+static inline int
+gpio_get(int port, int pin)
+{
+	uint32_t reg;
+
+	reg = *(volatile uint32_t *)(GPIO_PORT_BASE(port) + GPIO_PORT_IDR);
+
+	return ((reg >> pin) & 1);
+}
+
 #endif /* !_GPIO_H_ */
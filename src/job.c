@@ -0,0 +1,479 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+#include <sys/sem.h>
+#include <sys/thread.h>
+
+#include "arena.h"
+#include "dwt.h"
+#include "frame.h"
+#include "gcode.h"
+#include "job.h"
+#include "log.h"
+#include "pnp.h"
+
+/*
+ * Autonomous job: the host loads a placement list and the firmware runs
+ * pick, travel and place of every part in its own thread, with the same
+ * moves as G0 (Z follows the other axes), checking the vacuum switch
+ * after each pick. The host is only asked for bottom vision: at the
+ * camera the job waits for a correction, or for word that the image is
+ * taken, in which case it travels to the nominal place position and
+ * applies the correction once it comes, as M922 would.
+ *
+ * Parts are loaded in chunks into a ring while the job runs, so a job
+ * is not limited to the size of the ring.
+ */
+
+#define	JOB_THREAD_STACK_SIZE	4096
+#define	JOB_POLL_US		10000
+#define	JOB_VISION_TIMEOUT	(5000 * 1000 * DWT_CYCLES_PER_US)
+
+/* Micrometers or millidegrees to G-code fixed point. */
+#define	JOB_FIXED(v)		((int64_t)(v) * (GCODE_FIXED_ONE / 1000))
+
+static struct job_part job_parts[JOB_NPARTS] __ccm;
+static struct job_conf job_conf;
+static mdx_sem_t job_sem;
+
+static volatile int job_active;		/* Started, not done. */
+static volatile int job_stop;
+static volatile int job_loaded;		/* Parts loaded. */
+static volatile int job_next;		/* Parts taken by the job thread. */
+
+/* Correction of the part at the camera. */
+static volatile int job_corr_index;
+static volatile int job_corr_taken;	/* The image is taken. */
+static volatile int job_corr_set;	/* The correction is in. */
+static int job_corr_flags;
+static int32_t job_corr[3];
+
+static void
+job_event(int index, int event, int tries)
+{
+	uint8_t reply[4];
+
+	reply[0] = index;
+	reply[1] = index >> 8;
+	reply[2] = event;
+	reply[3] = tries;
+
+	frame_send(FRAME_JOB_EVENT | FRAME_REPLY, reply, sizeof(reply));
+}
+
+/*
+ * Run a command of the job, unless it is being stopped.
+ */
+static int
+job_execute(struct gcode_command *cmd)
+{
+
+	if (job_stop || pnp_feed_state() == PNP_CTL_ABORT) {
+		job_stop = 1;
+		return (-1);
+	}
+
+	gcode_execute(cmd);
+
+	return (0);
+}
+
+static int
+job_move(int32_t x, int32_t y, int nozzle, int32_t rot, int rot_set)
+{
+	struct gcode_command cmd;
+
+	bzero(&cmd, sizeof(struct gcode_command));
+	cmd.type = CMD_TYPE_MOVE;
+	cmd.letter = 'G';
+	cmd.x = JOB_FIXED(x);
+	cmd.y = JOB_FIXED(y);
+	cmd.x_set = 1;
+	cmd.y_set = 1;
+	if (nozzle == 1) {
+		cmd.h1 = JOB_FIXED(rot);
+		cmd.h1_set = rot_set;
+	} else {
+		cmd.h2 = JOB_FIXED(rot);
+		cmd.h2_set = rot_set;
+	}
+
+	return (job_execute(&cmd));
+}
+
+/*
+ * Lower the nozzle by depth, or raise both with depth 0. Nozzle 1 is
+ * down at positive Z, nozzle 2 at negative Z.
+ */
+static int
+job_z(int nozzle, int32_t depth)
+{
+	struct gcode_command cmd;
+
+	bzero(&cmd, sizeof(struct gcode_command));
+	cmd.type = CMD_TYPE_MOVE;
+	cmd.letter = 'G';
+	cmd.z = JOB_FIXED(depth);
+	if (nozzle == 2)
+		cmd.z = -cmd.z;
+	cmd.z_set = 1;
+
+	return (job_execute(&cmd));
+}
+
+static int
+job_actuate(int target, int value)
+{
+	struct gcode_command cmd;
+
+	bzero(&cmd, sizeof(struct gcode_command));
+	cmd.type = CMD_TYPE_ACTUATE;
+	cmd.letter = 'M';
+	cmd.code = 800;
+	cmd.actuate_target = target;
+	cmd.actuate_value = value;
+
+	return (job_execute(&cmd));
+}
+
+static int
+job_wait_moves(void)
+{
+	struct gcode_command cmd;
+
+	bzero(&cmd, sizeof(struct gcode_command));
+	cmd.type = CMD_TYPE_WAIT;
+	cmd.letter = 'M';
+	cmd.code = 400;
+
+	return (job_execute(&cmd));
+}
+
+/*
+ * Wait for the correction, or with taken set also for the image to be
+ * taken. No reply within JOB_VISION_TIMEOUT stops the job.
+ */
+static int
+job_wait_corr(int taken)
+{
+	uint32_t start;
+
+	start = dwt_cycles();
+	while (job_stop == 0) {
+		if (job_corr_set || (taken && job_corr_taken))
+			return (0);
+		if (dwt_cycles() - start > JOB_VISION_TIMEOUT) {
+			log_err(LOG_GCODE, "job: no vision reply\n");
+			job_stop = 1;
+			break;
+		}
+		mdx_sem_timedwait(&job_sem, JOB_POLL_US);
+	}
+
+	return (-1);
+}
+
+static int
+job_discard(int index, int nozzle, int vacuum, int tries)
+{
+
+	if (job_move(job_conf.discard_x, job_conf.discard_y, nozzle, 0, 0) ||
+	    job_actuate(vacuum, 0))
+		return (-1);
+
+	job_event(index, JOB_EV_REJECTED, tries);
+
+	return (0);
+}
+
+static int
+job_run_part(int index, const struct job_part *part)
+{
+	struct gcode_command cmd;
+	int32_t dx, dy, dr;
+	int corrected;
+	int vacuum;
+	int nozzle;
+	int tries;
+
+	nozzle = part->flags & JOB_NOZZLE;
+	vacuum = nozzle == 1 ? PNP_ACTUATE_TARGET_AVAC1 :
+	    PNP_ACTUATE_TARGET_AVAC2;
+
+	if (part->flags & JOB_PEEL)
+		if (job_actuate(PNP_ACTUATE_TARGET_PEEL, 1) ||
+		    job_actuate(PNP_ACTUATE_TARGET_PEEL, 0))
+			return (-1);
+
+	/* Pick, retried while the vacuum switch sees no part. */
+	for (tries = 1;; tries++) {
+		if (job_move(part->pick_x, part->pick_y, nozzle, 0, 1) ||
+		    job_z(nozzle, part->pick_z) ||
+		    job_actuate(vacuum, 1) ||
+		    job_z(nozzle, 0))
+			return (-1);
+		/* The vacuum bits are the nozzle numbers. */
+		if (gcode_vacuum() & nozzle)
+			break;
+		if (job_actuate(vacuum, 0))
+			return (-1);
+		if (tries > job_conf.retries) {
+			job_event(index, JOB_EV_MISSED, tries);
+			return (0);
+		}
+	}
+
+	dx = dy = dr = 0;
+	corrected = 1;
+	if (part->flags & JOB_VISION) {
+		if (job_move(job_conf.camera_x, job_conf.camera_y, nozzle, 0,
+		    0) || job_wait_moves())
+			return (-1);
+		job_corr_taken = 0;
+		job_corr_set = 0;
+		job_corr_flags = 0;
+		job_corr_index = index;
+		job_event(index, JOB_EV_VISION, tries);
+		if (job_wait_corr(1))
+			return (-1);
+		corrected = job_corr_set;
+		if (corrected && (job_corr_flags & JOB_CORR_REJECT))
+			return (job_discard(index, nozzle, vacuum, tries));
+		if (corrected) {
+			dx = job_corr[0];
+			dy = job_corr[1];
+			dr = job_corr[2];
+		}
+	}
+
+	if (job_move(part->place_x + dx, part->place_y + dy, nozzle,
+	    part->rot + dr, 1))
+		return (-1);
+
+	/* The image was taken on the way, the correction comes now. */
+	if (corrected == 0) {
+		if (job_wait_corr(0))
+			return (-1);
+		if (job_corr_flags & JOB_CORR_REJECT)
+			return (job_discard(index, nozzle, vacuum, tries));
+		bzero(&cmd, sizeof(struct gcode_command));
+		cmd.type = CMD_TYPE_CORRECT;
+		cmd.letter = 'M';
+		cmd.code = 922;
+		cmd.x = JOB_FIXED(job_corr[0]);
+		cmd.y = JOB_FIXED(job_corr[1]);
+		cmd.x_set = 1;
+		cmd.y_set = 1;
+		if (nozzle == 1) {
+			cmd.h1 = JOB_FIXED(job_corr[2]);
+			cmd.h1_set = 1;
+		} else {
+			cmd.h2 = JOB_FIXED(job_corr[2]);
+			cmd.h2_set = 1;
+		}
+		if (job_execute(&cmd))
+			return (-1);
+	}
+
+	if (job_z(nozzle, part->place_z) ||
+	    job_actuate(vacuum, 0) ||
+	    job_z(nozzle, 0))
+		return (-1);
+
+	job_event(index, JOB_EV_PLACED, tries);
+
+	return (0);
+}
+
+static void
+job_thread(void *arg)
+{
+	struct job_part part;
+	int index;
+
+	while (1) {
+		mdx_sem_wait(&job_sem);
+		if (job_active == 0)
+			continue;
+
+		while (job_stop == 0 && job_next < job_conf.count) {
+			if (job_next == job_loaded) {
+				mdx_sem_timedwait(&job_sem, JOB_POLL_US);
+				continue;
+			}
+			/* The slot is free for loading once copied. */
+			index = job_next;
+			part = job_parts[index % JOB_NPARTS];
+			job_next = index + 1;
+			if (job_run_part(index, &part))
+				job_stop = 1;
+		}
+
+		job_corr_index = -1;
+		if (job_stop)
+			job_event(job_next - 1, JOB_EV_STOPPED, 0);
+		else
+			job_event(job_conf.count, JOB_EV_DONE, 0);
+		job_active = 0;
+	}
+}
+
+/*
+ * Returns -1 while a job runs.
+ */
+int
+job_start(const struct job_conf *conf)
+{
+
+	if (job_active)
+		return (-1);
+
+	job_conf = *conf;
+	job_loaded = 0;
+	job_next = 0;
+	job_stop = 0;
+	job_corr_index = -1;
+	job_active = 1;
+
+	mdx_sem_post(&job_sem);
+
+	return (0);
+}
+
+/*
+ * Parts are loaded in order. Returns -1 for a part out of order or out
+ * of the job, -2 if the ring is full.
+ */
+int
+job_load(int index, const struct job_part *part)
+{
+
+	if (job_active == 0 || index != job_loaded ||
+	    index >= job_conf.count)
+		return (-1);
+	if (index >= job_next + JOB_NPARTS)
+		return (-2);
+
+	job_parts[index % JOB_NPARTS] = *part;
+	job_loaded = index + 1;
+
+	mdx_sem_post(&job_sem);
+
+	return (0);
+}
+
+void
+job_progress(int *loaded, int *next)
+{
+
+	*loaded = job_loaded;
+	*next = job_next;
+}
+
+/*
+ * Bottom vision reply for the part at the camera, returns -1 for any
+ * other part.
+ */
+int
+job_correct(int index, int flags, int32_t dx, int32_t dy, int32_t dr)
+{
+
+	if (job_active == 0 || index != job_corr_index)
+		return (-1);
+
+	if (flags & JOB_CORR_REJECT) {
+		job_corr_flags = flags;
+		job_corr_set = 1;
+	} else if (flags & JOB_CORR_TAKEN)
+		job_corr_taken = 1;
+	else {
+		job_corr_flags = 0;
+		job_corr[0] = dx;
+		job_corr[1] = dy;
+		job_corr[2] = dr;
+		job_corr_set = 1;
+	}
+
+	mdx_sem_post(&job_sem);
+
+	return (0);
+}
+
+int
+job_running(void)
+{
+
+	return (job_active);
+}
+
+/*
+ * Ctrl-X: the job stops before its next command. Returns once the job
+ * thread has sent its stop event.
+ */
+void
+job_abort(void)
+{
+
+	if (job_active == 0)
+		return;
+
+	job_stop = 1;
+	mdx_sem_post(&job_sem);
+
+	/* The stop event goes out before the abort is reported. */
+	while (job_active)
+		mdx_usleep(1000);
+}
+
+/*
+ * Called before the arena is sealed.
+ */
+int
+job_initialize(void)
+{
+	struct thread *td;
+	int error;
+
+	mdx_sem_init(&job_sem, 0);
+	job_corr_index = -1;
+
+	td = arena_alloc(sizeof(struct thread));
+	td->td_stack = arena_alloc_stack("job", JOB_THREAD_STACK_SIZE);
+	td->td_stack_size = JOB_THREAD_STACK_SIZE;
+
+	error = mdx_thread_setup(td, "job", 1 /* prio */, 500 /* quantum */,
+	    job_thread, NULL);
+	if (error) {
+		printf("%s: Failed to create job thread\n", __func__);
+		return (-1);
+	}
+
+	mdx_sched_add(td);
+
+	return (0);
+}
@@ -0,0 +1,78 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_JOB_H_
+#define	_SRC_JOB_H_
+
+#define	JOB_NPARTS		128	/* Parts loaded ahead, a ring. */
+
+/* Part flags. */
+#define	JOB_NOZZLE		0x03	/* 1 or 2 */
+#define	JOB_PEEL		(1 << 2)	/* Advance the feeder first. */
+#define	JOB_VISION		(1 << 3)	/* Bottom vision. */
+
+/* Correction flags. */
+#define	JOB_CORR_TAKEN		(1 << 0)	/* Image taken, move on. */
+#define	JOB_CORR_REJECT		(1 << 1)	/* Discard the part. */
+
+/* Events. */
+#define	JOB_EV_VISION		1	/* At the camera. */
+#define	JOB_EV_PLACED		2
+#define	JOB_EV_MISSED		3	/* No part after the retries. */
+#define	JOB_EV_REJECTED		4
+#define	JOB_EV_DONE		5
+#define	JOB_EV_STOPPED		6	/* Aborted, or no correction. */
+
+/* Positions in 10^-3 mm or degrees, depths towards the nozzle. */
+struct job_part {
+	int32_t pick_x;
+	int32_t pick_y;
+	int32_t pick_z;
+	int32_t place_x;
+	int32_t place_y;
+	int32_t place_z;
+	int32_t rot;
+	int flags;
+};
+
+struct job_conf {
+	int count;
+	int retries;
+	int32_t camera_x;
+	int32_t camera_y;
+	int32_t discard_x;
+	int32_t discard_y;
+};
+
+int job_initialize(void);
+int job_start(const struct job_conf *conf);
+int job_load(int index, const struct job_part *part);
+void job_progress(int *loaded, int *next);
+int job_correct(int index, int flags, int32_t dx, int32_t dy, int32_t dr);
+int job_running(void);
+void job_abort(void);
+
+#endif /* !_SRC_JOB_H_ */
@@ -0,0 +1,180 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+
+#include "arena.h"
+#include "dwt.h"
+#include "gcode.h"
+#include "log.h"
+
+/*
+ * Mirror records to ITM stimulus port 1 as raw words: header, format
+ * string address, arguments. Needs a debugger that enabled the port
+ * and SWO on PB3, which is the S1 sensor input on this board.
+ */
+#define	LOG_ITM
+#undef	LOG_ITM
+
+#define	ITM_STIM(n)	(0xE0000000 + 4 * (n))
+#define	ITM_TER		0xE0000E00
+#define	LOG_ITM_PORT	1
+
+struct log_record {
+	uint32_t time;
+	const char *fmt;
+	uint8_t subsys;
+	uint8_t level;
+	uint8_t nargs;
+	uintptr_t args[LOG_NARGS_MAX];
+};
+
+static struct log_record log_ring[LOG_NRECORDS] __ccm;
+static uint32_t log_head;	/* Next record to write. */
+static uint32_t log_tail;	/* Next record to drain. */
+
+uint8_t log_level[LOG_NSUBSYS] = {
+	[LOG_PNP] = LOG_INFO,
+	[LOG_GCODE] = LOG_INFO,
+	[LOG_TRIG] = LOG_INFO,
+	[LOG_CONFIG] = LOG_INFO,
+};
+
+static const char *log_subsys_names[LOG_NSUBSYS] = {
+	[LOG_PNP] = "pnp",
+	[LOG_GCODE] = "gcode",
+	[LOG_TRIG] = "trig",
+	[LOG_CONFIG] = "config",
+};
+
+static const char log_level_names[] = "EWID";
+
+#ifdef	LOG_ITM
+static void
+log_itm_write(uint32_t word)
+{
+	volatile uint32_t *port;
+
+	port = (volatile uint32_t *)ITM_STIM(LOG_ITM_PORT);
+
+	/* Reads as 0 while the stimulus FIFO is full. */
+	while (*port == 0)
+		;
+	*port = word;
+}
+
+static void
+log_itm_record(struct log_record *rec)
+{
+	int i;
+
+	if ((*(volatile uint32_t *)ITM_TER & (1 << LOG_ITM_PORT)) == 0)
+		return;
+
+	log_itm_write((rec->subsys << 16) | (rec->level << 8) | rec->nargs);
+	log_itm_write((uint32_t)rec->fmt);
+	for (i = 0; i < rec->nargs; i++)
+		log_itm_write(rec->args[i]);
+}
+#endif
+
+void
+log_write(int subsys, int level, const char *fmt, int nargs,
+    uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3)
+{
+	struct log_record *rec;
+
+	critical_enter();
+	rec = &log_ring[log_head & (LOG_NRECORDS - 1)];
+	log_head += 1;
+
+	rec->time = dwt_cycles();
+	rec->fmt = fmt;
+	rec->subsys = subsys;
+	rec->level = level;
+	rec->nargs = nargs;
+	rec->args[0] = a0;
+	rec->args[1] = a1;
+	rec->args[2] = a2;
+	rec->args[3] = a3;
+
+#ifdef	LOG_ITM
+	log_itm_record(rec);
+#endif
+	critical_exit();
+}
+
+/*
+ * Level for a subsystem, or for all of them if subsys is -1.
+ */
+void
+log_set_level(int subsys, int level)
+{
+	int i;
+
+	for (i = 0; i < LOG_NSUBSYS; i++)
+		if (subsys == -1 || subsys == i)
+			log_level[i] = level;
+}
+
+/*
+ * Print and consume the pending records, one per line: cycle counter
+ * (hex), subsystem, level and the formatted message.
+ */
+void
+log_drain(void)
+{
+	struct log_record rec;
+	uint32_t dropped;
+
+	while (1) {
+		critical_enter();
+		dropped = 0;
+		if (log_head - log_tail > LOG_NRECORDS) {
+			/* Overwritten before we got there. */
+			dropped = log_head - log_tail - LOG_NRECORDS;
+			log_tail = log_head - LOG_NRECORDS;
+		}
+		if (log_tail == log_head) {
+			critical_exit();
+			break;
+		}
+		rec = log_ring[log_tail & (LOG_NRECORDS - 1)];
+		log_tail += 1;
+		critical_exit();
+
+		gcode_out_lock();
+		if (dropped)
+			printf("ok L:dropped %u\n", dropped);
+		printf("ok L:%08x %s %c ", rec.time,
+		    log_subsys_names[rec.subsys],
+		    log_level_names[rec.level]);
+		printf(rec.fmt, rec.args[0], rec.args[1], rec.args[2],
+		    rec.args[3]);
+		gcode_out_unlock();
+	}
+}
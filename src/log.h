@@ -0,0 +1,87 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_LOG_H_
+#define	_SRC_LOG_H_
+
+/*
+ * Binary log ring. A record is the format string address plus up to
+ * 4 arguments, formatted only when the ring is drained. Arguments are
+ * integers or pointers to constant strings.
+ */
+
+#define	LOG_NRECORDS	256	/* Must be a power of 2. */
+#define	LOG_NARGS_MAX	4
+
+/* Subsystems. */
+#define	LOG_PNP		0
+#define	LOG_GCODE	1
+#define	LOG_TRIG	2
+#define	LOG_CONFIG	3
+#define	LOG_NSUBSYS	4
+
+/* Levels. */
+#define	LOG_ERR		0
+#define	LOG_WARN	1
+#define	LOG_INFO	2
+#define	LOG_DEBUG	3
+
+extern uint8_t log_level[LOG_NSUBSYS];
+
+void log_write(int subsys, int level, const char *fmt, int nargs,
+    uintptr_t a0, uintptr_t a1, uintptr_t a2, uintptr_t a3);
+void log_set_level(int subsys, int level);
+void log_drain(void);
+
+#define	LOG_NARGS(...)		LOG_NARGS_(_, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define	LOG_NARGS_(_, a, b, c, d, n, ...)	n
+
+#define	LOG_ARG(x)		((uintptr_t)(x))
+#define	LOG_ARGS_0()		0, 0, 0, 0
+#define	LOG_ARGS_1(a)		LOG_ARG(a), 0, 0, 0
+#define	LOG_ARGS_2(a, b)	LOG_ARG(a), LOG_ARG(b), 0, 0
+#define	LOG_ARGS_3(a, b, c)	LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), 0
+#define	LOG_ARGS_4(a, b, c, d)	LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), LOG_ARG(d)
+#define	LOG_ARGS__(n, ...)	LOG_ARGS_##n(__VA_ARGS__)
+#define	LOG_ARGS_(n, ...)	LOG_ARGS__(n, ##__VA_ARGS__)
+
+#define	LOG(subsys, level, fmt, ...)	do {				\
+	if ((level) <= log_level[(subsys)])				\
+		log_write((subsys), (level), (fmt),			\
+		    LOG_NARGS(__VA_ARGS__),				\
+		    LOG_ARGS_(LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__));	\
+} while (0)
+
+#define	log_err(subsys, fmt, ...)	\
+	LOG(subsys, LOG_ERR, fmt, ##__VA_ARGS__)
+#define	log_warn(subsys, fmt, ...)	\
+	LOG(subsys, LOG_WARN, fmt, ##__VA_ARGS__)
+#define	log_info(subsys, fmt, ...)	\
+	LOG(subsys, LOG_INFO, fmt, ##__VA_ARGS__)
+#define	log_debug(subsys, fmt, ...)	\
+	LOG(subsys, LOG_DEBUG, fmt, ##__VA_ARGS__)
+
+#endif /* !_SRC_LOG_H_ */
@@ -37,6 +37,8 @@ main(void)
 	int error;
 	int i;
 
+	board_stacks();
+
 	printf("MDEPX started\n");
 
 	mdx_usleep(100);
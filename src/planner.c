@@ -0,0 +1,434 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+
+#include "config.h"
+#include "gcode.h"
+#include "pnp.h"
+#include "trig.h"
+#include "planner.h"
+
+/*
+ * Ratios of an axis to the move vector are kept in Q16 to keep the
+ * products within 64 bits.
+ */
+#define	PLANNER_RATIO_ONE	(1 << 16)
+
+/* 10^-6 degrees per radian. */
+#define	PLANNER_UDEG_PER_RAD	57295780LL
+
+static int planner_vector[PNP_NAXES];	/* Moves along the XY vector. */
+static int64_t planner_feedrate;	/* nm/min (F), 0 if unset. */
+static int64_t planner_accel;		/* nm/s^2 (M204), 0 if unset. */
+static int planner_factor = 100;	/* Percent (M220). */
+
+static const char planner_letters[PNP_NAXES] = { 'X', 'Y', 'Z', 'I', 'J' };
+
+static int64_t
+planner_from_steps(struct config_axis *pa, int64_t steps)
+{
+
+	return (steps * pa->revo_nm / pa->revo_steps);
+}
+
+/*
+ * Convert ratio * val (nm or 10^-6 deg) into steps.
+ */
+static uint32_t
+planner_rate(struct config_axis *pa, int64_t val, int64_t ratio)
+{
+	int64_t rate;
+
+	rate = ((val * ratio) >> 16) * pa->revo_steps / pa->revo_nm;
+	if (rate < 1)
+		rate = 1;
+	if (rate > 0x7fffffff)
+		rate = 0x7fffffff;
+
+	return (rate);
+}
+
+/*
+ * Set the default limits of an axis in config, the step ratio has to
+ * be set already. Defaults follow the former fixed ramp: start at 15%
+ * of the maximum rate and reach it in 1000 steps.
+ */
+void
+planner_init(int axis, uint32_t rate_max, int vector)
+{
+	struct config_axis *pa;
+
+	pa = &config.axis[axis];
+	planner_vector[axis] = vector;
+	pa->vmax = planner_from_steps(pa, rate_max);
+	pa->accel = planner_from_steps(pa,
+	    (uint64_t)rate_max * rate_max / 2000);
+	pa->jerk = pa->vmax * 15 / 100;
+}
+
+void
+planner_feed(struct planner_feed *feed)
+{
+
+	feed->feedrate = planner_feedrate;
+	feed->factor = planner_factor;
+}
+
+/*
+ * Feedrate limit of the Z cam. F is linear, it is converted into
+ * rotation around the centre of the cam, where it is the slowest.
+ */
+static int64_t
+planner_feed_limit(struct config_axis *pa, const struct planner_feed *feed)
+{
+
+	return (feed->feedrate / 60 * PLANNER_UDEG_PER_RAD / pa->cam_radius);
+}
+
+static void
+planner_fill(struct config_axis *pa, struct planner_profile *prof,
+    int64_t v, int64_t a, int64_t j, int64_t ratio)
+{
+
+	prof->rate_max = planner_rate(pa, v, ratio);
+	prof->accel = planner_rate(pa, a, ratio);
+	prof->rate_start = planner_rate(pa, j, ratio);
+	if (prof->rate_start > prof->rate_max)
+		prof->rate_start = prof->rate_max;
+}
+
+/*
+ * Plan a move of steps[axis] steps on each axis (0 if the axis does not
+ * move). Axes of the XY vector share one profile scaled by their part
+ * of the vector so they start and arrive together on a straight line.
+ * Other axes are planned on their own. F limits the linear motion only,
+ * the XY vector and the Z cam; the nozzles turn at their own limits.
+ * The M220 factor scales every axis of the move.
+ */
+void
+planner_plan(const int *steps, const struct planner_feed *feed,
+    struct planner_profile *prof)
+{
+	struct config_axis *pa;
+	int64_t ratio[PNP_NAXES];
+	int64_t d[PNP_NAXES];
+	int64_t len;
+	int64_t v, a, j;
+	int64_t lim;
+	int vector;
+	int i;
+
+	len = 0;
+	vector = 0;
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		if (steps[i] == 0)
+			continue;
+		pa = &config.axis[i];
+		if (planner_vector[i]) {
+			d[i] = planner_from_steps(pa, abs(steps[i]));
+			len += d[i] * d[i];
+			vector = 1;
+			continue;
+		}
+
+		v = pa->vmax;
+		if (feed->feedrate && pa->cam_radius) {
+			lim = planner_feed_limit(pa, feed);
+			if (lim < v)
+				v = lim;
+		}
+		v = v * feed->factor / 100;
+		planner_fill(pa, &prof[i], v, pa->accel, pa->jerk,
+		    PLANNER_RATIO_ONE);
+	}
+
+	if (vector == 0)
+		return;
+
+	len = trig_isqrt64(len);
+	if (len == 0)
+		len = 1;
+
+	/* The slowest axis relative to its part of the vector limits. */
+	v = a = j = 0;
+	for (i = 0; i < PNP_NAXES; i++) {
+		pa = &config.axis[i];
+		if (steps[i] == 0 || planner_vector[i] == 0)
+			continue;
+		ratio[i] = d[i] * PLANNER_RATIO_ONE / len;
+		if (ratio[i] == 0)
+			ratio[i] = 1;
+		lim = pa->vmax * PLANNER_RATIO_ONE / ratio[i];
+		if (v == 0 || lim < v)
+			v = lim;
+		lim = pa->accel * PLANNER_RATIO_ONE / ratio[i];
+		if (a == 0 || lim < a)
+			a = lim;
+		lim = pa->jerk * PLANNER_RATIO_ONE / ratio[i];
+		if (j == 0 || lim < j)
+			j = lim;
+	}
+
+	if (feed->feedrate && feed->feedrate / 60 < v)
+		v = feed->feedrate / 60;
+	v = v * feed->factor / 100;
+	if (planner_accel && planner_accel < a)
+		a = planner_accel;
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		pa = &config.axis[i];
+		if (steps[i] == 0 || planner_vector[i] == 0)
+			continue;
+		planner_fill(pa, &prof[i], v, a, j, ratio[i]);
+	}
+}
+
+/*
+ * Step rate for step i of an n steps move.
+ */
+uint32_t
+planner_step_rate(const struct planner_profile *prof, uint32_t i,
+    uint32_t n)
+{
+	uint64_t max2;
+	uint64_t v2;
+	uint32_t d;
+
+	if (prof->accel == 0)
+		return (prof->rate_max);
+
+	/* Distance to the nearest end of the move. */
+	d = i < (n - i) ? i : (n - i);
+
+	v2 = (uint64_t)prof->rate_start * prof->rate_start +
+	    2 * (uint64_t)prof->accel * d;
+	max2 = (uint64_t)prof->rate_max * prof->rate_max;
+	if (v2 >= max2)
+		return (prof->rate_max);
+
+	return (trig_isqrt64(v2));
+}
+
+/*
+ * Steps the profile takes to accelerate from its start rate to rate.
+ */
+uint32_t
+planner_accel_steps(const struct planner_profile *prof, uint32_t rate)
+{
+	uint64_t min2;
+	uint64_t v2;
+
+	if (prof->accel == 0)
+		return (0);
+
+	v2 = (uint64_t)rate * rate;
+	min2 = (uint64_t)prof->rate_start * prof->rate_start;
+	if (v2 <= min2)
+		return (0);
+
+	return ((v2 - min2) / (2 * (uint64_t)prof->accel));
+}
+
+/*
+ * Step rate d steps into a stop that started at rate, with the
+ * deceleration of the profile. Returns 0 once the rate is down to the
+ * start rate, where the axis can stop at once.
+ */
+uint32_t
+planner_stop_rate(const struct planner_profile *prof, uint32_t rate,
+    uint32_t d)
+{
+	uint64_t min2;
+	uint64_t dec;
+	uint64_t v2;
+
+	if (prof->accel == 0)
+		return (0);
+
+	v2 = (uint64_t)rate * rate;
+	dec = 2 * (uint64_t)prof->accel * d;
+	min2 = (uint64_t)prof->rate_start * prof->rate_start;
+	if (dec >= v2 || v2 - dec <= min2)
+		return (0);
+
+	return (trig_isqrt64(v2 - dec));
+}
+
+/*
+ * Time to cover d steps from the start rate, accelerating up to the
+ * maximum rate, us. Continuous form of planner_step_rate(): over a
+ * ramp the rate grows linearly in time, (v - rate_start) / accel.
+ */
+static uint64_t
+planner_ramp_time(const struct planner_profile *prof, uint32_t d)
+{
+	uint32_t ramp;
+	uint64_t v;
+
+	if (prof->rate_max == 0)
+		return (0);
+
+	if (prof->accel == 0)
+		return ((uint64_t)d * 1000000 / prof->rate_max);
+
+	ramp = planner_accel_steps(prof, prof->rate_max);
+	if (d <= ramp) {
+		v = trig_isqrt64((uint64_t)prof->rate_start * prof->rate_start +
+		    2 * (uint64_t)prof->accel * d);
+		return ((v - prof->rate_start) * 1000000 / prof->accel);
+	}
+
+	return ((uint64_t)(prof->rate_max - prof->rate_start) * 1000000 /
+	    prof->accel + (uint64_t)(d - ramp) * 1000000 / prof->rate_max);
+}
+
+/*
+ * Time left of an n steps move with the profile once i steps are done,
+ * us. With i = 0 this is the duration of the move.
+ */
+uint32_t
+planner_time_left(const struct planner_profile *prof, uint32_t i,
+    uint32_t n)
+{
+	uint64_t total;
+	uint64_t done;
+	uint32_t half;
+
+	if (i >= n)
+		return (0);
+
+	half = n / 2;
+	total = planner_ramp_time(prof, half) +
+	    planner_ramp_time(prof, n - half);
+	if (i <= half)
+		done = planner_ramp_time(prof, i);
+	else
+		done = total - planner_ramp_time(prof, n - i);
+
+	return (total - done);
+}
+
+void
+planner_set_feedrate(int64_t f)
+{
+
+	if (f > 0)
+		planner_feedrate = f;
+}
+
+static int64_t *
+planner_param(int axis, int code)
+{
+	struct config_axis *pa;
+
+	pa = &config.axis[axis];
+
+	switch (code) {
+	case 201:
+		return (&pa->accel);
+	case 203:
+		return (&pa->vmax);
+	default:
+		return (&pa->jerk);
+	}
+}
+
+/*
+ * M201 (acceleration), M203 (velocity) and M205 (start velocity) take
+ * per axis values in mm (X, Y) or degrees (Z cam, I and J heads) per
+ * second. Without arguments they report the current values.
+ */
+static void
+planner_axes_command(struct gcode_command *cmd)
+{
+	int64_t val[PNP_NAXES];
+	int set[PNP_NAXES];
+	int i;
+
+	val[PNP_AXIS_X] = cmd->x;
+	set[PNP_AXIS_X] = cmd->x_set;
+	val[PNP_AXIS_Y] = cmd->y;
+	set[PNP_AXIS_Y] = cmd->y_set;
+	val[PNP_AXIS_Z] = cmd->z;
+	set[PNP_AXIS_Z] = cmd->z_set;
+	val[PNP_AXIS_H1] = cmd->h1;
+	set[PNP_AXIS_H1] = cmd->h1_set;
+	val[PNP_AXIS_H2] = cmd->h2;
+	set[PNP_AXIS_H2] = cmd->h2_set;
+
+	if (!(cmd->x_set || cmd->y_set || cmd->z_set || cmd->h1_set ||
+	    cmd->h2_set)) {
+		gcode_out_lock();
+		printf("ok");
+		for (i = 0; i < PNP_NAXES; i++)
+			printf(" %c:%d", planner_letters[i],
+			    (int)(*planner_param(i, cmd->code) /
+			    GCODE_FIXED_ONE));
+		printf("\n");
+		gcode_out_unlock();
+		return;
+	}
+
+	for (i = 0; i < PNP_NAXES; i++)
+		if (set[i] && val[i] > 0)
+			*planner_param(i, cmd->code) = val[i];
+}
+
+void
+planner_command(struct gcode_command *cmd)
+{
+
+	switch (cmd->code) {
+	case 201:
+	case 203:
+	case 205:
+		planner_axes_command(cmd);
+		break;
+	case 204:
+		/* XY acceleration of the following moves, S0 to reset. */
+		if (cmd->s_set && cmd->s >= 0) {
+			planner_accel = (int64_t)cmd->s * GCODE_FIXED_ONE;
+			break;
+		}
+		gcode_out_lock();
+		printf("ok S:%d\n", (int)(planner_accel / GCODE_FIXED_ONE));
+		gcode_out_unlock();
+		break;
+	case 220:
+		/* Speed factor, percent of the planned velocity. */
+		if (cmd->s_set && cmd->s > 0 && cmd->s <= 100) {
+			planner_factor = cmd->s;
+			break;
+		}
+		gcode_out_lock();
+		printf("ok S:%d\n", planner_factor);
+		gcode_out_unlock();
+		break;
+	}
+}
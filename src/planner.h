@@ -0,0 +1,70 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_PLANNER_H_
+#define	_SRC_PLANNER_H_
+
+/*
+ * Units of the frequency given to stm32f4_pwm_step() per step/s.
+ */
+#define	PLANNER_FREQ_SCALE	100
+
+/*
+ * Velocity profile of one axis for one move, in steps. The rate ramps
+ * from rate_start to rate_max with constant acceleration and back down
+ * symmetrically. An accel of 0 means a constant rate_max.
+ */
+struct planner_profile {
+	uint32_t rate_start;	/* steps/s */
+	uint32_t rate_max;	/* steps/s */
+	uint32_t accel;		/* steps/s^2 */
+};
+
+/*
+ * Feed of one move, taken from the modal F and M220 when it is sent. A
+ * move replanned in flight keeps the feed it was sent with.
+ */
+struct planner_feed {
+	int64_t feedrate;	/* nm/min (F), 0 if unset. */
+	int factor;		/* Percent (M220). */
+};
+
+void planner_init(int axis, uint32_t rate_max, int vector);
+void planner_feed(struct planner_feed *feed);
+void planner_plan(const int *steps, const struct planner_feed *feed,
+    struct planner_profile *prof);
+void planner_set_feedrate(int64_t f);
+void planner_command(struct gcode_command *cmd);
+uint32_t planner_step_rate(const struct planner_profile *prof, uint32_t i,
+    uint32_t n);
+uint32_t planner_accel_steps(const struct planner_profile *prof,
+    uint32_t rate);
+uint32_t planner_stop_rate(const struct planner_profile *prof, uint32_t rate,
+    uint32_t d);
+uint32_t planner_time_left(const struct planner_profile *prof, uint32_t i,
+    uint32_t n);
+
+#endif /* !_SRC_PLANNER_H_ */
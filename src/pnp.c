@@ -31,13 +31,21 @@
 #include <sys/sem.h>
 #include <sys/thread.h>
 
-#include <lib/msun/src/math.h>
-
 #include <arm/stm/stm32f4.h>
 
+#include "arena.h"
+#include "bench.h"
 #include "board.h"
+#include "capture.h"
+#include "config.h"
+#include "dwt.h"
 #include "gcode.h"
+#include "gpio.h"
+#include "job.h"
+#include "log.h"
+#include "planner.h"
 #include "pnp.h"
+#include "telemetry.h"
 #include "trig.h"
 
 #define	PNP_DEBUG
@@ -77,31 +85,169 @@
 #define	PNP_STEPS_H_MIN		(-180000000 / PNP_NR_STEP_DEG)
 #define	PNP_STEPS_H_MAX		(180000000 / PNP_NR_STEP_DEG)
 
+/* Step timer registers, read back to get the programmed step period. */
+#define	PNP_TIM_CR1		0x00
+#define	PNP_TIM_CR1_CEN		(1 << 0)
+#define	PNP_TIM_CNT		0x24
+#define	PNP_TIM_PSC		0x28
+#define	PNP_TIM_ARR		0x2C
+
+#define	PNP_THREAD_STACK_SIZE	4096
+
+/* Position compare output, the spare vibrator driver. */
+#define	PNP_STROBE_PORT		PORT_A
+#define	PNP_STROBE_PIN		3
+
+/* Homing defaults. */
+#define	PNP_HOME_BACKOFF_NM	(10000000)
+#define	PNP_HOME_INTO_NM	(1000000)
+#define	PNP_HOME_RATE_FAST	20	/* percent */
+#define	PNP_HOME_RATE_SLOW	2	/* percent */
+
+/* Step schedules. */
+#define	PNP_SCHED_NSEGS		64	/* Per axis, must be a power of 2. */
+#define	PNP_SCHED_MIN_PERIOD	(2 * DWT_CYCLES_PER_US)
+#define	PNP_SCHED_MAX_LATE	(1000 * DWT_CYCLES_PER_US)
+
+#if PNP_NAXES > CONFIG_NAXES
+#error "Stored configuration has less axes than PNP_AXES"
+#endif
+
 struct move_task {
 	int steps;
 	int check_home;
 	int direction;
-	int speed;
+	struct planner_profile prof;
 	mdx_sem_t task_compl_sem;
-	int speed_control;
+
+	/*
+	 * Jog: the main loop does not wait for the move, and may replace
+	 * the target (absolute, in steps) and profile while busy.
+	 */
+	int jog;
+	volatile int busy;
+	volatile int retarget;
+	int target;
+	struct planner_profile jog_prof;
+	struct planner_feed feed;	/* To replan the jog with. */
+
+	/* Progress along the profile of the move in flight. */
+	volatile int step;
+	volatile int nsteps;
 
 	/* Result */
 	int home_found;
 };
 
+/*
+ * Step schedule sent by the host (see frame.c): segments of count
+ * steps, the first one interval cycles after the previous step, the
+ * interval growing by add after each step. The main loop appends, the
+ * step ISR replays them without the worker.
+ */
+struct pnp_sched_seg {
+	uint32_t interval;
+	uint16_t count;
+	int16_t add;
+	int dir;
+};
+
+struct pnp_sched {
+	struct pnp_sched_seg segs[PNP_SCHED_NSEGS];
+	volatile uint32_t head;		/* Main loop. */
+	volatile uint32_t tail;		/* Step ISR. */
+	volatile int active;
+	uint32_t clock;		/* CYCCNT of the last step, or the start. */
+	uint32_t interval;
+	int16_t add;
+	uint16_t left;		/* Steps left in the current segment. */
+	uint32_t late;		/* Steps issued after their time. */
+	uint32_t stopped;	/* Schedules cut short. */
+	uint32_t steps;		/* Since the start, for capture. */
+	int home_prev;
+};
+
+/*
+ * Axis table. Each entry generates the step interrupt handler and a
+ * worker thread with the step, direction and home routines of the axis
+ * inlined, so adding an axis is a matter of adding a line here.
+ *
+ * Fields: name, axis id, PWM softc, step timer, PWM channels, maximum
+ * step rate (steps/s), direction port, direction pins driven high for
+ * direction 1 (and low for direction 0), direction pins driven low for
+ * direction 1, home switch port (-1 if none), home switch pin, step
+ * ratio (nm or 10^-6 deg per revo steps), steps limits, part of the XY
+ * vector, cam radius if linear motion is translated into rotation.
+ */
+#define	PNP_AXES(A)							\
+	A(x, X, &pwm_x_sc, TIM10_BASE, (1 << 0), 150000,		\
+	    PORT_E, (1 << 5), 0, PORT_C, 6,				\
+	    PNP_XY_FULL_REVO_NM, PNP_XY_FULL_REVO_STEPS,		\
+	    PNP_STEPS_X_MIN, PNP_STEPS_X_MAX, 1, 0)			\
+	A(y, Y, &pwm_y_sc, TIM4_BASE, ((1 << 0) | (1 << 1)), 150000,	\
+	    PORT_C, (1 << 9), (1 << 13), PORT_C, 7,			\
+	    PNP_XY_FULL_REVO_NM, PNP_XY_FULL_REVO_STEPS,		\
+	    PNP_STEPS_Y_MIN, PNP_STEPS_Y_MAX, 1, 0)			\
+	A(z, Z, &pwm_z_sc, TIM14_BASE, (1 << 0), 50000,			\
+	    PORT_E, (1 << 3), 0, PORT_B, 4,				\
+	    PNP_Z_FULL_REVO_DEG, PNP_Z_FULL_REVO_STEPS,			\
+	    PNP_STEPS_Z_MIN, PNP_STEPS_Z_MAX, 0, CAM_RADIUS)		\
+	A(h1, H1, &pwm_h1_sc, TIM13_BASE, (1 << 0), 50000,		\
+	    PORT_D, (1 << 1), 0, -1, 0,					\
+	    PNP_NR_FULL_REVO_DEG, PNP_NR_FULL_REVO_STEPS,		\
+	    PNP_STEPS_H_MIN, PNP_STEPS_H_MAX, 0, 0)			\
+	A(h2, H2, &pwm_h2_sc, TIM12_BASE, (1 << 0), 50000,		\
+	    PORT_D, (1 << 0), 0, -1, 0,					\
+	    PNP_NR_FULL_REVO_DEG, PNP_NR_FULL_REVO_STEPS,		\
+	    PNP_STEPS_H_MIN, PNP_STEPS_H_MAX, 0, 0)
+
+struct pnp_axis {
+	const char *name;
+	struct stm32f4_pwm_softc *pwm;
+	uint32_t tim_base;	/* Step timer. */
+	int chanset;		/* PWM channels. */
+	uint32_t rate_max;
+	int dir_port;
+	uint32_t dir_fwd;
+	uint32_t dir_rev;
+	int home_port;
+	int home_pin;
+	int64_t revo_nm;
+	int revo_steps;
+	int steps_min;
+	int steps_max;
+	int vector;
+	int64_t cam_radius;
+};
+
+static const struct pnp_axis pnp_axes[PNP_NAXES] = {
+#define	A(n, N, ...)	[PNP_AXIS_##N] = { #N " Motor", __VA_ARGS__ },
+	PNP_AXES(A)
+#undef	A
+};
+
 struct motor_state {
-	int chanset;	/* PWM channels. */
+	int axis;
+	const struct pnp_axis *ax;
 	mdx_sem_t worker_sem;
 	struct move_task task;
 	const char *name;
-	void (*set_direction)(int dir);
-	int (*is_at_home)(void);
-	void (*step)(int chanset, int speed);
+	int dir_invert;		/* Swap meaning of the direction pins. */
 	mdx_sem_t step_sem;
-	int step_nm;	/* Length of a step, nanometers. Has to be signed. */
+	uint32_t step_intr_time;	/* CYCCNT at step ISR entry. */
+	uint32_t step_intr_cnt;		/* Timer counter then, */
+	int step_intr_run;		/* if it was still counting. */
+	uint32_t step_intr_psc;		/* And the period that ended. */
+	uint32_t step_intr_arr;
+	/*
+	 * Step length as an exact ratio: revo_nm nanometers (or 10^-6
+	 * degrees) per revo_steps steps.
+	 */
+	int64_t revo_nm;
+	int revo_steps;
 
-	int (*cam_translate_mm_to_deg)(float z, float cam_radius, int *result);
-	int cam_radius;
+	/* Cam radius of an axis translated into rotation, or 0. */
+	int64_t cam_radius;
 
 	/*
 	 * Current offset from home in steps.
@@ -109,87 +255,203 @@ struct motor_state {
 	 */
 	int steps;
 
+	/*
+	 * Steps seen by the step ISR and counted by the worker; they
+	 * differ by one between the ISR and the worker waking up.
+	 */
+	volatile uint32_t isr_steps;
+	uint32_t done_steps;
+	volatile int strobe;	/* Compare output raised by this axis. */
+
+	struct pnp_sched sched;
+
 	/* Limits. */
 	int steps_max;
 	int steps_min;
 };
 
 struct pnp_state {
-	struct motor_state motor_x;
-	struct motor_state motor_y;
-	struct motor_state motor_z;
-	struct motor_state motor_h1;
-	struct motor_state motor_h2;
+#define	A(n, ...)	struct motor_state motor_##n;
+	PNP_AXES(A)
+#undef	A
 };
 
-static struct pnp_state pnp;
+static struct pnp_state pnp __ccm;
 
-void
-pnp_pwm_y_intr(void *arg, int irq)
-{
+/*
+ * Feed control, set from the UART interrupt. On hold or abort the
+ * workers decelerate to a stop; on hold they wait there for resume.
+ */
+static volatile int pnp_ctl;
 
-	stm32f4_pwm_intr(arg, irq);
-	mdx_sem_post(&pnp.motor_y.step_sem);
-}
+/* G0 moves are jogs (M921). */
+static int pnp_jog_mode;
 
-void
-pnp_pwm_x_intr(void *arg, int irq)
+/* Between the homing moves the axes are not idle either. */
+static volatile int pnp_homing;
+
+static struct motor_state * const pnp_motors[PNP_NAXES] = {
+#define	A(n, N, ...)	[PNP_AXIS_##N] = &pnp.motor_##n,
+	PNP_AXES(A)
+#undef	A
+};
+
+/*
+ * Position compare (M923): the step ISR of the armed axis raises the
+ * strobe output when the axis reaches the armed position and latches
+ * the position of all axes.
+ */
+struct pnp_compare {
+	volatile int armed;
+	int axis;
+	int target;			/* Steps. */
+	int pos[PNP_NAXES];		/* Latched, steps. */
+	uint32_t time;			/* CYCCNT at the strobe edge. */
+	uint32_t latency;		/* From the step edge, cycles. */
+	uint32_t lat_min;
+	uint32_t lat_max;
+	uint32_t count;
+};
+
+static struct pnp_compare pnp_cmp __ccm;
+
+/*
+ * Position of an axis as of its last step edge, including a step the
+ * worker has not counted yet. Interrupt context.
+ */
+static inline int
+pnp_isr_pos(struct motor_state *motor)
 {
+	int pending;
+
+	pending = motor->isr_steps - motor->done_steps;
+	if (motor->task.direction)
+		return (motor->steps + pending);
 
-	stm32f4_pwm_intr(arg, irq);
-	mdx_sem_post(&pnp.motor_x.step_sem);
+	return (motor->steps - pending);
 }
 
-void
-pnp_pwm_z_intr(void *arg, int irq)
+static inline void
+pnp_compare(struct motor_state *motor)
 {
+	struct pnp_compare *cmp;
+	int i;
+
+	cmp = &pnp_cmp;
+	if (cmp->armed == 0 || cmp->axis != motor->axis ||
+	    pnp_isr_pos(motor) != cmp->target)
+		return;
+
+	gpio_bsrr(PNP_STROBE_PORT, (1 << PNP_STROBE_PIN));
+	cmp->time = dwt_cycles();
+	motor->strobe = 1;
 
-	stm32f4_pwm_intr(arg, irq);
-	mdx_sem_post(&pnp.motor_z.step_sem);
+	for (i = 0; i < PNP_NAXES; i++)
+		cmp->pos[i] = pnp_isr_pos(pnp_motors[i]);
+
+	/*
+	 * The step edge is the update event: the timer counted on from it
+	 * until ISR entry. Without the counter, from ISR entry only.
+	 */
+	cmp->latency = cmp->time - motor->step_intr_time;
+	if (motor->step_intr_run)
+		cmp->latency += motor->step_intr_cnt *
+		    (motor->step_intr_psc + 1) * 2;
+	if (cmp->count == 0 || cmp->latency < cmp->lat_min)
+		cmp->lat_min = cmp->latency;
+	if (cmp->latency > cmp->lat_max)
+		cmp->lat_max = cmp->latency;
+	cmp->count += 1;
+	cmp->armed = 0;
 }
 
-void
-pnp_pwm_h1_intr(void *arg, int irq)
+static void pnp_sched_step(struct motor_state *motor,
+    const struct pnp_axis *ax);
+
+/*
+ * The step timers count up: at the update event CNT goes back to 0 and
+ * keeps counting while the interrupt is pending, so its value at ISR
+ * entry is the latency of the interrupt. That holds only if the update
+ * did not stop the timer (one-pulse mode clears CEN), so CEN is read
+ * too and a stopped timer gives no latency sample. A latency of a whole
+ * period or more wraps CNT and reads short; the jitter, taken from
+ * CYCCNT, still shows it. PSC and ARR are only written for the next
+ * step after this ISR, they still hold the period that just ended.
+ */
+static inline void
+pnp_isr_timer(struct motor_state *motor, const struct pnp_axis *ax)
 {
 
-	stm32f4_pwm_intr(arg, irq);
-	mdx_sem_post(&pnp.motor_h1.step_sem);
+	motor->step_intr_cnt = *(volatile uint32_t *)(ax->tim_base +
+	    PNP_TIM_CNT);
+	motor->step_intr_run = (*(volatile uint32_t *)(ax->tim_base +
+	    PNP_TIM_CR1) & PNP_TIM_CR1_CEN) != 0;
+	motor->step_intr_psc = *(volatile uint32_t *)(ax->tim_base +
+	    PNP_TIM_PSC);
+	motor->step_intr_arr = *(volatile uint32_t *)(ax->tim_base +
+	    PNP_TIM_ARR);
 }
 
-void
-pnp_pwm_h2_intr(void *arg, int irq)
+#define	A(n, N, ...)							\
+void									\
+pnp_pwm_##n##_intr(void *arg, int irq)					\
+{									\
+									\
+	pnp.motor_##n.step_intr_time = dwt_cycles();			\
+	pnp_isr_timer(&pnp.motor_##n, &pnp_axes[PNP_AXIS_##N]);	\
+	stm32f4_pwm_intr(arg, irq);					\
+	pnp.motor_##n.isr_steps += 1;					\
+	if (pnp.motor_##n.sched.active) {				\
+		pnp_sched_step(&pnp.motor_##n, &pnp_axes[PNP_AXIS_##N]);\
+		return;							\
+	}								\
+	pnp_compare(&pnp.motor_##n);					\
+	mdx_sem_post(&pnp.motor_##n.step_sem);				\
+}
+PNP_AXES(A)
+#undef	A
+
+/*
+ * Per-axis routines. These are given a pointer into the constant axis
+ * table, so once inlined into a specialized worker the register
+ * addresses and masks become immediates.
+ */
+static inline void
+pnp_axis_set_direction(const struct pnp_axis *ax, int dir)
 {
 
-	stm32f4_pwm_intr(arg, irq);
-	mdx_sem_post(&pnp.motor_h2.step_sem);
+	if (dir)
+		gpio_bsrr(ax->dir_port, ax->dir_fwd | (ax->dir_rev << 16));
+	else
+		gpio_bsrr(ax->dir_port, ax->dir_rev | (ax->dir_fwd << 16));
 }
 
 static inline int
-pnp_is_x_home(void)
+pnp_axis_has_home(const struct pnp_axis *ax)
 {
 
-	return (pin_get(&gpio_sc, PORT_C, 6));
+	return (ax->home_port >= 0);
 }
 
 static inline int
-pnp_is_yl_home(void)
+pnp_axis_is_at_home(const struct pnp_axis *ax)
 {
 
-	return (pin_get(&gpio_sc, PORT_C, 7));
+	return (gpio_get(ax->home_port, ax->home_pin));
 }
 
-static inline int
-pnp_is_z_home(void)
+static inline void
+pnp_axis_step(const struct pnp_axis *ax, uint32_t rate)
 {
 
-	return (pin_get(&gpio_sc, PORT_B, 4));
+	stm32f4_pwm_step(ax->pwm, ax->chanset, rate * PLANNER_FREQ_SCALE);
 }
 
 static inline int __unused
 pnp_is_yr_home(void)
 {
 
-	return (pin_get(&gpio_sc, PORT_C, 1));
+	return (gpio_get(PORT_C, 1));
 }
 
 static void
@@ -234,200 +496,455 @@ pnp_henable(int enable)
 	mdx_usleep(10000);
 }
 
-static void
-pnp_xset_direction(int dir)
-{
-
-	pin_set(&gpio_sc, PORT_E, 5, dir); /* X FR */
-}
-
-static void
-pnp_h1set_direction(int dir)
-{
-
-	pin_set(&gpio_sc, PORT_D, 1, dir); /* H1 FR */
-}
-
-static void
-pnp_h2set_direction(int dir)
-{
-
-	pin_set(&gpio_sc, PORT_D, 0, dir); /* H2 FR */
-}
-
-static void
-pnp_yset_direction(int dir)
-{
-	int rdir;
-
-	rdir = dir ? 0 : 1;
-
-	pin_set(&gpio_sc, PORT_C, 13, rdir); /* Y R FR */
-	pin_set(&gpio_sc, PORT_C, 9, dir); /* Y L FR */
-}
-
-static void
-pnp_yset_direction_rev(int dir)
+/*
+ * Step period as programmed by stm32f4_pwm_step(), in CPU cycles.
+ * Timers are clocked at half of the CPU frequency.
+ */
+static inline uint32_t
+pnp_step_period(const struct pnp_axis *ax)
 {
-	int rdir;
-
-	rdir = dir ? 0 : 1;
-
-	pin_set(&gpio_sc, PORT_C, 13, !rdir); /* Y R FR */
-	pin_set(&gpio_sc, PORT_C, 9, !dir); /* Y L FR */
-}
+	uint32_t psc;
+	uint32_t arr;
 
-static void
-pnp_zset_direction(int dir)
-{
+	psc = *(volatile uint32_t *)(ax->tim_base + PNP_TIM_PSC);
+	arr = *(volatile uint32_t *)(ax->tim_base + PNP_TIM_ARR);
 
-	pin_set(&gpio_sc, PORT_E, 3, dir); /* Z FR */
+	return ((psc + 1) * (arr + 1) * 2);
 }
 
+/*
+ * Program the next step of a schedule, due at sched->clock; a step that
+ * is already late goes out after the minimum period. A schedule that
+ * runs dry, would leave the travel limits or falls behind by more than
+ * PNP_SCHED_MAX_LATE ends there. Step ISR, or with interrupts disabled.
+ */
 static void
-xstep(int chanset, int speed)
+pnp_sched_next(struct motor_state *motor, const struct pnp_axis *ax)
 {
-	uint32_t freq;
+	struct pnp_sched_seg *seg;
+	struct pnp_sched *sched;
+	uint32_t period;
+	int next;
+
+	sched = &motor->sched;
+
+	if (sched->left == 0) {
+		if (sched->tail == sched->head) {
+			sched->active = 0;
+			motor->task.busy = 0;
+			return;
+		}
+		seg = &sched->segs[sched->tail & (PNP_SCHED_NSEGS - 1)];
+		sched->interval = seg->interval;
+		sched->add = seg->add;
+		sched->left = seg->count;
+		sched->tail += 1;
+		if (seg->dir != motor->task.direction) {
+			motor->task.direction = seg->dir;
+			pnp_axis_set_direction(ax, seg->dir ^ motor->dir_invert);
+		}
+	} else
+		sched->interval += sched->add;
+
+	next = motor->steps + (motor->task.direction ? 1 : -1);
+	if (next > motor->steps_max || next < motor->steps_min)
+		goto stop;
+
+	sched->clock += sched->interval;
+	sched->left -= 1;
+
+	period = sched->clock - dwt_cycles();
+	if ((int32_t)period < PNP_SCHED_MIN_PERIOD) {
+		/* Do not catch up on a queue that ran dry. */
+		if ((int32_t)period < -PNP_SCHED_MAX_LATE)
+			goto stop;
+		period = PNP_SCHED_MIN_PERIOD;
+		sched->late += 1;
+	}
 
-	freq = speed * 150000;
+	stm32f4_pwm_step(ax->pwm, ax->chanset,
+	    (uint64_t)DWT_CPU_FREQ * PLANNER_FREQ_SCALE / period);
 
-	stm32f4_pwm_step(&pwm_x_sc, chanset, freq);
+	return;
+stop:
+	sched->tail = sched->head;
+	sched->left = 0;
+	sched->stopped += 1;
+	sched->active = 0;
+	motor->task.busy = 0;
 }
 
-static void
-ystep(int chanset, int speed)
+/*
+ * Step capture of a schedule, as the worker does for a planned move:
+ * the home sensor trigger and the step event.
+ */
+static inline void
+pnp_sched_capture(struct motor_state *motor, const struct pnp_axis *ax)
 {
-	uint32_t freq;
+	struct pnp_sched *sched;
+	int home;
 
-	freq = speed * 150000;
+	sched = &motor->sched;
 
-	stm32f4_pwm_step(&pwm_y_sc, chanset, freq);
+	if (capture_state == CAPTURE_STATE_ARMED && pnp_axis_has_home(ax)) {
+		home = pnp_axis_is_at_home(ax);
+		if (sched->home_prev != -1 && home != sched->home_prev)
+			capture_trigger(CAPTURE_TRIG_HOME);
+		sched->home_prev = home;
+	}
+	capture_step(motor->axis, motor->task.direction, sched->steps,
+	    motor->step_intr_time);
 }
 
+/*
+ * Step ISR of an axis replaying a schedule: count the step, end the
+ * compare output pulse or raise it, and program the next step.
+ */
 static void
-zstep(int chanset, int speed)
+pnp_sched_step(struct motor_state *motor, const struct pnp_axis *ax)
 {
-	uint32_t freq;
 
-	freq = speed * 50000;
-
-	stm32f4_pwm_step(&pwm_z_sc, chanset, freq);
-}
+	if (motor->strobe) {
+		gpio_bsrr(PNP_STROBE_PORT, (1 << (PNP_STROBE_PIN + 16)));
+		motor->strobe = 0;
+	}
 
-static void
-h1step(int chanset, int speed)
-{
-	uint32_t freq;
+	if (motor->task.direction)
+		motor->steps += 1;
+	else
+		motor->steps -= 1;
+	motor->done_steps += 1;
 
-	freq = speed * 50000;
+	if (capture_state != CAPTURE_STATE_IDLE)
+		pnp_sched_capture(motor, ax);
+	motor->sched.steps += 1;
 
-	stm32f4_pwm_step(&pwm_h1_sc, chanset, freq);
+	pnp_compare(motor);
+	pnp_sched_next(motor, ax);
 }
 
-static void
-h2step(int chanset, int speed)
+/*
+ * Steps left to a jog target in the current direction of the move,
+ * negative if the axis has to turn around.
+ */
+static inline int
+pnp_jog_left(struct motor_state *motor, int target)
 {
-	uint32_t freq;
 
-	freq = speed * 50000;
+	if (motor->task.direction)
+		return (target - motor->steps);
 
-	stm32f4_pwm_step(&pwm_h2_sc, chanset, freq);
+	return (motor->steps - target);
 }
 
-static int
-calc_speed(int i, int steps, int speed)
+/*
+ * The move is done unless a new jog target came in meanwhile.
+ */
+static inline int
+pnp_worker_done(struct move_task *task)
 {
-	int t;
+	int done;
 
-	t = i < (steps - i) ? i : (steps - i);
-	if (t < 1000) {
-		/* Gradually increase/decrease speed */
-		speed = t / 10;
-		if (speed < 15)
-			speed = 15;
-	}
+	critical_enter();
+	done = (task->retarget == 0);
+	if (done)
+		task->busy = 0;
+	critical_exit();
 
-	return (speed);
+	return (done);
 }
 
-static void
-pnp_worker_thread(void *arg)
+/*
+ * Worker body, inlined into one thread entry per axis so that the axis
+ * table lookups fold into constants.
+ */
+static inline __attribute__((__always_inline__)) void
+pnp_worker(struct motor_state *motor, const struct pnp_axis *ax)
 {
-	struct motor_state *motor;
 	struct move_task *task;
-	uint32_t steps;
-	int speed;
+	struct tm_move rec;
+	uint32_t period;
+	uint32_t intr;
+	uint32_t psc;
+	uint32_t start;
+	uint32_t prev;
+	uint32_t late;
+	uint32_t now;
+	uint32_t stop_rate;
+	uint32_t rate;
+	uint32_t tmp;
+	int home_prev;
+	int target;
+	int steps;
+	int home;
+	int left;
+	int stop;
+	int base;
 	int i;
 
-	motor = arg;
 	task = &motor->task;
 
 	while (1) {
 		mdx_sem_wait(&motor->worker_sem);
 		dprintf("%s: task rcvd\n", __func__);
+		telemetry_cmd_stamp(TM_STAGE_START);
+		capture_trigger(CAPTURE_TRIG_MOVE);
 
 		steps = task->steps;
-		speed = task->speed;
 
 		dprintf("%s: steps needed %d\n", __func__, steps);
 
-		motor->set_direction(task->direction);
+		pnp_axis_set_direction(ax, task->direction ^ motor->dir_invert);
+
+		bzero(&rec, sizeof(struct tm_move));
+		rec.axis = motor->axis;
+		rec.direction = task->direction;
+		rec.check_home = task->check_home;
+
+		start = prev = dwt_cycles();
+		intr = 0;
+		home_prev = -1;
+		rate = task->prof.rate_start;
+		stop_rate = 0;
+		stop = -1;
+		base = 0;
+		task->step = 0;
+		task->nsteps = steps;
+
+		i = 0;
+		while (1) {
+			/* A jog replaced the target of the move. */
+			if (task->retarget) {
+				critical_enter();
+				task->prof = task->jog_prof;
+				target = task->target;
+				task->retarget = 0;
+				critical_exit();
+				left = pnp_jog_left(motor, target);
+				if (left > 0 && pnp_ctl == PNP_CTL_RUN) {
+					/* Same direction, go on at this rate. */
+					steps = i + left;
+					base = i - planner_accel_steps(&task->prof,
+					    rate);
+					stop = -1;
+				} else if (stop < 0) {
+					/* Stop first, then turn around. */
+					stop_rate = rate;
+					stop = i;
+				}
+			}
+
+			/* Decelerate from the current rate on hold or abort. */
+			if (pnp_ctl != PNP_CTL_RUN && stop < 0) {
+				stop_rate = rate;
+				stop = i;
+			}
+
+			if (stop >= 0) {
+				rate = 0;
+				if (i < steps)
+					rate = planner_stop_rate(&task->prof,
+					    stop_rate, i - stop);
+				if (rate == 0) {
+					/* Stopped, wait for resume. */
+					while (pnp_ctl == PNP_CTL_HOLD)
+						mdx_usleep(1000);
+					if (pnp_ctl == PNP_CTL_ABORT)
+						break;
+					/* Start over from here. */
+					stop = -1;
+					base = i;
+					if (task->jog) {
+						left = pnp_jog_left(motor,
+						    task->target);
+						if (left < 0) {
+							task->direction ^= 1;
+							pnp_axis_set_direction(ax,
+							    task->direction ^
+							    motor->dir_invert);
+							left = -left;
+						}
+						steps = i + left;
+					}
+				}
+			}
+
+			if (i >= steps) {
+				if (pnp_worker_done(task))
+					break;
+				continue;
+			}
 
-		for (i = 0; i < steps; i++) {
-			if (task->check_home && motor->is_at_home()) {
+			if (pnp_axis_has_home(ax) && task->check_home &&
+			    pnp_axis_is_at_home(ax)) {
 				task->home_found = 1;
 				break;
 			}
 
-			if (task->speed_control)
-				speed = calc_speed(i, steps, speed);
+			tmp = planner_step_rate(&task->prof, i - base,
+			    steps - base);
+			if (stop < 0 || tmp < rate)
+				rate = tmp;
 
-			motor->step(motor->chanset, speed);
+			pnp_axis_step(ax, rate);
+			period = pnp_step_period(ax);
 			mdx_sem_wait(&motor->step_sem);
+			now = dwt_cycles();
+
+			/* End of the compare output pulse. */
+			if (motor->strobe) {
+				gpio_bsrr(PNP_STROBE_PORT,
+				    (1 << (PNP_STROBE_PIN + 16)));
+				motor->strobe = 0;
+			}
+
+			/* Timer clock is half the CPU clock. */
+			psc = motor->step_intr_psc + 1;
+			if (motor->step_intr_run)
+				telemetry_isr_latency(motor->axis,
+				    motor->step_intr_cnt * psc * 2);
+			if (intr)
+				telemetry_isr_jitter(motor->axis,
+				    motor->step_intr_time - intr -
+				    (motor->step_intr_arr + 1) * psc * 2);
+			intr = motor->step_intr_time;
+
+			if (capture_state == CAPTURE_STATE_ARMED &&
+			    pnp_axis_has_home(ax)) {
+				home = pnp_axis_is_at_home(ax);
+				if (home_prev != -1 && home != home_prev)
+					capture_trigger(CAPTURE_TRIG_HOME);
+				home_prev = home;
+			}
+			capture_step(motor->axis, task->direction, i,
+			    motor->step_intr_time);
+
+			/* Keep in step with pnp_isr_pos(). */
+			critical_enter();
 			if (task->direction == 1)
 				motor->steps += 1;
 			else
 				motor->steps -= 1;
+			motor->done_steps += 1;
+			task->step = i + 1 - base;
+			task->nsteps = steps - base;
+			critical_exit();
+
+			rec.planned += period;
+			if (rec.min_period == 0 || period < rec.min_period)
+				rec.min_period = period;
+			late = (now - prev) - period;
+			if ((int32_t)late > (int32_t)rec.worst_late)
+				rec.worst_late = late;
+			prev = now;
+			i += 1;
 		}
 
-		mdx_sem_post(&task->task_compl_sem);
+		rec.steps = i;
+		rec.actual = prev - start;
+		telemetry_move_record(&rec);
+
+		/* Aborted or home found, a late jog target is dropped. */
+		critical_enter();
+		task->retarget = 0;
+		task->busy = 0;
+		critical_exit();
+
+		/* Nobody waits for a jog. */
+		if (task->jog == 0)
+			mdx_sem_post(&task->task_compl_sem);
 		dprintf("%s: task compl\n", __func__);
 	}
 }
 
+#define	A(n, N, ...)							\
+static void								\
+pnp_##n##_worker_thread(void *arg)					\
+{									\
+									\
+	pnp_worker(arg, &pnp_axes[PNP_AXIS_##N]);			\
+}
+PNP_AXES(A)
+#undef	A
+
+/*
+ * Convert a position into steps, rounded to the nearest step. Targets
+ * are absolute so the rounding remainder is carried from move to move
+ * and never exceeds half a step.
+ */
 static int
-pnp_move_nonblock(struct motor_state *motor, int new_pos)
+pnp_nm_to_steps(struct motor_state *motor, int64_t nm)
 {
-	struct move_task *task;
-	uint32_t delta;
-	int new_steps;
-	int error;
-	int tmp;
+	int64_t num;
 
-	task = &motor->task;
-	task->check_home = 0;
-	task->speed_control = 1;
+	num = nm * motor->revo_steps;
+	if (num >= 0)
+		return ((num + motor->revo_nm / 2) / motor->revo_nm);
+
+	return (-((-num + motor->revo_nm / 2) / motor->revo_nm));
+}
+
+/*
+ * Constant step rate in percent of the axis maximum, used for homing.
+ */
+static void
+pnp_task_rate(struct motor_state *motor, int percent)
+{
+	struct planner_profile *prof;
+
+	prof = &motor->task.prof;
+	prof->rate_start = 0;
+	prof->rate_max = motor->ax->rate_max * percent / 100;
+	if (prof->rate_max == 0)
+		prof->rate_max = 1;
+	prof->accel = 0;
+}
+
+/*
+ * Target position of a move in steps, checked against the limits.
+ */
+static int
+pnp_target_steps(struct motor_state *motor, int64_t new_pos, int *steps)
+{
+	int64_t tmp;
+	int error;
 
 	/* Convert required position from mm to degrees if needed. */
-	if (motor->cam_translate_mm_to_deg) {
-		if (motor->cam_radius == 0)
-			return (-1);
-		error = motor->cam_translate_mm_to_deg(new_pos,
-		    motor->cam_radius, &tmp);
+	if (motor->cam_radius) {
+		error = trig_translate_z(new_pos, motor->cam_radius, &tmp);
 		if (error) {
-			printf("Error: can't translate coordinate\n");
+			log_err(LOG_PNP, "%s: can't translate coordinate\n",
+			    motor->name);
 			return (-2);
 		}
 		new_pos = tmp;
 	}
 
-	new_steps = new_pos / motor->step_nm;
-	if (new_steps > motor->steps_max ||
-	    new_steps < motor->steps_min) {
-		printf("Can't move due to limits\n");
+	*steps = pnp_nm_to_steps(motor, new_pos);
+	if (*steps > motor->steps_max || *steps < motor->steps_min) {
+		log_err(LOG_PNP, "%s: can't move due to limits\n", motor->name);
 		return (-3);
 	}
 
+	return (0);
+}
+
+static int
+pnp_move_prepare(struct motor_state *motor, int64_t new_pos)
+{
+	struct move_task *task;
+	uint32_t delta;
+	int new_steps;
+	int error;
+
+	task = &motor->task;
+	task->check_home = 0;
+	task->jog = 0;
+
+	error = pnp_target_steps(motor, new_pos, &new_steps);
+	if (error)
+		return (error);
+
 	if (new_steps > motor->steps) {
 		task->direction = 1;
 		delta = abs(new_steps - motor->steps);
@@ -437,84 +954,272 @@ pnp_move_nonblock(struct motor_state *motor, int new_pos)
 	}
 
 	task->steps = delta;
-	task->speed = 100;
-
-	mdx_sem_post(&motor->worker_sem);
 
 	return (0);
 }
 
+/*
+ * Wait for jogs still in progress.
+ */
+void
+pnp_wait(void)
+{
+	int i;
+
+	for (i = 0; i < PNP_NAXES; i++)
+		while (pnp_motors[i]->task.busy)
+			mdx_usleep(1000);
+}
+
+/*
+ * No axis has a move or a step schedule in progress.
+ */
+int
+pnp_idle(void)
+{
+	int i;
+
+	if (pnp_homing)
+		return (0);
+	for (i = 0; i < PNP_NAXES; i++)
+		if (pnp_motors[i]->task.busy || pnp_motors[i]->sched.active)
+			return (0);
+
+	return (1);
+}
+
+/*
+ * Wait for the step schedules in flight.
+ */
+static void
+pnp_sched_wait(void)
+{
+	int i;
+
+	for (i = 0; i < PNP_NAXES; i++)
+		while (pnp_motors[i]->sched.active)
+			mdx_usleep(1000);
+}
+
+/*
+ * Move the axes flagged in set[] to pos[] together, with the velocity
+ * profiles given by the planner, and wait for completion. An axis
+ * that can't move is skipped, the others still move.
+ */
+static int
+pnp_move_group(const int64_t *pos, const int *set)
+{
+	struct planner_profile prof[PNP_NAXES];
+	struct planner_feed feed;
+	struct motor_state *motor;
+	int steps[PNP_NAXES];
+	int error;
+	int err;
+	int i;
+
+	error = 0;
+
+	pnp_wait();
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		steps[i] = 0;
+		if (set[i] == 0)
+			continue;
+		motor = pnp_motors[i];
+		log_debug(LOG_PNP, "moving %s to %d\n", motor->name,
+		    (int)pos[i]);
+		err = pnp_move_prepare(motor, pos[i]);
+		if (err) {
+			error = err;
+			continue;
+		}
+		steps[i] = motor->task.steps;
+	}
+
+	planner_feed(&feed);
+	planner_plan(steps, &feed, prof);
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		if (steps[i] == 0)
+			continue;
+		motor = pnp_motors[i];
+		motor->task.prof = prof[i];
+		motor->task.feed = feed;
+		motor->task.busy = 1;
+		mdx_sem_post(&motor->worker_sem);
+	}
+	telemetry_cmd_stamp(TM_STAGE_QUEUED);
+
+	for (i = 0; i < PNP_NAXES; i++)
+		if (steps[i] != 0)
+			mdx_sem_wait(&pnp_motors[i]->task.task_compl_sem);
+
+	return (error);
+}
+
+static int
+pnp_move(struct motor_state *motor, int64_t new_pos)
+{
+	int64_t pos[PNP_NAXES];
+	int set[PNP_NAXES];
+
+	bzero(set, sizeof(set));
+	pos[motor->axis] = new_pos;
+	set[motor->axis] = 1;
+
+	return (pnp_move_group(pos, set));
+}
+
+/*
+ * Hand the targets (in steps) over to the workers without waiting. An
+ * axis still moving takes the new target and profile on its next step:
+ * it carries on from its current rate, or stops and turns around if
+ * the target is now behind it.
+ */
+static void
+pnp_jog_steps(const int *target, const int *set,
+    const struct planner_feed *feed)
+{
+	struct planner_profile prof[PNP_NAXES];
+	struct motor_state *motor;
+	struct move_task *task;
+	int steps[PNP_NAXES];
+	int busy;
+	int i;
+
+	/* A step schedule is not retargeted, let it finish. */
+	pnp_sched_wait();
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		steps[i] = 0;
+		if (set[i])
+			steps[i] = target[i] - pnp_motors[i]->steps;
+	}
+
+	planner_plan(steps, feed, prof);
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		if (set[i] == 0)
+			continue;
+		motor = pnp_motors[i];
+		task = &motor->task;
+
+		critical_enter();
+		busy = task->busy;
+		if (busy) {
+			if (steps[i] != 0)
+				task->jog_prof = prof[i];
+			else
+				task->jog_prof = task->prof;
+			task->target = target[i];
+			task->feed = *feed;
+			task->retarget = 1;
+		}
+		critical_exit();
+
+		if (busy || steps[i] == 0)
+			continue;
+
+		task->check_home = 0;
+		task->jog = 1;
+		task->target = target[i];
+		task->direction = steps[i] > 0;
+		task->steps = abs(steps[i]);
+		task->prof = prof[i];
+		task->feed = *feed;
+		task->busy = 1;
+		mdx_sem_post(&motor->worker_sem);
+	}
+}
+
 static int
-pnp_move(struct motor_state *motor, int new_pos)
+pnp_jog(const int64_t *pos, const int *set)
 {
+	struct planner_feed feed;
+	int target[PNP_NAXES];
 	int error;
+	int i;
 
-	error = pnp_move_nonblock(motor, new_pos);
-	if (error)
-		return (error);
+	for (i = 0; i < PNP_NAXES; i++) {
+		if (set[i] == 0)
+			continue;
+		error = pnp_target_steps(pnp_motors[i], pos[i], &target[i]);
+		if (error)
+			return (error);
+	}
 
-	mdx_sem_wait(&motor->task.task_compl_sem);
+	planner_feed(&feed);
+	pnp_jog_steps(target, set, &feed);
 
 	return (0);
 }
 
+/*
+ * Run the homing move set up in the task of motor and wait for it.
+ */
+static void
+pnp_home_run(struct motor_state *motor)
+{
+	struct move_task *task;
+
+	task = &motor->task;
+	task->jog = 0;
+	task->busy = 1;
+	mdx_sem_post(&motor->worker_sem);
+	mdx_sem_wait(&task->task_compl_sem);
+}
+
 static void
 pnp_move_home_motor(struct motor_state *motor)
 {
+	struct config_axis *ca;
 	struct move_task *task;
 
 	task = &motor->task;
+	ca = &config.axis[motor->axis];
 
 	/* First reach home quickly. */
-	if (motor->is_at_home() == 0) {
-		task->steps = PNP_MAX_Y_NM / motor->step_nm;
+	if (pnp_axis_is_at_home(motor->ax) == 0) {
+		task->steps = pnp_nm_to_steps(motor, PNP_MAX_Y_NM);
 		task->check_home = 1;
-		task->speed = 20;
-		task->speed_control = 0;
+		pnp_task_rate(motor, config.home_rate_fast);
 		task->direction = 0;
-		mdx_sem_post(&motor->worker_sem);
-		mdx_sem_wait(&task->task_compl_sem);
+		pnp_home_run(motor);
 	}
 
-	if (motor->is_at_home() == 0)
+	if (pnp_axis_is_at_home(motor->ax) == 0)
 		panic("we are still not at home");
 
 	/* Now move back a bit. */
 	task->direction = 1;
-	task->steps = 10000000 / motor->step_nm;
-	task->speed = 10;
-	task->speed_control = 0;
+	task->steps = pnp_nm_to_steps(motor, ca->home_backoff);
+	pnp_task_rate(motor, config.home_rate_fast / 2);
 	task->check_home = 0;
-	mdx_sem_post(&motor->worker_sem);
-	mdx_sem_wait(&task->task_compl_sem);
+	pnp_home_run(motor);
 
-	if (motor->is_at_home())
+	if (pnp_axis_is_at_home(motor->ax))
 		panic("still at home");
 
 	/* Now try to reach home slowly. */
 
-	printf("%s is trying to reach home\n", motor->name);
-	task->steps = PNP_MAX_Y_NM / motor->step_nm;
+	log_info(LOG_PNP, "%s is trying to reach home\n", motor->name);
+	task->steps = pnp_nm_to_steps(motor, PNP_MAX_Y_NM);
 	task->check_home = 1;
-	task->speed = 2;
-	task->speed_control = 0;
+	pnp_task_rate(motor, config.home_rate_slow);
 	task->direction = 0;
-	mdx_sem_post(&motor->worker_sem);
-	mdx_sem_wait(&task->task_compl_sem);
+	pnp_home_run(motor);
 
-	/* Now go into home for 1 mm. */
+	/* Now go into home a bit. */
 
-	printf("%s is going into home for 1mm\n", motor->name);
-	task->steps = 1000000 / motor->step_nm;
+	log_info(LOG_PNP, "%s is going into home\n", motor->name);
+	task->steps = pnp_nm_to_steps(motor, ca->home_into);
 	task->check_home = 0;
-	task->speed = 2;
-	task->speed_control = 0;
+	pnp_task_rate(motor, config.home_rate_slow);
 	task->direction = 0;
-	mdx_sem_post(&motor->worker_sem);
-	mdx_sem_wait(&task->task_compl_sem);
+	pnp_home_run(motor);
 
 	motor->steps = 0;
-	printf("%s home reached\n", motor->name);
+	log_info(LOG_PNP, "%s home reached\n", motor->name);
 }
 
 static int
@@ -529,15 +1234,13 @@ pnp_move_home_z(struct motor_state *motor)
 	task = &motor->task;
 
 	/* First leave home. */
-	if (pnp_is_z_home()) {
+	if (pnp_axis_is_at_home(motor->ax)) {
 		task->steps = 200;
 		task->check_home = 0;
-		task->speed = 15;
-		task->speed_control = 0;
+		pnp_task_rate(motor, 15);
 		task->home_found = 0;
 		task->direction = 1;
-		mdx_sem_post(&motor->worker_sem);
-		mdx_sem_wait(&task->task_compl_sem);
+		pnp_home_run(motor);
 		/* TODO: ensure we left it. */
 	}
 
@@ -547,15 +1250,13 @@ pnp_move_home_z(struct motor_state *motor)
 
 	/* Now find home once again. */
 	for (i = 0; i < 20; i++) {
-		printf("Making %d steps towards %d\n", steps, dir);
+		log_info(LOG_PNP, "Making %d steps towards %d\n", steps, dir);
 		task->direction = dir;
 		task->steps = steps;
 		task->check_home = 1;
-		task->speed = 15;
-		task->speed_control = 0;
+		pnp_task_rate(motor, 15);
 		task->home_found = 0;
-		mdx_sem_post(&motor->worker_sem);
-		mdx_sem_wait(&task->task_compl_sem);
+		pnp_home_run(motor);
 		if (task->home_found) {
 			found = 1;
 			break;
@@ -565,22 +1266,20 @@ pnp_move_home_z(struct motor_state *motor)
 	}
 
 	if (found == 0) {
-		printf("Error: Z Home not found\n");
+		log_err(LOG_PNP, "Z home not found\n");
 		return (-1);
 	}
 
 	/* Now make 50 steps into home. */
 	task->steps = 50;
 	task->check_home = 0;
-	task->speed = 15;
-	task->speed_control = 0;
+	pnp_task_rate(motor, 15);
 	task->home_found = 0;
 	task->direction = dir;
-	mdx_sem_post(&motor->worker_sem);
-	mdx_sem_wait(&task->task_compl_sem);
+	pnp_home_run(motor);
 
 	motor->steps = 0;
-	printf("Z home found\n");
+	log_info(LOG_PNP, "Z home found\n");
 
 	return (0);
 }
@@ -590,178 +1289,706 @@ pnp_move_home(void)
 {
 	int error;
 
+	pnp_homing = 1;
 	error = pnp_move_home_z(&pnp.motor_z);
-	if (error)
-		return (error);
-
-	pnp_move_home_motor(&pnp.motor_y);
-	pnp_move_home_motor(&pnp.motor_x);
+	if (error == 0) {
+		pnp_move_home_motor(&pnp.motor_y);
+		pnp_move_home_motor(&pnp.motor_x);
+	}
+	pnp_homing = 0;
 
-	return (0);
+	return (error);
 }
 
 void
 pnp_command_move(struct gcode_command *cmd)
 {
-	uint32_t x, y, z, h1, h2;
+	int64_t pos[PNP_NAXES];
+	int set[PNP_NAXES];
 
 	/* TODO: check for errors. */
 
-	if (cmd->x_set) {
-		x = cmd->x;
-		printf("moving X to %d\n", x);
-		pnp_move_nonblock(&pnp.motor_x, x);
+	pos[PNP_AXIS_X] = cmd->x;
+	set[PNP_AXIS_X] = cmd->x_set;
+	pos[PNP_AXIS_Y] = cmd->y;
+	set[PNP_AXIS_Y] = cmd->y_set;
+	pos[PNP_AXIS_Z] = 0;
+	set[PNP_AXIS_Z] = 0;
+	pos[PNP_AXIS_H1] = -1 * cmd->h1;
+	set[PNP_AXIS_H1] = cmd->h1_set;
+	pos[PNP_AXIS_H2] = -1 * cmd->h2;
+	set[PNP_AXIS_H2] = cmd->h2_set;
+
+	/*
+	 * A jog returns, and the command completes, once the targets are
+	 * handed over. Z still never moves together with the others: they
+	 * wait for a Z jog to end, and Z waits for them to arrive.
+	 */
+	if (pnp_jog_mode) {
+		if (cmd->x_set || cmd->y_set || cmd->h1_set || cmd->h2_set)
+			while (pnp.motor_z.task.busy)
+				mdx_usleep(1000);
+		pnp_jog(pos, set);
+		if (cmd->z_set) {
+			pnp_wait();
+			if (pnp_ctl == PNP_CTL_ABORT)
+				return;
+			pos[PNP_AXIS_Z] = cmd->z;
+			set[PNP_AXIS_Z] = 1;
+			set[PNP_AXIS_X] = set[PNP_AXIS_Y] = 0;
+			set[PNP_AXIS_H1] = set[PNP_AXIS_H2] = 0;
+			pnp_jog(pos, set);
+		}
+		return;
 	}
 
-	if (cmd->y_set) {
-		y = cmd->y;
-		printf("moving Y to %d\n", y);
-		pnp_move_nonblock(&pnp.motor_y, y);
+	pnp_move_group(pos, set);
+
+	/* Z moves once the others are in place. */
+	if (cmd->z_set && pnp_ctl != PNP_CTL_ABORT)
+		pnp_move(&pnp.motor_z, cmd->z);
+
+	telemetry_cmd_stamp(TM_STAGE_END);
+}
+
+/*
+ * M925 X Y Z I J: predicted duration of a move to the given position,
+ * us, per axis and in total (T). It is planned as the move would be,
+ * with the current feedrate, speed factor, limits and Z cam, from where
+ * the axes are headed. Z follows the other axes unless in jog mode.
+ * S1 also reports the time left of the moves in flight (R) and the
+ * cycle counter value at which they and the move would be done (E).
+ */
+void
+pnp_command_estimate(struct gcode_command *cmd)
+{
+	struct planner_profile prof[PNP_NAXES];
+	struct planner_feed feed;
+	struct motor_state *motor;
+	struct move_task *task;
+	uint32_t dur[PNP_NAXES];
+	uint32_t total;
+	uint32_t left;
+	uint32_t now;
+	uint32_t t;
+	int64_t pos[PNP_NAXES];
+	int steps[PNP_NAXES];
+	int set[PNP_NAXES];
+	int from;
+	int to;
+	int i;
+
+	pos[PNP_AXIS_X] = cmd->x;
+	set[PNP_AXIS_X] = cmd->x_set;
+	pos[PNP_AXIS_Y] = cmd->y;
+	set[PNP_AXIS_Y] = cmd->y_set;
+	pos[PNP_AXIS_Z] = cmd->z;
+	set[PNP_AXIS_Z] = cmd->z_set;
+	pos[PNP_AXIS_H1] = -1 * cmd->h1;
+	set[PNP_AXIS_H1] = cmd->h1_set;
+	pos[PNP_AXIS_H2] = -1 * cmd->h2;
+	set[PNP_AXIS_H2] = cmd->h2_set;
+
+	now = dwt_cycles();
+	left = 0;
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		motor = pnp_motors[i];
+		task = &motor->task;
+
+		t = 0;
+		critical_enter();
+		from = motor->steps;
+		if (task->busy && motor->sched.active == 0) {
+			t = planner_time_left(&task->prof, task->step,
+			    task->nsteps);
+			if (task->jog)
+				from = task->target;
+		}
+		critical_exit();
+		if (t > left)
+			left = t;
+
+		steps[i] = 0;
+		if (set[i] && pnp_target_steps(motor, pos[i], &to) == 0)
+			steps[i] = to - from;
 	}
 
-	if (cmd->h1_set) {
-		h1 = -1 * cmd->h1;
-		printf("moving H1 to %d\n", h1);
-		pnp_move_nonblock(&pnp.motor_h1, h1);
+	planner_feed(&feed);
+	planner_plan(steps, &feed, prof);
+
+	total = 0;
+	for (i = 0; i < PNP_NAXES; i++) {
+		dur[i] = planner_time_left(&prof[i], 0, abs(steps[i]));
+		if (i != PNP_AXIS_Z && dur[i] > total)
+			total = dur[i];
 	}
+	total += dur[PNP_AXIS_Z];
+
+	gcode_out_lock();
+	printf("ok T:%u X:%u Y:%u Z:%u I:%u J:%u", total, dur[PNP_AXIS_X],
+	    dur[PNP_AXIS_Y], dur[PNP_AXIS_Z], dur[PNP_AXIS_H1],
+	    dur[PNP_AXIS_H2]);
+	if (cmd->s_set && cmd->s)
+		printf(" R:%u E:%08x", left,
+		    now + (left + total) * DWT_CYCLES_PER_US);
+	printf("\n");
+	gcode_out_unlock();
+}
+
+static int
+pnp_thread_create(const char *name, void (*entry)(void *), void *arg)
+{
+	struct thread *td;
+	int error;
+
+	td = arena_alloc(sizeof(struct thread));
+	td->td_stack = arena_alloc_stack(name, PNP_THREAD_STACK_SIZE);
+	td->td_stack_size = PNP_THREAD_STACK_SIZE;
 
-	if (cmd->h2_set) {
-		h2 = -1 * cmd->h2;
-		printf("moving H2 to %d\n", h2);
-		/* TODO: check for errors. */
-		pnp_move_nonblock(&pnp.motor_h2, h2);
+	error = mdx_thread_setup(td, name, 1 /* prio */, 500 /* quantum */,
+	    entry, arg);
+	if (error) {
+		printf("%s: Failed to create %s thread\n", __func__, name);
+		return (-1);
 	}
 
-	if (cmd->h1_set)
-		mdx_sem_wait(&pnp.motor_h1.task.task_compl_sem);
-	if (cmd->h2_set)
-		mdx_sem_wait(&pnp.motor_h2.task.task_compl_sem);
-	if (cmd->x_set)
-		mdx_sem_wait(&pnp.motor_x.task.task_compl_sem);
-	if (cmd->y_set)
-		mdx_sem_wait(&pnp.motor_y.task.task_compl_sem);
+	mdx_sched_add(td);
+
+	return (0);
+}
+
+/*
+ * M922 X Y I J: shift the target of the move in progress by a small
+ * delta (mm, degrees), e.g. a bottom vision offset. A jog still in
+ * flight absorbs it into the rest of its profile without stopping;
+ * otherwise the axes move by the delta from where they are.
+ */
+void
+pnp_command_correct(struct gcode_command *cmd)
+{
+	struct planner_feed feed;
+	struct motor_state *motor;
+	int64_t delta[PNP_NAXES];
+	int target[PNP_NAXES];
+	int set[PNP_NAXES];
+	int i;
 
-	if (cmd->z_set) {
-		z = cmd->z;
-		printf("moving Z to %d\n", z);
-		pnp_move(&pnp.motor_z, z);
+	delta[PNP_AXIS_X] = cmd->x;
+	set[PNP_AXIS_X] = cmd->x_set;
+	delta[PNP_AXIS_Y] = cmd->y;
+	set[PNP_AXIS_Y] = cmd->y_set;
+	delta[PNP_AXIS_Z] = 0;
+	set[PNP_AXIS_Z] = 0;	/* Not linear, see pnp_target_steps(). */
+	delta[PNP_AXIS_H1] = -1 * cmd->h1;
+	set[PNP_AXIS_H1] = cmd->h1_set;
+	delta[PNP_AXIS_H2] = -1 * cmd->h2;
+	set[PNP_AXIS_H2] = cmd->h2_set;
+
+	/* A jog in flight keeps its feed, a new move takes the modal one. */
+	planner_feed(&feed);
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		if (set[i] == 0)
+			continue;
+		motor = pnp_motors[i];
+		critical_enter();
+		if (motor->task.busy) {
+			target[i] = motor->task.target;
+			feed = motor->task.feed;
+		} else
+			target[i] = motor->steps;
+		critical_exit();
+		target[i] += pnp_nm_to_steps(motor, delta[i]);
+		if (target[i] > motor->steps_max ||
+		    target[i] < motor->steps_min) {
+			log_err(LOG_PNP, "%s: can't correct due to limits\n",
+			    motor->name);
+			return;
+		}
 	}
+
+	pnp_jog_steps(target, set, &feed);
+
+	if (pnp_jog_mode == 0)
+		pnp_wait();
 }
 
+/*
+ * Convert step counters into G-code units (nm, 10^-6 deg).
+ */
 static void
-pnp_motor_initialize(struct motor_state *motor, const char *name)
+pnp_steps_to_pos(const int *steps, int64_t *pos)
 {
+	struct motor_state *motor;
+	int i;
 
-	mdx_sem_init(&motor->worker_sem, 0);
-	mdx_sem_init(&motor->step_sem, 0);
-	motor->name = name;
+	for (i = 0; i < PNP_NAXES; i++) {
+		motor = pnp_motors[i];
+		pos[i] = steps[i] * motor->revo_nm / motor->revo_steps;
+		if (motor->cam_radius)
+			trig_untranslate_z(pos[i], motor->cam_radius, &pos[i]);
+	}
+
+	/* Nozzle rotation is inverted in pnp_command_move(). */
+	pos[PNP_AXIS_H1] = -pos[PNP_AXIS_H1];
+	pos[PNP_AXIS_H2] = -pos[PNP_AXIS_H2];
 }
 
-static int
-pnp_thread_create(const char *name, void *arg)
+/*
+ * Positions of all axes in G-code units. Step counters are updated by
+ * the workers in thread context, so copying them in a critical section
+ * gives a consistent set even in the middle of a move.
+ */
+void
+pnp_status(int64_t *pos)
 {
-	struct thread *td;
+	int steps[PNP_NAXES];
+	int i;
 
-	td = mdx_thread_create(name, 1 /* prio */, 500 /* quantum */,
-	    8192 /* stack */, pnp_worker_thread, arg);
-	if (td == NULL) {
-		printf("%s: Failed to create X mover thread\n", __func__);
-		return (-1);
+	critical_enter();
+	for (i = 0; i < PNP_NAXES; i++)
+		steps[i] = pnp_motors[i]->steps;
+	critical_exit();
+
+	pnp_steps_to_pos(steps, pos);
+}
+
+/*
+ * M923 X or Y: arm the position compare on one axis, mm. S0 disarms.
+ * M924: report the position of all axes latched by the last compare
+ * and the latency of the strobe edge.
+ */
+void
+pnp_command_compare(struct gcode_command *cmd)
+{
+	struct pnp_compare *cmp;
+	int64_t pos[PNP_NAXES];
+	int steps[PNP_NAXES];
+	uint32_t count;
+	int target;
+	int axis;
+	int i;
+
+	cmp = &pnp_cmp;
+
+	if (cmd->code == 924) {
+		critical_enter();
+		count = cmp->count;
+		for (i = 0; i < PNP_NAXES; i++)
+			steps[i] = cmp->pos[i];
+		critical_exit();
+
+		pnp_steps_to_pos(steps, pos);
+		gcode_out_lock();
+		printf("ok C:%u", count);
+		gcode_print_fixed('X', pos[PNP_AXIS_X]);
+		gcode_print_fixed('Y', pos[PNP_AXIS_Y]);
+		gcode_print_fixed('Z', pos[PNP_AXIS_Z]);
+		gcode_print_fixed('I', pos[PNP_AXIS_H1]);
+		gcode_print_fixed('J', pos[PNP_AXIS_H2]);
+		printf(" L:%u m:%u M:%u\n", cmp->latency, cmp->lat_min,
+		    cmp->lat_max);
+		gcode_out_unlock();
+		return;
 	}
 
-	mdx_sched_add(td);
+	if (cmd->s_set && cmd->s == 0) {
+		cmp->armed = 0;
+		return;
+	}
 
-	return (0);
+	if (cmd->x_set) {
+		axis = PNP_AXIS_X;
+		pos[axis] = cmd->x;
+	} else if (cmd->y_set) {
+		axis = PNP_AXIS_Y;
+		pos[axis] = cmd->y;
+	} else
+		return;
+
+	if (pnp_target_steps(pnp_motors[axis], pos[axis], &target))
+		return;
+
+	cmp->armed = 0;
+	cmp->axis = axis;
+	cmp->target = target;
+	cmp->armed = 1;
 }
 
-static int
-pnp_initialize(void)
+/*
+ * M921 S1 makes G0 a jog: the command completes once the targets are
+ * handed over, before the axes arrive, and a G0 received meanwhile
+ * replaces them. Z is still sequenced after the others. M921 S0 waits
+ * for the jog to finish and goes back to normal moves.
+ */
+void
+pnp_command_jog_mode(struct gcode_command *cmd)
 {
-	int error;
 
-	bzero(&pnp, sizeof(struct pnp_state));
+	if (cmd->s_set == 0) {
+		gcode_out_lock();
+		printf("ok S:%d\n", pnp_jog_mode);
+		gcode_out_unlock();
+		return;
+	}
 
-	pnp_motor_initialize(&pnp.motor_x, "X Motor");
-	pnp.motor_x.step_nm = PNP_XY_STEP_NM;
-	pnp.motor_x.set_direction = pnp_xset_direction;
-	pnp.motor_x.step = xstep;
-	pnp.motor_x.chanset = (1 << 0);
-	pnp.motor_x.is_at_home = pnp_is_x_home;
-	pnp.motor_x.steps_min = PNP_STEPS_X_MIN;
-	pnp.motor_x.steps_max = PNP_STEPS_X_MAX;
-	mdx_sem_init(&pnp.motor_x.task.task_compl_sem, 0);
-
-	pnp_motor_initialize(&pnp.motor_y, "Y Motor");
-	pnp.motor_y.step_nm = PNP_XY_STEP_NM;
-	pnp.motor_y.set_direction = pnp_yset_direction;
-	pnp.motor_y.step = ystep;
-	pnp.motor_y.chanset = ((1 << 0) | (1 << 1));
-	pnp.motor_y.is_at_home = pnp_is_yl_home;
-	pnp.motor_y.steps_min = PNP_STEPS_Y_MIN;
-	pnp.motor_y.steps_max = PNP_STEPS_Y_MAX;
-	mdx_sem_init(&pnp.motor_y.task.task_compl_sem, 0);
-
-	pnp_motor_initialize(&pnp.motor_z, "Z Motor");
-	pnp.motor_z.step_nm = PNP_Z_STEP_DEG;
-	pnp.motor_z.set_direction = pnp_zset_direction;
-	pnp.motor_z.step = zstep;
-	pnp.motor_z.chanset = (1 << 0);
-	pnp.motor_z.is_at_home = pnp_is_z_home;
-	pnp.motor_z.cam_translate_mm_to_deg = trig_translate_z;
-	pnp.motor_z.cam_radius = CAM_RADIUS;
-	pnp.motor_z.steps_min = PNP_STEPS_Z_MIN;
-	pnp.motor_z.steps_max = PNP_STEPS_Z_MAX;
-	mdx_sem_init(&pnp.motor_z.task.task_compl_sem, 0);
-
-	pnp_motor_initialize(&pnp.motor_h1, "H1 Motor");
-	pnp.motor_h1.step_nm = PNP_NR_STEP_DEG;
-	pnp.motor_h1.set_direction = pnp_h1set_direction;
-	pnp.motor_h1.step = h1step;
-	pnp.motor_h1.chanset = (1 << 0);
-	pnp.motor_h1.is_at_home = NULL;
-	pnp.motor_h1.steps_min = PNP_STEPS_H_MIN;
-	pnp.motor_h1.steps_max = PNP_STEPS_H_MAX;
-	mdx_sem_init(&pnp.motor_h1.task.task_compl_sem, 0);
-
-	pnp_motor_initialize(&pnp.motor_h2, "H2 Motor");
-	pnp.motor_h2.step_nm = PNP_NR_STEP_DEG;
-	pnp.motor_h2.set_direction = pnp_h2set_direction;
-	pnp.motor_h2.step = h2step;
-	pnp.motor_h2.chanset = (1 << 0);
-	pnp.motor_h2.is_at_home = NULL;
-	pnp.motor_h2.steps_min = PNP_STEPS_H_MIN;
-	pnp.motor_h2.steps_max = PNP_STEPS_H_MAX;
-	mdx_sem_init(&pnp.motor_h2.task.task_compl_sem, 0);
-
-	error = pnp_thread_create("X Motor", &pnp.motor_x);
-	if (error) {
-		printf("%s: Failed to create X mover thread\n", __func__);
-		return (-1);
+	if (cmd->s == 0)
+		pnp_wait();
+	pnp_jog_mode = cmd->s ? 1 : 0;
+}
+
+/*
+ * Feed hold, resume and abort, called from the UART interrupt.
+ */
+void
+pnp_feed_hold(void)
+{
+
+	if (pnp_ctl == PNP_CTL_RUN)
+		pnp_ctl = PNP_CTL_HOLD;
+}
+
+void
+pnp_feed_resume(void)
+{
+
+	if (pnp_ctl == PNP_CTL_HOLD)
+		pnp_ctl = PNP_CTL_RUN;
+}
+
+void
+pnp_feed_abort(void)
+{
+	struct pnp_sched *sched;
+	int i;
+
+	pnp_ctl = PNP_CTL_ABORT;
+
+	/* Schedules end with the step in progress. */
+	for (i = 0; i < PNP_NAXES; i++) {
+		sched = &pnp_motors[i]->sched;
+		critical_enter();
+		sched->tail = sched->head;
+		sched->left = 0;
+		critical_exit();
 	}
+}
 
-	error = pnp_thread_create("Y Motor", &pnp.motor_y);
-	if (error) {
-		printf("%s: Failed to create Y mover thread\n", __func__);
+int
+pnp_feed_state(void)
+{
+
+	return (pnp_ctl);
+}
+
+/*
+ * Set the time the next step schedule of an idle axis counts from,
+ * CYCCNT.
+ */
+int
+pnp_sched_start(int axis, uint32_t clock)
+{
+	struct motor_state *motor;
+
+	if (axis < 0 || axis >= PNP_NAXES)
 		return (-1);
-	}
 
-	error = pnp_thread_create("Z Motor", &pnp.motor_z);
-	if (error) {
-		printf("%s: Failed to create Z mover thread\n", __func__);
+	motor = pnp_motors[axis];
+	if (motor->task.busy)
+		return (-2);
+
+	motor->sched.clock = clock;
+
+	return (0);
+}
+
+/*
+ * Append a segment to the step schedule of an axis and start it if the
+ * axis is idle. Fails on a move in progress, during an abort, or with
+ * the queue full; the host paces itself with pnp_sched_stat().
+ */
+int
+pnp_sched_queue(int axis, int dir, uint32_t interval, uint32_t count,
+    int add)
+{
+	struct pnp_sched_seg *seg;
+	struct motor_state *motor;
+	struct pnp_sched *sched;
+
+	if (axis < 0 || axis >= PNP_NAXES || count == 0 || count > 0xffff ||
+	    add < -32768 || add > 32767)
 		return (-1);
+
+	motor = pnp_motors[axis];
+	sched = &motor->sched;
+
+	if ((motor->task.busy && sched->active == 0) ||
+	    pnp_ctl != PNP_CTL_RUN)
+		return (-2);
+	if (sched->head - sched->tail == PNP_SCHED_NSEGS)
+		return (-3);
+
+	seg = &sched->segs[sched->head & (PNP_SCHED_NSEGS - 1)];
+	seg->interval = interval;
+	seg->count = count;
+	seg->add = add;
+	seg->dir = dir ? 1 : 0;
+
+	critical_enter();
+	sched->head += 1;
+	if (sched->active == 0) {
+		sched->active = 1;
+		sched->steps = 0;
+		sched->home_prev = -1;
+		capture_trigger(CAPTURE_TRIG_MOVE);
+		motor->task.busy = 1;
+		/* Set the direction pins of the first segment. */
+		motor->task.direction = -1;
+		pnp_sched_next(motor, &pnp_axes[axis]);
 	}
+	critical_exit();
 
-	error = pnp_thread_create("H1 Motor", &pnp.motor_h1);
-	if (error) {
-		printf("%s: Failed to create H1 mover thread\n", __func__);
-		return (-1);
+	return (0);
+}
+
+void
+pnp_sched_stat(int axis, struct pnp_sched_stat *st)
+{
+	struct motor_state *motor;
+	struct pnp_sched *sched;
+
+	motor = pnp_motors[axis];
+	sched = &motor->sched;
+
+	critical_enter();
+	st->free = PNP_SCHED_NSEGS - (sched->head - sched->tail);
+	st->active = sched->active;
+	st->steps = motor->steps;
+	st->late = sched->late;
+	st->stopped = sched->stopped;
+	critical_exit();
+}
+
+/*
+ * Called by the command loop once the aborted move has returned and the
+ * queue is flushed, the following moves run normally.
+ */
+void
+pnp_feed_clear(void)
+{
+
+	pnp_ctl = PNP_CTL_RUN;
+}
+
+/*
+ * Tuning defaults, used until a configuration record is saved.
+ */
+void
+pnp_config_defaults(void)
+{
+	const struct pnp_axis *ax;
+	struct config_axis *ca;
+	int i;
+
+	bzero(&config, sizeof(struct config));
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		ax = &pnp_axes[i];
+		ca = &config.axis[i];
+		ca->revo_nm = ax->revo_nm;
+		ca->revo_steps = ax->revo_steps;
+		ca->steps_min = ax->steps_min;
+		ca->steps_max = ax->steps_max;
+		ca->cam_radius = ax->cam_radius;
+		ca->home_backoff = PNP_HOME_BACKOFF_NM;
+		ca->home_into = PNP_HOME_INTO_NM;
+		planner_init(i, ax->rate_max, ax->vector);
 	}
 
-	error = pnp_thread_create("H2 Motor", &pnp.motor_h2);
-	if (error) {
-		printf("%s: Failed to create H2 mover thread\n", __func__);
-		return (-1);
+	config.home_rate_fast = PNP_HOME_RATE_FAST;
+	config.home_rate_slow = PNP_HOME_RATE_SLOW;
+}
+
+/*
+ * Take the step ratio, limits and cam radius from config. Positions
+ * in steps are kept, so re-home after changing the step ratio.
+ */
+void
+pnp_config_apply(void)
+{
+	struct motor_state *motor;
+	struct config_axis *ca;
+	int i;
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		motor = pnp_motors[i];
+		ca = &config.axis[i];
+		motor->revo_nm = ca->revo_nm;
+		motor->revo_steps = ca->revo_steps;
+		motor->steps_min = ca->steps_min;
+		motor->steps_max = ca->steps_max;
+		motor->cam_radius = ca->cam_radius;
+	}
+}
+
+/*
+ * M92 X Y Z I J	steps per mm or degree, rounded to whole steps per
+ *			revolution
+ * M208 X Y Z I J	travel maximum, or minimum with S1
+ * M919 Z		cam radius, mm
+ * M920 X Y		home back-off, or final move into home with S1, mm
+ * M210 S L		fast and slow homing rates, percent
+ *
+ * Refused while the axes move, and nothing is changed unless all of the
+ * result passes the same checks as a stored record.
+ */
+void
+pnp_command_config(struct gcode_command *cmd)
+{
+	struct config_axis *ca;
+	struct config c;
+	int64_t val[PNP_NAXES];
+	int set[PNP_NAXES];
+	int64_t min, max;
+	int64_t v;
+	int error;
+	int i;
+
+	/* The motors take the new ratios and limits at once. */
+	if (!pnp_idle() || job_running()) {
+		gcode_out_lock();
+		printf("ERR: moving\n");
+		gcode_out_unlock();
+		return;
+	}
+
+	c = config;
+	error = 0;
+
+	if (cmd->code == 210) {
+		if (cmd->s_set)
+			c.home_rate_fast = cmd->s;
+		if (cmd->l_set)
+			c.home_rate_slow = cmd->l;
+		goto done;
+	}
+
+	val[PNP_AXIS_X] = cmd->x;
+	set[PNP_AXIS_X] = cmd->x_set;
+	val[PNP_AXIS_Y] = cmd->y;
+	set[PNP_AXIS_Y] = cmd->y_set;
+	val[PNP_AXIS_Z] = cmd->z;
+	set[PNP_AXIS_Z] = cmd->z_set;
+	val[PNP_AXIS_H1] = cmd->h1;
+	set[PNP_AXIS_H1] = cmd->h1_set;
+	val[PNP_AXIS_H2] = cmd->h2;
+	set[PNP_AXIS_H2] = cmd->h2_set;
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		if (set[i] == 0)
+			continue;
+		ca = &c.axis[i];
+		v = val[i];
+		switch (cmd->code) {
+		case 92:
+			v = (v * ca->revo_nm / GCODE_FIXED_ONE +
+			    GCODE_FIXED_ONE / 2) / GCODE_FIXED_ONE;
+			if (v <= 0 || v > INT32_MAX) {
+				error = 1;
+				break;
+			}
+			/* The travel limits stay where they are in mm. */
+			min = (int64_t)ca->steps_min * v / ca->revo_steps;
+			max = (int64_t)ca->steps_max * v / ca->revo_steps;
+			if (min < INT32_MIN || max > INT32_MAX) {
+				error = 1;
+				break;
+			}
+			ca->steps_min = min;
+			ca->steps_max = max;
+			ca->revo_steps = v;
+			break;
+		case 208:
+			v = v * ca->revo_steps / ca->revo_nm;
+			if (v < INT32_MIN || v > INT32_MAX) {
+				error = 1;
+				break;
+			}
+			if (cmd->s_set && cmd->s == 1)
+				ca->steps_min = v;
+			else
+				ca->steps_max = v;
+			break;
+		case 919:
+			if (ca->cam_radius == 0)
+				break;
+			ca->cam_radius = v;
+			if (v <= 0)
+				error = 1;
+			break;
+		case 920:
+			if (cmd->s_set && cmd->s == 1)
+				ca->home_into = v;
+			else
+				ca->home_backoff = v;
+			break;
+		}
+	}
+
+done:
+	if (error || config_check(&c)) {
+		gcode_out_lock();
+		printf("ERR: out of range\n");
+		gcode_out_unlock();
+		return;
+	}
+
+	config = c;
+	pnp_config_apply();
+}
+
+static int
+pnp_motor_initialize(struct motor_state *motor, int axis,
+    void (*worker)(void *))
+{
+	const struct pnp_axis *ax;
+
+	ax = &pnp_axes[axis];
+
+	mdx_sem_init(&motor->worker_sem, 0);
+	mdx_sem_init(&motor->step_sem, 0);
+	mdx_sem_init(&motor->task.task_compl_sem, 0);
+	motor->axis = axis;
+	motor->ax = ax;
+	motor->name = ax->name;
+
+	return (pnp_thread_create(ax->name, worker, motor));
+}
+
+static int
+pnp_initialize(void)
+{
+	int error;
+
+	bzero(&pnp, sizeof(struct pnp_state));
+	bzero(&pnp_cmp, sizeof(struct pnp_compare));
+
+	pnp_config_defaults();
+	config_load();
+
+#define	A(n, N, ...)							\
+	error = pnp_motor_initialize(&pnp.motor_##n, PNP_AXIS_##N,	\
+	    pnp_##n##_worker_thread);					\
+	if (error) {							\
+		printf("%s: Failed to create " #N " mover thread\n",	\
+		    __func__);						\
+		return (-1);						\
 	}
+	PNP_AXES(A)
+#undef	A
+
+	pnp_config_apply();
 
 	pnp_xenable(1);
 	pnp_yenable(1);
@@ -806,12 +2033,15 @@ pnp_test_heads(void)
 static int
 pnp_move_xy(uint32_t new_pos_x, uint32_t new_pos_y)
 {
+	int64_t pos[PNP_NAXES];
+	int set[PNP_NAXES];
 
-	pnp_move_nonblock(&pnp.motor_x, new_pos_x);
-	pnp_move_nonblock(&pnp.motor_y, new_pos_y);
-
-	mdx_sem_wait(&pnp.motor_x.task.task_compl_sem);
-	mdx_sem_wait(&pnp.motor_y.task.task_compl_sem);
+	bzero(set, sizeof(set));
+	pos[PNP_AXIS_X] = new_pos_x;
+	set[PNP_AXIS_X] = 1;
+	pos[PNP_AXIS_Y] = new_pos_y;
+	set[PNP_AXIS_Y] = 1;
+	pnp_move_group(pos, set);
 
 	dprintf("%s: new pos %d %d\n", __func__, pnp.motor_x.pos,
 	    pnp.motor_y.pos);
@@ -860,12 +2090,95 @@ pnp_test_z(void)
 	return (0);
 }
 
+static volatile int pnp_bench_sink;
+
+static void
+pnp_bench_isr(int i)
+{
+
+	pnp_pwm_x_intr(&pwm_x_sc, 25);
+}
+
+static void
+pnp_bench_nm_to_steps(int i)
+{
+
+	pnp_bench_sink = pnp_nm_to_steps(&pnp.motor_x,
+	    (int64_t)i * 3604567);
+}
+
+static void
+pnp_bench_pin_set(int i)
+{
+
+	pin_set(&gpio_sc, PORT_E, 5, i & 1); /* X FR */
+}
+
+static void
+pnp_bench_pin_get(int i)
+{
+
+	pnp_bench_sink = pin_get(&gpio_sc, PORT_C, 6);
+}
+
+static void
+pnp_bench_set_direction(int i)
+{
+
+	pnp_axis_set_direction(&pnp_axes[PNP_AXIS_X], i & 1);
+}
+
+static void
+pnp_bench_is_at_home(int i)
+{
+
+	pnp_bench_sink = pnp_axis_is_at_home(&pnp_axes[PNP_AXIS_X]);
+}
+
+/*
+ * Step ISR, position conversion and the GPIO routines of the workers
+ * against pin_set()/pin_get(). Call with the axes idle: the step
+ * semaphore, counters and direction of X are restored afterwards.
+ */
+void
+pnp_bench(void)
+{
+	struct motor_state *motor;
+
+	motor = &pnp.motor_x;
+
+	bench_measure("pnp_pwm_x_intr", pnp_bench_isr);
+	critical_enter();
+	mdx_sem_init(&motor->step_sem, 0);
+	motor->isr_steps = motor->done_steps;
+	critical_exit();
+
+	bench_measure("pnp_nm_to_steps", pnp_bench_nm_to_steps);
+	bench_measure("pin_set", pnp_bench_pin_set);
+	bench_measure("pin_get", pnp_bench_pin_get);
+	bench_measure("pnp_axis_set_direction", pnp_bench_set_direction);
+	bench_measure("pnp_axis_is_at_home", pnp_bench_is_at_home);
+
+	pnp_axis_set_direction(&pnp_axes[PNP_AXIS_X], motor->task.direction);
+}
+
 int
 pnp_main(void)
 {
 	int error;
 
 	pnp_initialize();
+	gcode_initialize();
+	job_initialize();
+
+	/* All runtime objects are allocated. */
+	arena_seal();
+
+	if (BENCH_AT_BOOT) {
+		bench_run();
+		return (0);
+	}
+
 	pnp_test_heads();
 	if (1 == 0)
 		pnp_test_z();
@@ -877,7 +2190,7 @@ pnp_main(void)
 	/* Change location of 0,0. */
 	pnp_move_xy(0, PNP_MAX_Y_NM);
 	pnp.motor_y.steps = 0;
-	pnp.motor_y.set_direction = pnp_yset_direction_rev;
+	pnp.motor_y.dir_invert = 1;
 
 	if (1 == 0)
 		pnp_move_random();
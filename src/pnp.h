@@ -27,6 +27,26 @@
 #ifndef _SRC_PNP_H_
 #define	_SRC_PNP_H_
 
+#define	PNP_AXIS_X	0
+#define	PNP_AXIS_Y	1
+#define	PNP_AXIS_Z	2
+#define	PNP_AXIS_H1	3
+#define	PNP_AXIS_H2	4
+#define	PNP_NAXES	5
+
+/* Feed control state. */
+#define	PNP_CTL_RUN	0
+#define	PNP_CTL_HOLD	1
+#define	PNP_CTL_ABORT	2
+
+struct pnp_sched_stat {
+	uint32_t free;		/* Free segments in the queue. */
+	int active;
+	int steps;		/* Position. */
+	uint32_t late;
+	uint32_t stopped;
+};
+
 void pnp_pwm_x_intr(void *arg, int irq);
 void pnp_pwm_y_intr(void *arg, int irq);
 void pnp_pwm_z_intr(void *arg, int irq);
@@ -34,7 +54,27 @@ void pnp_pwm_h1_intr(void *arg, int irq);
 void pnp_pwm_h2_intr(void *arg, int irq);
 
 int pnp_main(void);
+void pnp_bench(void);
 void pnp_command_move(struct gcode_command *cmd);
+void pnp_command_jog_mode(struct gcode_command *cmd);
+void pnp_command_correct(struct gcode_command *cmd);
+void pnp_command_compare(struct gcode_command *cmd);
+void pnp_command_estimate(struct gcode_command *cmd);
+void pnp_wait(void);
+int pnp_idle(void);
 void pnp_henable(int enable);
+void pnp_status(int64_t *pos);
+void pnp_feed_hold(void);
+void pnp_feed_resume(void);
+void pnp_feed_abort(void);
+int pnp_feed_state(void);
+void pnp_feed_clear(void);
+int pnp_sched_start(int axis, uint32_t clock);
+int pnp_sched_queue(int axis, int dir, uint32_t interval, uint32_t count,
+    int add);
+void pnp_sched_stat(int axis, struct pnp_sched_stat *st);
+void pnp_config_defaults(void);
+void pnp_config_apply(void);
+void pnp_command_config(struct gcode_command *cmd);
 
 #endif /* !_SRC_PNP_H_ */
@@ -0,0 +1,455 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/systm.h>
+
+#include "arena.h"
+#include "dwt.h"
+#include "gcode.h"
+#include "pnp.h"
+#include "telemetry.h"
+
+struct tm_axis_stats {
+	uint32_t count;
+	uint64_t steps;
+	uint64_t planned;
+	uint64_t actual;
+	uint32_t worst_late;
+	uint32_t worst_overrun;	/* actual - planned, cycles. */
+};
+
+struct tm_isr_stats {
+	struct tm_hist latency;	/* Update event to ISR entry. */
+	struct tm_hist jitter;	/* |ISR interval - step period|. */
+};
+
+/*
+ * Log-linear histogram of microseconds with 4 sub-buckets per power
+ * of 2, good enough for a percentile within 25%.
+ */
+#define	TM_LHIST_NBUCKETS	100
+#define	TM_LHIST_MAX_US		((1 << 26) - 1)
+
+struct tm_lhist {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint16_t bucket[TM_LHIST_NBUCKETS];
+};
+
+#define	TM_NCMDS		8
+
+struct tm_cmd_stats {
+	char letter;
+	int code;
+	struct tm_lhist stage[TM_NSTAGES];	/* [RX]: total. */
+};
+
+static struct tm_move tm_ring[TELEMETRY_NRECORDS] __ccm;
+static struct tm_axis_stats tm_stats[PNP_NAXES] __ccm;
+static struct tm_isr_stats tm_isr[PNP_NAXES] __ccm;
+static uint32_t tm_seq;
+static struct tm_cmd_stats tm_cmds[TM_NCMDS] __ccm;
+static uint32_t tm_cmd_ts[TM_NSTAGES] __ccm;
+static uint32_t tm_cmd_dropped;		/* Commands of no room. */
+static int tm_cmd_active;		/* Between begin and end. */
+
+static const char *tm_axis_names[PNP_NAXES] = {
+	[PNP_AXIS_X] = "X",
+	[PNP_AXIS_Y] = "Y",
+	[PNP_AXIS_Z] = "Z",
+	[PNP_AXIS_H1] = "H1",
+	[PNP_AXIS_H2] = "H2",
+};
+
+/*
+ * Called by motor worker threads once a task is completed.
+ */
+void
+telemetry_move_record(struct tm_move *rec)
+{
+	struct tm_axis_stats *st;
+	uint32_t overrun;
+
+	critical_enter();
+	rec->seq = tm_seq++;
+	tm_ring[rec->seq & (TELEMETRY_NRECORDS - 1)] = *rec;
+
+	st = &tm_stats[rec->axis];
+	st->count += 1;
+	st->steps += rec->steps;
+	st->planned += rec->planned;
+	st->actual += rec->actual;
+	if (rec->worst_late > st->worst_late)
+		st->worst_late = rec->worst_late;
+	if (rec->actual > rec->planned) {
+		overrun = rec->actual - rec->planned;
+		if (overrun > st->worst_overrun)
+			st->worst_overrun = overrun;
+	}
+	critical_exit();
+}
+
+/*
+ * Called by motor worker threads after each step, with the timing of
+ * the step interrupt in cycles. Each axis has a single writer.
+ */
+void
+telemetry_isr_latency(int axis, int32_t latency)
+{
+
+	if (latency < 0)
+		latency = 0;
+	tm_hist_add(&tm_isr[axis].latency, latency);
+}
+
+void
+telemetry_isr_jitter(int axis, int32_t interval_err)
+{
+
+	if (interval_err < 0)
+		interval_err = -interval_err;
+	tm_hist_add(&tm_isr[axis].jitter, interval_err);
+}
+
+/*
+ * Print records, oldest first, one per line:
+ * seq, axis, steps, planned us, actual us, peak step rate Hz, worst late us.
+ */
+void
+telemetry_dump(void)
+{
+	struct tm_move rec;
+	uint32_t first;
+	uint32_t last;
+	uint32_t rate;
+	uint32_t i;
+
+	critical_enter();
+	last = tm_seq;
+	critical_exit();
+
+	first = 0;
+	if (last > TELEMETRY_NRECORDS)
+		first = last - TELEMETRY_NRECORDS;
+
+	for (i = first; i < last; i++) {
+		critical_enter();
+		rec = tm_ring[i & (TELEMETRY_NRECORDS - 1)];
+		critical_exit();
+
+		/* Overwritten while we were printing. */
+		if (rec.seq != i)
+			continue;
+
+		rate = 0;
+		if (rec.min_period)
+			rate = DWT_CPU_FREQ / rec.min_period;
+
+		gcode_out_lock();
+		printf("ok T:%u A:%s%c N:%u P:%u D:%u R:%u L:%u\n", rec.seq,
+		    tm_axis_names[rec.axis], rec.direction ? '+' : '-',
+		    rec.steps, dwt_cycles_to_us(rec.planned),
+		    dwt_cycles_to_us(rec.actual), rate,
+		    dwt_cycles_to_us(rec.worst_late));
+		gcode_out_unlock();
+	}
+}
+
+/*
+ * Per-axis aggregates: number of segments, steps, total planned and
+ * actual time in ms, actual/planned ratio in percent, worst segment
+ * overrun and worst late step in us.
+ */
+void
+telemetry_stats(void)
+{
+	struct tm_axis_stats st;
+	uint32_t ratio;
+	int i;
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		critical_enter();
+		st = tm_stats[i];
+		critical_exit();
+
+		ratio = 0;
+		if (st.planned)
+			ratio = (st.actual * 100) / st.planned;
+
+		gcode_out_lock();
+		printf("ok A:%s C:%u N:%u P:%u D:%u E:%u%% O:%u L:%u\n",
+		    tm_axis_names[i], st.count, (uint32_t)st.steps,
+		    (uint32_t)(st.planned / (DWT_CYCLES_PER_US * 1000)),
+		    (uint32_t)(st.actual / (DWT_CYCLES_PER_US * 1000)),
+		    ratio, dwt_cycles_to_us(st.worst_overrun),
+		    dwt_cycles_to_us(st.worst_late));
+		gcode_out_unlock();
+	}
+}
+
+static void
+telemetry_hist_print(const char *axis, char type, struct tm_hist *h)
+{
+	int last;
+	int i;
+
+	for (last = 32; last > 0; last--)
+		if (h->bucket[last])
+			break;
+
+	gcode_out_lock();
+	printf("ok A:%s H:%c C:%u M:%u B:", axis, type, h->count,
+	    h->max);
+	for (i = 0; i <= last; i++)
+		printf(i ? ",%u" : "%u", h->bucket[i]);
+	printf("\n");
+	gcode_out_unlock();
+}
+
+/*
+ * Step interrupt histograms, in cycles. Latency (H:L) is from the
+ * timer update event to the ISR entry, read from the timer counter,
+ * jitter (H:J) is the deviation of the interval between two ISRs from
+ * the period programmed into the timer.
+ * Bucket n of B: counts values in [2^(n-1), 2^n) cycles.
+ */
+void
+telemetry_isr_dump(void)
+{
+	struct tm_isr_stats st;
+	int i;
+
+	for (i = 0; i < PNP_NAXES; i++) {
+		critical_enter();
+		st = tm_isr[i];
+		critical_exit();
+
+		telemetry_hist_print(tm_axis_names[i], 'L', &st.latency);
+		telemetry_hist_print(tm_axis_names[i], 'J', &st.jitter);
+	}
+}
+
+static int
+tm_lhist_index(uint32_t val)
+{
+	int o;
+
+	if (val < 4)
+		return (val);
+	if (val > TM_LHIST_MAX_US)
+		val = TM_LHIST_MAX_US;
+
+	o = 31 - __builtin_clz(val);
+
+	return (4 + (o - 2) * 4 + ((val >> (o - 2)) & 3));
+}
+
+/* Upper bound of the bucket. */
+static uint32_t
+tm_lhist_value(int idx)
+{
+	int sub;
+	int o;
+
+	if (idx < 4)
+		return (idx);
+
+	o = (idx - 4) / 4 + 2;
+	sub = (idx - 4) % 4;
+
+	return (((4 + sub) << (o - 2)) + (1 << (o - 2)) - 1);
+}
+
+static void
+tm_lhist_add(struct tm_lhist *h, uint32_t val)
+{
+	int idx;
+
+	idx = tm_lhist_index(val);
+	if (h->bucket[idx] != 0xffff)
+		h->bucket[idx] += 1;
+	if (h->count == 0 || val < h->min)
+		h->min = val;
+	if (val > h->max)
+		h->max = val;
+	h->sum += val;
+	h->count += 1;
+}
+
+static uint32_t
+tm_lhist_percentile(struct tm_lhist *h, int pct)
+{
+	uint32_t total;
+	uint32_t cum;
+	uint32_t need;
+	int i;
+
+	total = 0;
+	for (i = 0; i < TM_LHIST_NBUCKETS; i++)
+		total += h->bucket[i];
+	if (total == 0)
+		return (0);
+
+	need = (total * pct + 99) / 100;
+	cum = 0;
+	for (i = 0; i < TM_LHIST_NBUCKETS; i++) {
+		cum += h->bucket[i];
+		if (cum >= need)
+			break;
+	}
+
+	if (tm_lhist_value(i) > h->max)
+		return (h->max);
+
+	return (tm_lhist_value(i));
+}
+
+/*
+ * Per G-code command latency breakdown. A single console command is in
+ * processing at a time, so there is one set of timestamps. Moves run
+ * by batches, macros or the job come without a begin and are not
+ * stamped.
+ */
+void
+telemetry_cmd_begin(uint32_t rx_time)
+{
+
+	bzero(tm_cmd_ts, sizeof(tm_cmd_ts));
+	tm_cmd_ts[TM_STAGE_RX] = rx_time;
+	tm_cmd_active = 1;
+}
+
+/*
+ * Record a stage timestamp. Motor stages are reported by several
+ * workers: the first queue and start, and the last end win.
+ */
+void
+telemetry_cmd_stamp(int stage)
+{
+	uint32_t now;
+
+	if (tm_cmd_active == 0)
+		return;
+
+	now = dwt_cycles();
+
+	critical_enter();
+	if (stage == TM_STAGE_END || tm_cmd_ts[stage] == 0)
+		tm_cmd_ts[stage] = now;
+	critical_exit();
+}
+
+void
+telemetry_cmd_end(char letter, int code)
+{
+	struct tm_cmd_stats *cs;
+	uint32_t prev;
+	int i;
+
+	tm_cmd_active = 0;
+
+	/* An empty line. */
+	if (letter == 0)
+		return;
+
+	cs = NULL;
+	for (i = 0; i < TM_NCMDS; i++) {
+		if (tm_cmds[i].letter == 0) {
+			tm_cmds[i].letter = letter;
+			tm_cmds[i].code = code;
+		}
+		if (tm_cmds[i].letter == letter && tm_cmds[i].code == code) {
+			cs = &tm_cmds[i];
+			break;
+		}
+	}
+
+	/* No room for a new command type. */
+	if (cs == NULL) {
+		tm_cmd_dropped += 1;
+		return;
+	}
+
+	/* Each stage accounts the time since the previous stage seen. */
+	prev = tm_cmd_ts[TM_STAGE_RX];
+	for (i = TM_STAGE_PARSED; i < TM_NSTAGES; i++) {
+		if (tm_cmd_ts[i] == 0)
+			continue;
+		tm_lhist_add(&cs->stage[i],
+		    dwt_cycles_to_us(tm_cmd_ts[i] - prev));
+		prev = tm_cmd_ts[i];
+	}
+
+	tm_lhist_add(&cs->stage[TM_STAGE_RX],
+	    dwt_cycles_to_us(prev - tm_cmd_ts[TM_STAGE_RX]));
+}
+
+/*
+ * One line per command type and stage: count, min, avg, p99 and max
+ * in us. Stage T is the total from LF reception to "COMPLETE".
+ */
+void
+telemetry_cmd_dump(void)
+{
+	static const char stage_names[TM_NSTAGES] = {
+		[TM_STAGE_RX] = 'T',
+		[TM_STAGE_PARSED] = 'P',
+		[TM_STAGE_ACK] = 'A',
+		[TM_STAGE_QUEUED] = 'Q',
+		[TM_STAGE_START] = 'S',
+		[TM_STAGE_END] = 'E',
+		[TM_STAGE_COMPLETE] = 'C',
+	};
+	struct tm_cmd_stats *cs;
+	struct tm_lhist *h;
+	int i, j;
+
+	for (i = 0; i < TM_NCMDS; i++) {
+		cs = &tm_cmds[i];
+		if (cs->letter == 0)
+			break;
+		for (j = 0; j < TM_NSTAGES; j++) {
+			h = &cs->stage[j];
+			if (h->count == 0)
+				continue;
+			gcode_out_lock();
+			printf("ok C:%c%d S:%c N:%u m:%u a:%u p:%u M:%u\n",
+			    cs->letter, cs->code, stage_names[j], h->count,
+			    h->min, (uint32_t)(h->sum / h->count),
+			    tm_lhist_percentile(h, 99), h->max);
+			gcode_out_unlock();
+		}
+	}
+
+	if (tm_cmd_dropped) {
+		gcode_out_lock();
+		printf("ok C:* N:%u\n", tm_cmd_dropped);
+		gcode_out_unlock();
+	}
+}
@@ -0,0 +1,85 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SRC_TELEMETRY_H_
+#define	_SRC_TELEMETRY_H_
+
+#define	TELEMETRY_NRECORDS	64	/* Must be a power of 2. */
+
+/* One executed segment (a single motor task). */
+struct tm_move {
+	uint32_t seq;
+	uint8_t axis;
+	uint8_t direction;
+	uint8_t check_home;
+	uint32_t steps;
+	uint32_t planned;	/* Sum of programmed step periods, cycles. */
+	uint32_t actual;	/* First step issued to last done, cycles. */
+	uint32_t min_period;	/* Shortest step period, cycles. */
+	uint32_t worst_late;	/* Worst step interval overrun, cycles. */
+};
+
+/* log2-bucketed histogram: bucket n counts values in [2^(n-1), 2^n). */
+struct tm_hist {
+	uint32_t count;
+	uint32_t max;
+	uint32_t bucket[33];
+};
+
+static inline void
+tm_hist_add(struct tm_hist *h, uint32_t val)
+{
+	int n;
+
+	n = val ? (32 - __builtin_clz(val)) : 0;
+	h->bucket[n] += 1;
+	h->count += 1;
+	if (val > h->max)
+		h->max = val;
+}
+
+/* G-code command processing stages, in order. */
+#define	TM_STAGE_RX		0	/* LF received. */
+#define	TM_STAGE_PARSED		1	/* Parsing done. */
+#define	TM_STAGE_ACK		2	/* "OK" sent. */
+#define	TM_STAGE_QUEUED		3	/* First motor task posted. */
+#define	TM_STAGE_START		4	/* First motor task started. */
+#define	TM_STAGE_END		5	/* Last motor task completed. */
+#define	TM_STAGE_COMPLETE	6	/* "COMPLETE" sent. */
+#define	TM_NSTAGES		7
+
+void telemetry_move_record(struct tm_move *rec);
+void telemetry_isr_latency(int axis, int32_t latency);
+void telemetry_isr_jitter(int axis, int32_t interval_err);
+void telemetry_dump(void);
+void telemetry_stats(void);
+void telemetry_isr_dump(void);
+void telemetry_cmd_begin(uint32_t rx_time);
+void telemetry_cmd_stamp(int stage);
+void telemetry_cmd_end(char letter, int code);
+void telemetry_cmd_dump(void);
+
+#endif /* !_SRC_TELEMETRY_H_ */
@@ -31,8 +31,7 @@
 #include <sys/sem.h>
 #include <sys/thread.h>
 
-#include <lib/msun/src/math.h>
-
+#include "log.h"
 #include "trig.h"
 
 #define	TRIG_DEBUG
@@ -44,35 +43,157 @@
 #define	dprintf(fmt, ...)
 #endif
 
-#define	M_PI	3.14159265358979323846
-#define	DEG(x)	((180 / M_PI) * (x))
-#define	RAD(x)	((M_PI / 180) * (x))
+#define	TRIG_Q		30
+#define	TRIG_ONE	((int64_t)1 << TRIG_Q)
+#define	TRIG_CORDIC_N	32
+#define	TRIG_CORDIC_K	652032874LL	/* 1 / CORDIC gain, Q30. */
+
+/* atan(2^-i) in 10^-9 degrees. */
+static const int64_t trig_atan_tbl[TRIG_CORDIC_N] = {
+	45000000000LL,
+	26565051177LL,
+	14036243468LL,
+	7125016349LL,
+	3576334375LL,
+	1789910608LL,
+	895173710LL,
+	447614171LL,
+	223810500LL,
+	111905677LL,
+	55952892LL,
+	27976453LL,
+	13988227LL,
+	6994114LL,
+	3497057LL,
+	1748528LL,
+	874264LL,
+	437132LL,
+	218566LL,
+	109283LL,
+	54642LL,
+	27321LL,
+	13660LL,
+	6830LL,
+	3415LL,
+	1708LL,
+	854LL,
+	427LL,
+	213LL,
+	107LL,
+	53LL,
+	27LL,
+};
+
+uint64_t
+trig_isqrt64(uint64_t val)
+{
+	uint64_t res;
+	uint64_t bit;
+
+	res = 0;
+	bit = (uint64_t)1 << 62;
+	while (bit > val)
+		bit >>= 2;
+
+	while (bit) {
+		if (val >= res + bit) {
+			val -= res + bit;
+			res = (res >> 1) + bit;
+		} else
+			res >>= 1;
+		bit >>= 2;
+	}
+
+	return (res);
+}
 
 /*
- * cam_radius and z are in mm.
+ * CORDIC in vectoring mode: atan2(y, x) for x >= 0, in 10^-9 degrees.
+ */
+static int64_t
+trig_atan2(int64_t y, int64_t x)
+{
+	int64_t angle;
+	int64_t xn;
+	int i;
+
+	angle = 0;
+	for (i = 0; i < TRIG_CORDIC_N; i++) {
+		if (y > 0) {
+			xn = x + (y >> i);
+			y -= (x >> i);
+			angle += trig_atan_tbl[i];
+		} else {
+			xn = x - (y >> i);
+			y += (x >> i);
+			angle -= trig_atan_tbl[i];
+		}
+		x = xn;
+	}
+
+	return (angle);
+}
+
+/*
+ * CORDIC in rotation mode: sin(angle) in Q30 for |angle| <= 90 degrees,
+ * angle in 10^-9 degrees.
+ */
+static int64_t
+trig_sin(int64_t angle)
+{
+	int64_t x, y;
+	int64_t xn;
+	int i;
+
+	x = TRIG_CORDIC_K;
+	y = 0;
+	for (i = 0; i < TRIG_CORDIC_N; i++) {
+		if (angle > 0) {
+			xn = x - (y >> i);
+			y += (x >> i);
+			angle -= trig_atan_tbl[i];
+		} else {
+			xn = x + (y >> i);
+			y -= (x >> i);
+			angle += trig_atan_tbl[i];
+		}
+		x = xn;
+	}
+
+	return (y);
+}
+
+/*
+ * cam_radius and z are in nanometers.
  * return value is motor rotation degrees multiplied by 1000000.
  *
+ * deg = 90 + asin(z / cam_radius - 1), with asin(s) computed as
+ * atan2(s, sqrt(1 - s^2)) in Q30 fixed point.
+ *
  * Note: absolute z is expected as input.
  */
 int
-trig_translate_z(float z0, float cam_radius, int *result)
+trig_translate_z(int64_t z0, int64_t cam_radius, int64_t *result)
 {
-	float val;
-	float deg;
-	float z;
+	int64_t deg;
+	int64_t s;
+	int64_t c;
+	int64_t z;
 
-	z = abs(z0);
+	z = z0 < 0 ? -z0 : z0;
 
 	if (z > cam_radius * 2) {
-		printf("%s: Can't rotate Z for more than 180 deg.\n", __func__);
+		log_err(LOG_TRIG, "%s: Can't rotate Z for more than 180 deg.\n",
+		    __func__);
 		return (-1);
 	}
 
-	val = z / cam_radius - 1;
-	deg = 90 + DEG(asin(val));
+	s = ((z - cam_radius) << TRIG_Q) / cam_radius;
+	c = trig_isqrt64(TRIG_ONE * TRIG_ONE - s * s);
+	deg = 90000000000LL + trig_atan2(s, c);
 
-	/* Convert to nano. */
-	deg *= 1000000;
+	/* Convert to 10^-6 degrees, rounded. */
+	deg = (deg + 500) / 1000;
 
 	/* Check if negative. */
 	if (z0 < 0)
@@ -80,27 +201,73 @@ trig_translate_z(float z0, float cam_radius, int *result)
 
 	*result = deg;
 
-	dprintf("%s: z %f mm, deg %d\n", __func__, z, result);
+	dprintf("%s: z %d nm, deg %d\n", __func__, (int)z, (int)deg);
+
+	return (0);
+}
+
+/*
+ * Inverse of trig_translate_z(): z = cam_radius * (1 + sin(deg - 90)).
+ */
+int
+trig_untranslate_z(int64_t deg0, int64_t cam_radius, int64_t *result)
+{
+	int64_t deg;
+	int64_t z;
+
+	deg = deg0 < 0 ? -deg0 : deg0;
+	if (deg > 180000000)
+		return (-1);
+
+	z = cam_radius + ((cam_radius * trig_sin((deg - 90000000) * 1000)) >>
+	    TRIG_Q);
+
+	*result = deg0 < 0 ? -z : z;
 
 	return (0);
 }
 
-void
+/*
+ * Compare with 90 + asin(z / 15 - 1) for z = 0..30 mm, in 10^-6 degrees.
+ */
+int
 trig_test(void)
 {
-	int cam_radius;
-	int result;
+	static const int32_t ref[] = {
+		0, 21039470, 29926435, 36869898, 42833428, 48189685, 53130102,
+		57769047, 62181861, 66421822, 70528779, 74533990, 78463041,
+		82337744, 86177446, 90000000, 93822554, 97662256, 101536959,
+		105466010, 109471221, 113578178, 117818139, 122230953,
+		126869898, 131810315, 137166572, 143130102, 150073565,
+		158960530, 180000000,
+	};
+	int64_t result;
+	int64_t err;
 	int error;
-	float j;
+	int j;
 
-	cam_radius = 15000000;
-
-	for (j = 0; j < 30; j += 1) {
-		error = trig_translate_z(j * 1000000, cam_radius, &result);
+	for (j = 0; j < sizeof(ref) / sizeof(ref[0]); j++) {
+		error = trig_translate_z(j * 1000000LL, 15000000, &result);
 		if (error) {
-			printf("%s: can't translate %f\n", __func__, j);
-			break;
+			printf("%s: can't translate %d mm\n", __func__, j);
+			return (-1);
+		}
+		err = result - ref[j];
+		if (err < -1 || err > 1) {
+			printf("%s: z %d mm, deg %d, expected %d\n", __func__,
+			    j, (int)result, ref[j]);
+			return (-1);
+		}
+		trig_untranslate_z(ref[j], 15000000, &result);
+		err = result - j * 1000000LL;
+		if (err < -100 || err > 100) {
+			printf("%s: deg %d, z %d nm, expected %d mm\n",
+			    __func__, ref[j], (int)result, j);
+			return (-1);
 		}
-		printf("%s: z %f mm, deg %d\n", __func__, j, result);
 	}
+
+	printf("%s: passed\n", __func__);
+
+	return (0);
 }
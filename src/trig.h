@@ -27,7 +27,9 @@
 #ifndef _SRC_TRIG_H_
 #define	_SRC_TRIG_H_
 
-int trig_translate_z(float z, float cam_radius, int *result);
-void trig_test(void);
+uint64_t trig_isqrt64(uint64_t val);
+int trig_translate_z(int64_t z, int64_t cam_radius, int64_t *result);
+int trig_untranslate_z(int64_t deg, int64_t cam_radius, int64_t *result);
+int trig_test(void);
 
 #endif /* !_SRC_TRIG_H_ */
@@ -0,0 +1,394 @@
+#!/usr/bin/env python3
+#-
+# Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+"""Send G-code in binary batch frames.
+
+Usage: batch.py [-m] [-n] [-p port] [-s baud] file ...
+
+G0, M800 and M400 lines are packed into BATCH frames (src/frame.h),
+which the firmware runs in order and answers with one 10-byte reply.
+A batch ends at M400, at M105, whose vacuum reading comes with the
+reply, at a comment or a blank line, and when the frame is full. Other
+lines are sent as G-code. With -n nothing is sent, the bytes on the
+wire are counted for plain G-code and for batches. -s switches the
+console to a higher rate first (M927).
+
+With -m the steps of a placement, split at M400 where the host looks
+through the camera, are stored as macros (MACRO_DEFINE) when the same
+sequence comes more than once. The coordinates that change from one
+component to the next become arguments, and each step is a MACRO_CALL
+with only those. M105 is a SENSE record then, and does not end the
+step.
+"""
+
+import argparse
+import re
+import struct
+import sys
+import time
+
+from pnpframe import (BATCH, ERRORS, MACRO_CALL, MACRO_DEFINE, MAXLEN,
+                      NAK, OVERHEAD, REPLY, Link)
+
+OP_WAIT = 0x01
+OP_SENSE = 0x02
+OP_ACTUATE = 0x20
+OP_MOVE = 0x40
+MOVE_ARGS = 0x80
+
+MACRO_N = 16				# FRAME_MACRO_N
+MACRO_ARGS = 16
+MACRO_LEN = MAXLEN - 2
+
+AXES = "XYZIJ"
+TARGETS = "PVWDO"			# M800 words, targets 1 to 5.
+
+# Replies to a G-code line and to a batch, CRLF line endings.
+GCODE_RX = len("OK\r\nCOMPLETE\r\n")
+BATCH_RX = OVERHEAD + 5
+
+
+def words(line):
+    return [(w[0], float(w[1:])) for w in line.upper().split()]
+
+
+def varint(val):
+    """Zigzag LEB128."""
+    val = (val << 1) ^ (val >> 63)
+    out = b""
+    while val >= 0x80:
+        out += bytes([val & 0x7F | 0x80])
+        val >>= 7
+    return out + bytes([val])
+
+
+def record(line):
+    """Batch record of a G-code line, or None."""
+    w = words(line)
+    if not w:
+        return None
+    cmd = w[0]
+    if cmd == ("G", 0):
+        mask = 0
+        fields = b""
+        args = dict(w[1:])
+        for i, a in enumerate(AXES):
+            if a in args:
+                mask |= 1 << i
+                fields += varint(round(args[a] * 1000))
+        if "F" in args:
+            mask |= 1 << 5
+            fields += varint(round(args["F"]))
+        return bytes([OP_MOVE | mask]) + fields
+    if cmd == ("M", 800):
+        rec = b""
+        for letter, val in w[1:]:
+            if letter in TARGETS:
+                rec += bytes([OP_ACTUATE |
+                              (TARGETS.index(letter) + 1) << 1 |
+                              (1 if val else 0)])
+        return rec or None
+    if cmd == ("M", 400):
+        return bytes([OP_WAIT])
+    return None
+
+
+def plan(path):
+    """Items: ("batch", records, reads) or ("gcode", line)."""
+    items = []
+    recs = []
+    nrecs = 0
+
+    def flush(reads=0):
+        nonlocal recs, nrecs
+        if recs:
+            items.append(("batch", recs, reads))
+        elif reads:
+            items.append(("gcode", "M105 N%d" % reads))
+        recs = []
+
+    with open(path) as f:
+        for line in f:
+            line = line.split(";")[0].strip()
+            if not line:
+                continue
+            w = words(line)
+            if w[0] == ("M", 105):
+                flush(int(dict(w[1:]).get("N", 1)))
+                continue
+            rec = record(line)
+            if rec is None:
+                flush()
+                items.append(("gcode", line))
+                continue
+            if 2 + sum(len(r) for r in recs) + len(rec) > MAXLEN:
+                flush()
+            recs.append(rec)
+            if rec == bytes([OP_WAIT]):
+                flush()
+    flush()
+
+    return items
+
+
+def steps(path):
+    """Placement steps: lists of batchable lines, or a G-code line."""
+    out = []
+    cur = []
+
+    def flush():
+        nonlocal cur
+        if cur:
+            out.append(cur)
+        cur = []
+
+    with open(path) as f:
+        for line in f:
+            line = line.split(";")[0].strip()
+            if not line:
+                flush()
+                continue
+            w = words(line)
+            if w[0] != ("M", 105) and record(line) is None:
+                flush()
+                out.append(line)
+                continue
+            cur.append(line)
+            if w[0] == ("M", 400):
+                flush()
+    flush()
+
+    return out
+
+
+def template(lines):
+    """Shape of a step and the G0 values in it, as integers."""
+    shape = []
+    values = []
+    for line in lines:
+        w = words(line)
+        if w[0] == ("G", 0):
+            args = [(a, v) for a, v in w[1:] if a in AXES + "F"]
+            shape.append(("G0",) + tuple(a for a, _ in args))
+            values += [round(v) if a == "F" else round(v * 1000)
+                       for a, v in args]
+        elif w[0] == ("M", 105):
+            shape.append(("M105", int(dict(w[1:]).get("N", 1))))
+        else:
+            shape.append(record(line))
+    return tuple(shape), values
+
+
+def encode_step(shape, values, argslots=()):
+    """Records of a step, the values in argslots as argument numbers."""
+    recs = b""
+    reads = 0
+    i = 0
+    for s in shape:
+        if isinstance(s, bytes):
+            recs += s
+            continue
+        if s[0] == "M105":
+            recs += bytes([OP_SENSE])
+            reads = s[1]
+            continue
+        mask = argmask = 0
+        fields = b""
+        for a in s[1:]:
+            bit = 1 << (AXES + "F").index(a)
+            mask |= bit
+            if i in argslots:
+                argmask |= bit
+                fields += bytes([argslots.index(i)])
+            else:
+                fields += varint(values[i])
+            i += 1
+        if argmask:
+            recs += bytes([OP_MOVE | MOVE_ARGS | mask, argmask]) + fields
+        else:
+            recs += bytes([OP_MOVE | mask]) + fields
+    return recs, reads
+
+
+def plan_macros(path):
+    """Items as plan(), plus ("define", id, nargs, records) and
+    ("call", id, args, reads)."""
+    items = []
+    seen = {}
+    parts = steps(path)
+    for p in parts:
+        if not isinstance(p, str):
+            shape, values = template(p)
+            seen.setdefault(shape, []).append(values)
+
+    macros = {}
+    for shape, occ in sorted(seen.items(), key=lambda x: -len(x[1])):
+        if len(occ) < 2 or len(macros) == MACRO_N:
+            continue
+        slots = tuple(i for i in range(len(occ[0]))
+                      if any(v[i] != occ[0][i] for v in occ))
+        recs, _ = encode_step(shape, occ[0], slots)
+        if len(slots) > MACRO_ARGS or len(recs) > MACRO_LEN:
+            continue
+        macros[shape] = (len(macros), slots)
+        items.append(("define", len(macros) - 1, len(slots), recs))
+
+    for p in parts:
+        if isinstance(p, str):
+            items.append(("gcode", p))
+            continue
+        shape, values = template(p)
+        recs, reads = encode_step(shape, values)
+        if shape in macros:
+            mid, slots = macros[shape]
+            items.append(("call", mid, [values[i] for i in slots], reads))
+        elif len(recs) + 2 <= MAXLEN:
+            items.append(("batch", [recs], reads))
+        else:
+            items += [("gcode", line) for line in p]
+
+    return items
+
+
+def gcode_bytes(path):
+    tx = rx = 0
+    with open(path) as f:
+        for line in f:
+            line = line.split(";")[0].strip()
+            if not line:
+                continue
+            tx += len(line) + 1
+            rx += GCODE_RX
+            if words(line)[0] == ("M", 105):
+                rx += len("ok V:1\r\n")
+    return tx + rx
+
+
+def batch_bytes(items):
+    n = 0
+    for item in items:
+        if item[0] == "batch":
+            n += OVERHEAD + 2 + sum(len(r) for r in item[1]) + BATCH_RX
+        elif item[0] == "define":
+            n += OVERHEAD + 2 + len(item[3]) + OVERHEAD + 2
+        elif item[0] == "call":
+            n += OVERHEAD + 3 + sum(len(varint(v)) for v in item[2]) + \
+                BATCH_RX
+        else:
+            n += len(item[1]) + 1 + GCODE_RX
+            if item[1].startswith("M105"):
+                n += len("ok V:1\r\n")
+    return n
+
+
+def components(path):
+    with open(path) as f:
+        for line in f:
+            m = re.match(r";\s*components:\s*(\d+)", line)
+            if m:
+                return int(m.group(1))
+    return 0
+
+
+def run(link, items):
+    seq = 0
+    for item in items:
+        if item[0] == "gcode":
+            for r in link.gcode(item[1]):
+                print(r)
+            continue
+        if item[0] == "define":
+            _, mid, nargs, recs = item
+            nak = link.check(MACRO_DEFINE, bytes([mid, nargs]) + recs)
+            if nak:
+                raise SystemExit("macro %d: record %d, %s" %
+                                 (mid, nak[2], ERRORS.get(nak[1], nak[1])))
+            continue
+        if item[0] == "call":
+            _, mid, args, reads = item
+            payload = struct.pack("<HB", seq, mid) + \
+                b"".join(varint(v) for v in args)
+            rtype, data = link.request(MACRO_CALL, payload)
+        else:
+            _, recs, reads = item
+            payload = struct.pack("<H", seq) + b"".join(recs)
+            rtype, data = link.request(BATCH, payload)
+        if rtype == NAK | REPLY:
+            raise SystemExit("batch: %s" % ERRORS.get(data[1], data[1]))
+        rseq, done, err, vac = struct.unpack("<HBBB", data)
+        if rseq != seq or err:
+            raise SystemExit("batch %d: %d records done, %s" %
+                             (seq, done, ERRORS.get(err, err)))
+        if reads:
+            print("ok %s:%d" % ("VW"[reads - 1], vac >> (reads - 1) & 1))
+        seq = (seq + 1) & 0xFFFF
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-m", action="store_true", help="use macros")
+    ap.add_argument("-n", action="store_true", help="count bytes only")
+    ap.add_argument("-p", help="serial port")
+    ap.add_argument("-s", type=int, help="baud rate")
+    ap.add_argument("files", nargs="+")
+    args = ap.parse_args()
+
+    if not args.n and not args.p:
+        ap.error("a port is needed without -n")
+
+    link = None
+    if not args.n:
+        link = Link(args.p)
+        if args.s and link.baud(args.s) != args.s:
+            print("batch: staying at %d baud" % link.rate)
+        link.enable()
+
+    for path in args.files:
+        items = plan(path)
+        g = gcode_bytes(path)
+        b = batch_bytes(items)
+        n = components(path) or 1
+        print("%s: %d bytes as G-code, %d in batches, %.0f and %.0f per "
+              "component, %.1fx" % (path, g, b, g / n, b / n, g / b))
+        if args.m:
+            items = plan_macros(path)
+            b = batch_bytes(items)
+            print("  %d with %d macros, %.0f per component, %.1fx" %
+                  (b, sum(1 for i in items if i[0] == "define"), b / n,
+                   g / b))
+        if link is None:
+            continue
+        t0 = time.monotonic()
+        tx, rx = link.tx, link.rx
+        run(link, items)
+        print("  sent %d, received %d bytes in %.3f s" %
+              (link.tx - tx, link.rx - rx, time.monotonic() - t0))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
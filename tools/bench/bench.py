@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+#-
+# Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+"""Run the placement benchmark traces and compare with a baseline.
+
+Usage: bench.py [-p port] [-s baud] [-b baseline.json] [-w out.json]
+                [trace ...]
+
+Each trace is sent one line at a time, the next one after COMPLETE, to
+the simulator (tools/sim/pnpsim, default) or to the machine on a serial
+port. The time of every line is split into the characters on the wire
+(protocol) and the rest, which goes to the phase of the command: travel
+(XY moves), z, rotation, actuation (M800, M105) or other. Components per
+hour come from the "; components: <n>" line of the trace. With -s
+the console is switched to that rate (M927) before each trace.
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import termios
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+SIM = os.path.join(BENCH_DIR, "..", "sim", "pnpsim")
+
+BAUD = 115200
+
+PHASES = ["travel", "z", "rotation", "actuation", "other", "protocol"]
+
+
+def load_trace(path):
+    lines = []
+    components = 0
+
+    with open(path) as f:
+        for line in f:
+            m = re.match(r";\s*components:\s*(\d+)", line)
+            if m:
+                components = int(m.group(1))
+            line = line.split(";")[0].strip()
+            if line:
+                lines.append(line)
+
+    return (lines, components)
+
+
+def phase(line):
+    words = line.upper().split()
+    if not words:
+        return "other"
+    if words[0] in ("M800", "M105"):
+        return "actuation"
+    if words[0] not in ("G0", "G00"):
+        return "other"
+    axes = set(w[0] for w in words[1:])
+    if axes & set("XY"):
+        return "travel"
+    if "Z" in axes:
+        return "z"
+    if axes & set("IJ"):
+        return "rotation"
+    return "other"
+
+
+def run_sim(path, baud):
+    """Records (start us, end us, chars sent, chars received, line)."""
+    if not os.access(SIM, os.X_OK):
+        raise SystemExit("bench: %s not found, run make -C tools/sim" % SIM)
+
+    with tempfile.NamedTemporaryFile(mode="r", suffix=".txt") as rec, \
+            tempfile.NamedTemporaryFile(mode="w", suffix=".gcode") as tr:
+        # The rate switch and its confirmation are not timed.
+        skip = 0
+        if baud != BAUD:
+            tr.write("M927 S%d\nM927\n" % baud)
+            skip = 2
+        with open(path) as f:
+            tr.write(f.read())
+        tr.flush()
+        subprocess.run([SIM, "-t", tr.name, "-r", rec.name], check=True,
+                       stdout=subprocess.DEVNULL)
+        records = []
+        for line in rec:
+            f = line.rstrip("\n").split(" ", 4)
+            records.append((float(f[0]), float(f[1]), int(f[2]),
+                            int(f[3]), f[4]))
+
+    return records[skip:]
+
+
+def open_port(port):
+    fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0
+    attr[1] = 0
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0
+    attr[4] = attr[5] = termios.B115200
+    attr[6][termios.VMIN] = 1
+    attr[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+
+    return fd
+
+
+def switch_port(fd, baud):
+    """M927 at the current rate, then confirm at the new one."""
+    for line in ("M927 S%d" % baud, "\nM927"):
+        os.write(fd, (line + "\n").encode())
+        buf = b""
+        while b"COMPLETE" not in buf:
+            buf += os.read(fd, 256)
+        if b"ok S:%d" % baud not in buf:
+            raise SystemExit("bench: can't switch to %d baud" % baud)
+        if line.startswith("M927 S"):
+            attr = termios.tcgetattr(fd)
+            attr[4] = attr[5] = getattr(termios, "B%d" % baud)
+            termios.tcsetattr(fd, termios.TCSADRAIN, attr)
+
+
+def run_port(fd, lines):
+    """Same records as run_sim(), timed on the host."""
+    records = []
+    buf = b""
+    t0 = time.monotonic()
+
+    for line in lines:
+        start = (time.monotonic() - t0) * 1000000
+        os.write(fd, (line + "\n").encode())
+        rx = 0
+        while True:
+            while b"\n" not in buf:
+                buf += os.read(fd, 256)
+            reply, buf = buf.split(b"\n", 1)
+            rx += len(reply) + 1
+            if reply.strip() == b"COMPLETE":
+                break
+        end = (time.monotonic() - t0) * 1000000
+        records.append((start, end, len(line) + 1, rx, line))
+
+    return records
+
+
+def summarize(records, components, baud):
+    res = {p: 0.0 for p in PHASES}
+    char_us = 10 * 1000000.0 / baud
+
+    for start, end, tx, rx, line in records:
+        # One more character time until the receiver goes idle.
+        proto = (tx + 1 + rx) * char_us
+        total = end - start
+        res["protocol"] += min(proto, total)
+        res[phase(line)] += max(total - proto, 0)
+
+    res = {p: round(v / 1000, 3) for p, v in res.items()}
+    total = sum(res[p] for p in PHASES)
+
+    return {
+        "lines": len(records),
+        "components": components,
+        "total_ms": round(total, 3),
+        "cph": round(components * 3600000 / total) if total else 0,
+        "phases_ms": res,
+    }
+
+
+def report(name, res, base, threshold):
+    """Print one trace, return the number of regressions."""
+    bad = 0
+
+    print("%s: %d lines, %.3f s, %d components, %d cph" %
+          (name, res["lines"], res["total_ms"] / 1000, res["components"],
+           res["cph"]))
+    for p in PHASES:
+        ms = res["phases_ms"][p]
+        line = "  %-10s %12.3f ms %5.1f%%" % (p, ms,
+            100 * ms / res["total_ms"] if res["total_ms"] else 0)
+        if base is not None:
+            old = base["phases_ms"].get(p, 0)
+            line += "  %+10.3f ms" % (ms - old)
+        print(line)
+
+    if base is None:
+        return 0
+
+    delta = res["total_ms"] - base["total_ms"]
+    pct = 100 * delta / base["total_ms"] if base["total_ms"] else 0
+    verdict = "ok"
+    if pct > threshold:
+        verdict = "REGRESSION"
+        bad += 1
+    elif pct < -threshold:
+        verdict = "improved"
+    print("  total %+.3f ms (%+.2f%%) vs baseline: %s" % (delta, pct,
+                                                         verdict))
+
+    return bad
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("traces", nargs="*",
+                    help="G-code traces (default tools/bench/*.gcode)")
+    ap.add_argument("-b", "--baseline",
+                    help="compare with this baseline (JSON)")
+    ap.add_argument("-p", "--port",
+                    help="run on the machine at this serial port")
+    ap.add_argument("-s", "--speed", type=int, default=BAUD,
+                    help="console baud rate (default 115200)")
+    ap.add_argument("-t", "--threshold", type=float, default=1.0,
+                    help="regression threshold, percent (default 1)")
+    ap.add_argument("-w", "--write", help="save the results as a baseline")
+    args = ap.parse_args()
+
+    traces = args.traces or sorted(glob.glob(os.path.join(BENCH_DIR,
+                                                          "*.gcode")))
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    fd = open_port(args.port) if args.port else None
+    if fd is not None and args.speed != BAUD:
+        switch_port(fd, args.speed)
+
+    results = {}
+    bad = 0
+    for path in traces:
+        name = os.path.splitext(os.path.basename(path))[0]
+        lines, components = load_trace(path)
+        if fd is None:
+            records = run_sim(path, args.speed)
+        else:
+            records = run_port(fd, lines)
+        results[name] = summarize(records, components, args.speed)
+        bad += report(name, results[name], baseline.get(name),
+                      args.threshold)
+
+    if args.write:
+        with open(args.write, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write("\n")
+
+    if bad:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
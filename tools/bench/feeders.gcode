@@ -0,0 +1,173 @@
+; Feeder setup: advance and pick test on every tape feeder
+; components: 0
+
+G0 Z0 F30000
+G0 X20 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X28 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X36 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X44 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X52 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X60 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X68 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X76 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X84 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X92 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X100 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+G0 X108 Y300
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+M800 V0
+
+M400
@@ -0,0 +1,568 @@
+; 0402 resistors and capacitors from 8 mm tape, no bottom vision
+; OpenPnP job sequence, nozzles 1 (V, I) and 2 (W, J) alternate.
+; components: 40
+
+G0 Z0 F30000
+M400
+
+; part 1
+G0 X20 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X150 Y150 I90
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 2
+G0 X28 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X153.5 Y150 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 3
+G0 X36 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X157 Y150 I180
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 4
+G0 X44 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X160.5 Y150 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 5
+G0 X52 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X164 Y150 I270
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 6
+G0 X60 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X167.5 Y150 J270
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 7
+G0 X20 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X171 Y150 I270
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 8
+G0 X28 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X174.5 Y150 J270
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 9
+G0 X36 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X150 Y152.5 I90
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 10
+G0 X44 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X153.5 Y152.5 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 11
+G0 X52 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X157 Y152.5 I270
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 12
+G0 X60 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X160.5 Y152.5 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 13
+G0 X20 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X164 Y152.5 I270
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 14
+G0 X28 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X167.5 Y152.5 J270
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 15
+G0 X36 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X171 Y152.5 I0
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 16
+G0 X44 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X174.5 Y152.5 J270
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 17
+G0 X52 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X150 Y155 I180
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 18
+G0 X60 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X153.5 Y155 J90
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 19
+G0 X20 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X157 Y155 I0
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 20
+G0 X28 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X160.5 Y155 J180
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 21
+G0 X36 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X164 Y155 I0
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 22
+G0 X44 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X167.5 Y155 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 23
+G0 X52 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X171 Y155 I0
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 24
+G0 X60 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X174.5 Y155 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 25
+G0 X20 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X150 Y157.5 I270
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 26
+G0 X28 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X153.5 Y157.5 J90
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 27
+G0 X36 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X157 Y157.5 I270
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 28
+G0 X44 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X160.5 Y157.5 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 29
+G0 X52 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X164 Y157.5 I90
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 30
+G0 X60 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X167.5 Y157.5 J270
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 31
+G0 X20 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X171 Y157.5 I270
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 32
+G0 X28 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X174.5 Y157.5 J90
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 33
+G0 X36 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X150 Y160 I180
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 34
+G0 X44 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X153.5 Y160 J90
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 35
+G0 X52 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X157 Y160 I90
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 36
+G0 X60 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X160.5 Y160 J270
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 37
+G0 X20 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X164 Y160 I180
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 38
+G0 X28 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X167.5 Y160 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 39
+G0 X36 Y300
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X171 Y160 I270
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 40
+G0 X44 Y300
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X174.5 Y160 J0
+G0 Z-10
+M800 W0
+G0 Z0
+
+M400
@@ -0,0 +1,68 @@
+; LQFP-64 and LQFP-128 from a tray, bottom vision
+; OpenPnP job sequence, nozzles 1 (V, I) and 2 (W, J) alternate.
+; components: 4
+
+G0 Z0 F30000
+M400
+
+; part 1
+G0 X300 Y60
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X180 Y20
+M400
+G0 I-0.113
+G0 X199.973 Y180.011
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 2
+G0 X300 Y90
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X180 Y20
+M400
+G0 J2.646
+G0 X229.983 Y180.063
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 3
+G0 X300 Y60
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X180 Y20
+M400
+G0 I89.487
+G0 X199.9 Y210.008
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 4
+G0 X300 Y90
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X180 Y20
+M400
+G0 J1.719
+G0 X229.966 Y210.02
+G0 Z-10
+M800 W0
+G0 Z0
+
+M400
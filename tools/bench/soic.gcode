@@ -0,0 +1,212 @@
+; SOIC-8 and SOIC-16 from 12 mm tape, bottom vision
+; OpenPnP job sequence, nozzles 1 (V, I) and 2 (W, J) alternate.
+; components: 12
+
+G0 Z0 F30000
+M400
+
+; part 1
+G0 X80 Y330
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X180 Y20
+M400
+G0 I-1.544
+G0 X170.059 Y169.983
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 2
+G0 X96 Y330
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X180 Y20
+M400
+G0 J178.038
+G0 X182.01 Y170.041
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 3
+G0 X80 Y330
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X180 Y20
+M400
+G0 I1.047
+G0 X193.975 Y169.988
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 4
+G0 X96 Y330
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X180 Y20
+M400
+G0 J180.051
+G0 X206.056 Y170.004
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 5
+G0 X80 Y330
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X180 Y20
+M400
+G0 I179.36
+G0 X169.998 Y178.906
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 6
+G0 X96 Y330
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X180 Y20
+M400
+G0 J-2.739
+G0 X182.041 Y179.097
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 7
+G0 X80 Y330
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X180 Y20
+M400
+G0 I180.559
+G0 X193.979 Y178.934
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 8
+G0 X96 Y330
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X180 Y20
+M400
+G0 J180.013
+G0 X206.096 Y179.054
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 9
+G0 X80 Y330
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X180 Y20
+M400
+G0 I180.238
+G0 X170.072 Y187.946
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 10
+G0 X96 Y330
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X180 Y20
+M400
+G0 J180.083
+G0 X182.09 Y188.016
+G0 Z-10
+M800 W0
+G0 Z0
+
+; part 11
+G0 X80 Y330
+M800 O1
+M800 O0
+G0 I0
+G0 Z10
+M800 V1
+G0 Z0
+M105 N1
+G0 X180 Y20
+M400
+G0 I-0.245
+G0 X193.954 Y188.01
+G0 Z10
+M800 V0
+G0 Z0
+
+; part 12
+G0 X96 Y330
+M800 O1
+M800 O0
+G0 J0
+G0 Z-10
+M800 W1
+G0 Z0
+M105 N2
+G0 X180 Y20
+M400
+G0 J182.743
+G0 X205.901 Y188.057
+G0 Z-10
+M800 W0
+G0 Z0
+
+M400
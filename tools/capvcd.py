@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+#-
+# Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+"""Convert an M915 step capture dump into a VCD file for GTKWave.
+
+Usage: capvcd.py [-o out.vcd] [-w pulse_ns] [dump.txt]
+
+The input is the console output of M915, other lines are ignored.
+"""
+
+import argparse
+import sys
+
+AXES = ["X", "Y", "Z", "H1", "H2"]
+
+
+def parse(lines):
+    freq = None
+    events = []
+    base = 0
+    last = None
+
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("ok K:"):
+            continue
+        body = line[5:]
+        if body.startswith("N:"):
+            for field in body.split():
+                if field.startswith("F:"):
+                    freq = int(field[2:])
+            continue
+        fields = body.split()
+        if len(fields) != 4:
+            continue
+        t = int(fields[0], 16)
+
+        # Unwrap the 32-bit cycle counter. Events of different axes may
+        # be slightly out of order, so only a large step back is a wrap.
+        if last is not None and t + base < last - (1 << 31):
+            base += 1 << 32
+        t += base
+        last = t
+
+        events.append((t, int(fields[1]), int(fields[2]), int(fields[3])))
+
+    if freq is None:
+        raise SystemExit("capvcd: no M915 header found")
+
+    events.sort()
+
+    return (freq, events)
+
+
+def write_vcd(out, freq, events, pulse_ns):
+    ids = {}
+    for n, name in enumerate(AXES):
+        ids[n] = ("s%d" % n, "d%d" % n, "p%d" % n, "i%d" % n)
+
+    out.write("$timescale 1ns $end\n")
+    out.write("$scope module stepper $end\n")
+    for n, name in enumerate(AXES):
+        stp, dr, pos, idx = ids[n]
+        out.write("$var wire 1 %s STP_%s $end\n" % (stp, name))
+        out.write("$var wire 1 %s DIR_%s $end\n" % (dr, name))
+        out.write("$var integer 32 %s POS_%s $end\n" % (pos, name))
+        out.write("$var integer 32 %s IDX_%s $end\n" % (idx, name))
+    out.write("$upscope $end\n")
+    out.write("$enddefinitions $end\n")
+
+    if not events:
+        return
+
+    t0 = events[0][0]
+
+    # Changes: (time ns, order, text). Falling edges sort before
+    # rising edges at the same time.
+    changes = []
+    pos = [0] * len(AXES)
+    dirs = [None] * len(AXES)
+    for t, axis, d, index in events:
+        ns = (t - t0) * 1000000000 // freq
+        stp, dr, p, idx = ids[axis]
+        if dirs[axis] != d:
+            changes.append((ns, 1, "%d%s" % (d, dr)))
+            dirs[axis] = d
+        pos[axis] += 1 if d else -1
+        changes.append((ns, 2, "1%s" % stp))
+        changes.append((ns, 2, "b{:b} {}".format(pos[axis] & 0xffffffff, p)))
+        changes.append((ns, 2, "b{:b} {}".format(index, idx)))
+        changes.append((ns + pulse_ns, 0, "0%s" % stp))
+    changes.sort()
+
+    out.write("#0\n$dumpvars\n")
+    for n in range(len(AXES)):
+        stp, dr, p, idx = ids[n]
+        out.write("0%s\n0%s\nb0 %s\nb0 %s\n" % (stp, dr, p, idx))
+    out.write("$end\n")
+
+    cur = 0
+    for ns, _, text in changes:
+        if ns != cur:
+            out.write("#%d\n" % ns)
+            cur = ns
+        out.write(text + "\n")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("dump", nargs="?", help="M915 output (default stdin)")
+    ap.add_argument("-o", "--output", help="VCD file (default stdout)")
+    ap.add_argument("-w", "--pulse-ns", type=int, default=1000,
+                    help="STP pulse width drawn, ns (default 1000)")
+    args = ap.parse_args()
+
+    if args.dump:
+        with open(args.dump) as f:
+            freq, events = parse(f)
+    else:
+        freq, events = parse(sys.stdin)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            write_vcd(f, freq, events, args.pulse_ns)
+    else:
+        write_vcd(sys.stdout, freq, events, args.pulse_ns)
+
+
+if __name__ == "__main__":
+    main()
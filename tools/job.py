@@ -0,0 +1,294 @@
+#!/usr/bin/env python3
+#-
+# Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+"""Run a placement job in the firmware (src/job.c).
+
+Usage: job.py [-g] [-n] [-c X,Y] [-d X,Y] [-r retries] [-l latency]
+              [-s baud] port file
+
+The file is a placement list, one part per line:
+
+    nozzle pick_x pick_y pick_depth place_x place_y place_depth rot [flags]
+
+in mm and degrees, flags "peel" and "vision". With -g it is a G-code
+trace as in tools/bench, turned into a placement list; -n prints that
+list and exits. Parts are loaded in chunks as the ring has room. At the
+camera the firmware waits for bottom vision, stubbed here: the reply is
+a zero correction after -l seconds, with the image taken at once.
+"""
+
+import argparse
+import re
+import select
+import struct
+import sys
+import time
+
+from pnpframe import ERRORS, MAXLEN, NAK, REPLY, Link, encode
+
+JOB_START = 0x08
+JOB_LOAD = 0x09
+JOB_CORRECT = 0x0A
+JOB_EVENT = 0x0B
+
+NPARTS = 128				# JOB_NPARTS
+PEEL = 1 << 2
+VISION = 1 << 3
+CORR_TAKEN = 1 << 0
+
+EV_VISION = 1
+EV_PLACED = 2
+EV_MISSED = 3
+EV_REJECTED = 4
+EV_DONE = 5
+EV_STOPPED = 6
+EVENTS = {EV_PLACED: "placed", EV_MISSED: "missed", EV_REJECTED: "rejected"}
+
+
+def varint(val):
+    """Zigzag LEB128."""
+    val = (val << 1) ^ (val >> 63)
+    out = b""
+    while val >= 0x80:
+        out += bytes([val & 0x7F | 0x80])
+        val >>= 7
+    return out + bytes([val])
+
+
+def um(v):
+    return round(float(v) * 1000)
+
+
+def load_list(path):
+    parts = []
+    with open(path) as f:
+        for line in f:
+            w = line.split("#")[0].split()
+            if not w:
+                continue
+            flags = int(w[0])
+            flags |= PEEL if "peel" in w[8:] else 0
+            flags |= VISION if "vision" in w[8:] else 0
+            parts.append([flags] + [um(v) for v in w[1:8]])
+    return parts
+
+
+def load_trace(path):
+    """Parts of an OpenPnP style trace, and the camera position."""
+    parts = []
+    camera = None
+    part = None
+    with open(path) as f:
+        for line in f:
+            line = line.split(";")[0].strip()
+            w = dict((x[0], float(x[1:])) for x in line.upper().split())
+            if "M" in w and w["M"] == 800 and ("V" in w or "W" in w):
+                if part is None:
+                    continue
+                if w.get("V", w.get("W")):
+                    part["nozzle"] = 1 if "V" in w else 2
+                    part["pick_z"] = part["z"]
+                else:
+                    part["place_z"] = part["z"]
+                    part["place"] = part["xy"]
+                    part["rot"] = part["r"]
+                    parts.append(part)
+                    part = None
+                continue
+            if "M" in w and w["M"] == 800 and w.get("O"):
+                part = part or {"flags": 0}
+                part["flags"] |= PEEL
+            elif "M" in w and w["M"] == 400 and part and "nozzle" in part:
+                part["flags"] |= VISION
+                camera = part["xy"]
+            elif "G" in w:
+                if "X" in w:
+                    part = part or {"flags": 0}
+                    part["xy"] = (w["X"], w["Y"])
+                    part.setdefault("pick", part["xy"])
+                for a in "IJ":
+                    if a in w and part is not None:
+                        part["r"] = w[a]
+                if "Z" in w and part is not None and w["Z"]:
+                    part["z"] = abs(w["Z"])
+    out = []
+    for p in parts:
+        out.append([p["nozzle"] | p["flags"],
+                    um(p["pick"][0]), um(p["pick"][1]), um(p["pick_z"]),
+                    um(p["place"][0]), um(p["place"][1]), um(p["place_z"]),
+                    um(p.get("rot", 0))])
+    return out, camera
+
+
+def print_list(parts):
+    for p in parts:
+        flags = [f for f, b in (("peel", PEEL), ("vision", VISION))
+                 if p[0] & b]
+        print(" ".join([str(p[0] & 3)] + ["%g" % (v / 1000) for v in p[1:]]
+                       + flags))
+
+
+def encode_part(p):
+    return bytes([p[0]]) + b"".join(varint(v) for v in p[1:])
+
+
+def vision(index):
+    """Bottom vision correction of a part, mm and degrees."""
+    return 0, 0, 0
+
+
+def run(link, parts, camera, discard, retries, latency):
+    payload = struct.pack("<HB", len(parts), retries) + \
+        b"".join(varint(um(v)) for v in camera + discard)
+    nak = link.check(JOB_START, payload)
+    if nak:
+        raise SystemExit("job: %s" % ERRORS.get(nak[1], nak[1]))
+
+    loaded = 0			# Parts the firmware has.
+    taken = 0			# Parts it has started.
+    loading = False
+    due = []			# Corrections to send: (time, index).
+    counts = {}
+
+    while True:
+        if not loading and loaded < len(parts) and \
+                loaded < taken + NPARTS:
+            chunk = b""
+            n = loaded
+            while n < min(len(parts), taken + NPARTS):
+                rec = encode_part(parts[n])
+                if 2 + len(chunk) + len(rec) > MAXLEN:
+                    break
+                chunk += rec
+                n += 1
+            link.write(encode_load(loaded, chunk))
+            loading = True
+
+        if due and not link.buf:
+            left = due[0][0] - time.monotonic()
+            if left > 0 and not select.select([link.fd], [], [], left)[0]:
+                left = 0
+            if left <= 0:
+                _, index = due.pop(0)
+                dx, dy, dr = vision(index)
+                link.write(encode_correct(index, 0, dx, dy, dr))
+                continue
+
+        rtype, data = link.receive()
+        if rtype is None:
+            if data:
+                print(data)
+        elif rtype == JOB_LOAD | REPLY:
+            loaded, taken = struct.unpack("<HH", data)
+            loading = False
+        elif rtype == NAK | REPLY and data[0] == JOB_LOAD:
+            # Loaded up to the part refused, the ring is full.
+            loaded += data[2]
+            loading = False
+            if data[1] != 6:
+                raise SystemExit("job: load %s" % ERRORS.get(data[1]))
+        elif rtype == NAK | REPLY:
+            raise SystemExit("job: %#x %s" %
+                             (data[0], ERRORS.get(data[1], data[1])))
+        elif rtype == JOB_EVENT | REPLY:
+            index, ev, tries = struct.unpack("<HBB", data)
+            taken = max(taken, index + 1)
+            if ev == EV_VISION:
+                if latency:
+                    link.write(encode_correct(index, CORR_TAKEN))
+                due.append((time.monotonic() + latency, index))
+            elif ev in EVENTS:
+                counts[ev] = counts.get(ev, 0) + 1
+                if ev != EV_PLACED or tries > 1:
+                    print("part %d: %s, %d picks" %
+                          (index, EVENTS[ev], tries))
+            elif ev == EV_DONE:
+                return counts
+            elif ev == EV_STOPPED:
+                raise SystemExit("job: stopped at part %d" % index)
+
+
+def encode_load(index, chunk):
+    return encode(JOB_LOAD, struct.pack("<H", index) + chunk)
+
+
+def encode_correct(index, flags, dx=0, dy=0, dr=0):
+    payload = struct.pack("<HB", index, flags)
+    if flags == 0:
+        payload += b"".join(varint(um(v)) for v in (dx, dy, dr))
+    return encode(JOB_CORRECT, payload)
+
+
+def xy(s):
+    return [float(v) for v in s.split(",")]
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-g", action="store_true", help="file is a G-code trace")
+    ap.add_argument("-n", action="store_true", help="print the parts")
+    ap.add_argument("-c", type=xy, help="camera X,Y")
+    ap.add_argument("-d", type=xy, default=[0, 0], help="discard X,Y")
+    ap.add_argument("-r", type=int, default=2, help="pick retries")
+    ap.add_argument("-l", type=float, default=0, help="vision latency, s")
+    ap.add_argument("-s", type=int, help="baud rate")
+    ap.add_argument("port", nargs="?")
+    ap.add_argument("file")
+    args = ap.parse_args()
+
+    camera = args.c
+    if args.g:
+        parts, cam = load_trace(args.file)
+        camera = camera or (list(cam) if cam else None)
+    else:
+        parts = load_list(args.file)
+    if args.n:
+        print_list(parts)
+        return 0
+    if args.port is None:
+        ap.error("a port is needed without -n")
+    if camera is None:
+        camera = [0, 0]
+
+    link = Link(args.port)
+    if args.s and link.baud(args.s) != args.s:
+        print("job: staying at %d baud" % link.rate)
+    link.enable()
+
+    t0 = time.monotonic()
+    tx, rx = link.tx, link.rx
+    counts = run(link, parts, camera, args.d, args.r, args.l)
+    t = time.monotonic() - t0
+    print("%s: %d parts, %d placed in %.3f s, %.0f cph, sent %d, "
+          "received %d bytes" %
+          (args.file, len(parts), counts.get(EV_PLACED, 0), t,
+           3600 * counts.get(EV_PLACED, 0) / t, link.tx - tx,
+           link.rx - rx))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
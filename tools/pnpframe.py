@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+#-
+# Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+"""Binary frames on the firmware console, see src/frame.h.
+
+Shared by stepsched.py and batch.py.
+"""
+
+import os
+import re
+import select
+import struct
+import sys
+import termios
+import time
+
+SYNC = 0xA5
+MAXLEN = 120
+OVERHEAD = 5
+
+CLOCK = 0x01
+STEP_CLOCK = 0x02
+QUEUE_STEP = 0x03
+SCHED_STATUS = 0x04
+BATCH = 0x05
+MACRO_DEFINE = 0x06
+MACRO_CALL = 0x07
+NAK = 0x7F
+REPLY = 0x80
+
+BAUD = 115200
+BAUD_TIMEOUT = 0.5			# GCODE_BAUD_TIMEOUT
+
+ERR_FULL = 6
+ERR_ABORT = 7
+ERRORS = {1: "crc", 2: "length", 3: "type", 4: "argument", 5: "busy",
+          6: "full", 7: "aborted", 8: "no such macro"}
+
+
+def crc16(data, crc=0xFFFF):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def encode(ftype, payload=b""):
+    body = bytes([len(payload), ftype]) + payload
+    return bytes([SYNC]) + body + struct.pack("<H", crc16(body))
+
+
+class Link:
+    """Console of the machine, or of tools/sim/pnpsim on its pty."""
+
+    def __init__(self, port):
+        self.fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+        attr = termios.tcgetattr(self.fd)
+        attr[0] = 0
+        attr[1] = 0
+        attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        attr[3] = 0
+        attr[4] = attr[5] = termios.B115200
+        attr[6][termios.VMIN] = 1
+        attr[6][termios.VTIME] = 0
+        termios.tcsetattr(self.fd, termios.TCSANOW, attr)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+        self.buf = b""
+        self.bol = True
+        self.tx = 0
+        self.rx = 0
+        self.rate = BAUD
+        self.deadline = None
+
+    def speed(self, rate):
+        attr = termios.tcgetattr(self.fd)
+        attr[4] = attr[5] = getattr(termios, "B%d" % rate)
+        termios.tcsetattr(self.fd, termios.TCSADRAIN, attr)
+        self.rate = rate
+
+    def write(self, data):
+        os.write(self.fd, data)
+        self.tx += len(data)
+
+    def read(self, n):
+        while len(self.buf) < n:
+            if self.deadline is not None:
+                left = self.deadline - time.monotonic()
+                if left <= 0 or not select.select([self.fd], [], [],
+                                                  left)[0]:
+                    raise TimeoutError
+            self.buf += os.read(self.fd, 256)
+        data, self.buf = self.buf[:n], self.buf[n:]
+        self.rx += n
+        return data
+
+    def receive(self):
+        """Next frame or text line: (type, payload) or (None, line)."""
+        line = b""
+        while True:
+            b = self.read(1)
+            if self.bol and not line and b[0] == SYNC:
+                hdr = self.read(2)
+                rest = self.read(hdr[0] + 2)
+                if crc16(hdr + rest[:-2]) != struct.unpack("<H",
+                                                           rest[-2:])[0]:
+                    raise SystemExit("frame: reply with a bad CRC")
+                return hdr[1], rest[:-2]
+            line += b
+            self.bol = b == b"\n"
+            if self.bol:
+                return None, line.decode(errors="replace").strip()
+
+    def request(self, ftype, payload=b""):
+        """Send a frame, return (type, payload) of the reply frame."""
+        self.write(encode(ftype, payload))
+        while True:
+            rtype, data = self.receive()
+            if rtype is not None:
+                return rtype, data
+            # Text lines, such as status reports, are passed through.
+            print(data)
+
+    def check(self, ftype, payload=b""):
+        """None, or the payload of a NAK."""
+        rtype, data = self.request(ftype, payload)
+        if rtype == NAK | REPLY:
+            return data
+        if rtype != ftype | REPLY:
+            raise SystemExit("frame: unexpected reply %#x" % rtype)
+        return None
+
+    def gcode(self, line):
+        """Send a G-code line, return the replies before COMPLETE."""
+        self.write((line + "\n").encode())
+        replies = []
+        while True:
+            rtype, data = self.receive()
+            if rtype is not None:
+                raise SystemExit("frame: unexpected frame %#x" % rtype)
+            if data == "COMPLETE":
+                return replies
+            if data and data != "OK":
+                replies.append(data)
+
+    def baud(self, rate):
+        """Switch both ends to rate with M927, return the rate in use."""
+        if not any(r == "ok S:%d" % rate
+                   for r in self.gcode("M927 S%d" % rate)):
+            return self.rate
+        old = self.rate
+        self.speed(rate)
+        try:
+            # The newline ends whatever noise came before.
+            self.deadline = time.monotonic() + BAUD_TIMEOUT / 2
+            if any(r == "ok S:%d" % rate for r in self.gcode("\nM927")):
+                return rate
+        except TimeoutError:
+            pass
+        finally:
+            self.deadline = None
+        # The firmware goes back to the old rate on its own.
+        self.speed(old)
+        self.deadline = time.monotonic() + 2 * BAUD_TIMEOUT
+        try:
+            while self.receive()[1] != "ok S:%d" % old:
+                continue
+        finally:
+            self.deadline = None
+        self.buf = b""
+        self.bol = True
+        return old
+
+    def enable(self):
+        """Turn frames on with M926, fails on firmware without them."""
+        for r in self.gcode("M926 S1"):
+            m = re.match(r"ok P:(\d+) L:(\d+) S:1", r)
+            if m:
+                return int(m.group(1))
+        raise SystemExit("frame: binary frames not supported")
@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+#-
+# Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+"""Check real-time characters in a stream with no idle gap.
+
+Usage: rtstream.py port
+
+The firmware looks for real-time characters when the line goes idle,
+which never happens while a host streams without a pause, and on every
+half of its receive buffer. Two runs:
+
+hold	X is held in a move with '!', so no line is read, and close to a
+	receive window of lines follows at once with '?' in front: the
+	status report has to come while the lines are still on the wire.
+	^X then drops the move and the lines.
+long	Several receive buffers of short lines without a pause, with '?'
+	every kilobyte: every one is answered.
+
+Runs on the machine or on tools/sim/pnpsim. X moves by up to 100 mm.
+"""
+
+import argparse
+import os
+import select
+import sys
+import time
+
+from pnpframe import Link
+
+FILL = b"G90\n"
+BUFSIZE = 4096				# DMA_BUF_SIZE
+WINDOW = 3840				# GCODE_WINDOW
+
+
+def status(link, timeout=1.0):
+    """Wait for a status report, return its words and the time it came."""
+    link.deadline = time.monotonic() + timeout
+    try:
+        while True:
+            _, line = link.receive()
+            if line.startswith("ok X:"):
+                return dict(w.split(":") for w in line.split()[1:]), \
+                    time.monotonic()
+    except TimeoutError:
+        return None, None
+    finally:
+        link.deadline = None
+
+
+def drain(link, quiet=0.5):
+    """Read replies until the console stays quiet, return them."""
+    lines = []
+    link.deadline = time.monotonic() + quiet
+    try:
+        while True:
+            _, line = link.receive()
+            lines.append(line)
+            link.deadline = time.monotonic() + quiet
+    except TimeoutError:
+        return lines
+    finally:
+        link.deadline = None
+
+
+def run_hold(link):
+    link.write(b"?")
+    words, _ = status(link)
+    if words is None:
+        raise SystemExit("rtstream: no status report")
+    x = 10 if float(words["X"]) > 55 else 100
+
+    link.write(b"G0 X%d\n" % x)
+    time.sleep(0.05)
+    link.write(b"!")
+    drain(link, 0.2)
+
+    data = b"?" + FILL * ((WINDOW - 1) // len(FILL))
+    wire = len(data) * 10 / link.rate
+    t0 = time.monotonic()
+    link.write(data)
+    words, t = status(link, 2 * wire + 1)
+
+    link.write(b"\x18")
+    aborted = any(l == "ABORTED" for l in drain(link))
+
+    if words is None:
+        print("hold: no status report")
+        return 1
+    print("hold: status after %.0f ms, %d bytes take %.0f ms%s" %
+          ((t - t0) * 1000, len(data), wire * 1000,
+           "" if aborted else ", not aborted"))
+    # A half buffer at the latest, the line is idle only at the end.
+    return 0 if t - t0 < wire * 0.8 and aborted else 1
+
+
+def run_long(link, nbufs=4):
+    data = b""
+    queries = 0
+    while len(data) < nbufs * BUFSIZE:
+        data += b"?" + FILL * (1023 // len(FILL))
+        queries += 1
+
+    # Write and read together, the replies outnumber the lines.
+    answered = 0
+    sent = 0
+    t0 = time.monotonic()
+    while True:
+        wfd = [link.fd] if sent < len(data) else []
+        r, w, _ = select.select([link.fd], wfd, [], 1.0)
+        if not r and not w:
+            break
+        if w:
+            sent += os.write(link.fd, data[sent:sent + 256])
+        if r:
+            link.buf += os.read(link.fd, 4096)
+            while b"\n" in link.buf:
+                line, link.buf = link.buf.split(b"\n", 1)
+                if line.startswith(b"ok X:"):
+                    answered += 1
+
+    print("long: %d of %d status reports in %d bytes, %.3f s" %
+          (answered, queries, len(data), time.monotonic() - t0))
+    return 0 if answered == queries else 1
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("port")
+    args = ap.parse_args()
+
+    link = Link(args.port)
+    drain(link, 0.2)
+    err = run_hold(link)
+    err |= run_long(link)
+    print("rtstream: %s" % ("ok" if err == 0 else "FAILED"))
+
+    return err
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,86 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SIM_STM32F4_H_
+#define	_SIM_STM32F4_H_
+
+#include <arm/stm/stm32f4_gpio.h>
+
+/*
+ * Peripheral addresses are the real ones: the simulator maps memory
+ * there so that direct register accesses of src/ work unchanged.
+ */
+#define	FLASH_BASE	0x40023C00
+#define	GPIO_BASE	0x40020000
+#define	USART1_BASE	0x40011000
+#define	DMA2_BASE	0x40026400
+#define	TIM4_BASE	0x40000800
+#define	TIM10_BASE	0x40014400
+#define	TIM12_BASE	0x40001800
+#define	TIM13_BASE	0x40001C00
+#define	TIM14_BASE	0x40002000
+
+#define	USART_SR	0x00
+#define	USART_DR	0x04
+#define	USART_BRR	0x08
+#define	USART_CR1	0x0C
+
+struct stm32f4_flash_softc {
+	uint32_t base;
+};
+
+struct stm32f4_usart_softc {
+	uint32_t base;
+};
+
+struct stm32f4_dma_softc {
+	uint32_t base;
+};
+
+struct stm32f4_pwm_softc {
+	uint32_t base;
+};
+
+struct stm32f4_dma_conf {
+	uintptr_t mem0;
+	int sid;
+	uint32_t periph_addr;
+	int dir;
+	int channel;
+	int circ;
+	int psize;
+	int nbytes;
+};
+
+void stm32f4_dma_setup(struct stm32f4_dma_softc *sc,
+    struct stm32f4_dma_conf *conf);
+void stm32f4_dma_control(struct stm32f4_dma_softc *sc, int sid, int enable);
+uint32_t stm32f4_dma_getcnt(struct stm32f4_dma_softc *sc, int sid);
+void stm32f4_pwm_intr(void *arg, int irq);
+void stm32f4_pwm_step(struct stm32f4_pwm_softc *sc, int chanset,
+    uint32_t freq);
+
+#endif /* !_SIM_STM32F4_H_ */
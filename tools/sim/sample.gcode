@@ -0,0 +1,13 @@
+; Short pick and place cycle for the simulator.
+G0 X100 Y100 F30000
+G0 Z10
+M800 V1
+G0 Z0
+G0 X200 Y150 I90
+G0 Z10
+M800 V0
+G0 Z0
+M400
+?
+G0 X10 Y10 I0
+M911
@@ -0,0 +1,734 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Host simulator of the motion controller. The firmware sources run
+ * unchanged as cooperative threads on a virtual clock: time advances
+ * only when every thread is blocked, to the next timer, UART or sleep
+ * event, so a run is fully deterministic. The console is either a
+ * pseudo-terminal (paced to real time, for OpenPnP or a terminal) or
+ * a G-code trace replayed as fast as possible.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "include/sys/sem.h"
+#include "include/sys/thread.h"
+
+#include "sim.h"
+
+#define	SIM_NTHREADS		16
+#define	SIM_STACK_SIZE		(256 * 1024)
+#define	SIM_TRACE_NLINES	65536
+#define	SIM_LINE_LEN		256
+
+struct sim_thread {
+	struct thread *td;
+	void (*entry)(void *);
+	void *arg;
+	ucontext_t ctx;
+	int state;
+#define	SIM_TD_NEW	0
+#define	SIM_TD_READY	1
+#define	SIM_TD_SEM	2
+#define	SIM_TD_SLEEP	3
+#define	SIM_TD_EXITED	4
+	uint64_t wakeup;		/* Also the timeout of SIM_TD_SEM. */
+	struct sim_thread *next;	/* Semaphore wait list. */
+	mdx_sem_t *sem;
+	int timedout;
+};
+
+uint64_t sim_clock;
+
+static struct sim_thread sim_threads[SIM_NTHREADS];
+static struct sim_thread *sim_cur;
+static ucontext_t sim_sched_ctx;
+static int sim_nthreads;
+
+static int sim_pty = -1;
+static int sim_verbose;
+static int sim_bench;
+static uint64_t sim_limit;
+
+/* Trace replay. */
+static char **sim_trace;
+static int sim_trace_nlines;
+static int sim_trace_next;
+static int sim_trace_started;
+static int sim_done;
+static uint64_t sim_trace_start;
+static uint64_t sim_trace_end;
+static char sim_line[SIM_LINE_LEN];
+static int sim_line_len;
+
+/* Per line timing records. */
+static FILE *sim_records;
+static uint64_t sim_line_start;
+static int sim_line_rx;
+static int sim_line_tx;
+
+static void
+sim_block(void)
+{
+
+	swapcontext(&sim_cur->ctx, &sim_sched_ctx);
+}
+
+static void
+sim_sleep(uint64_t cycles)
+{
+
+	if (sim_cur == NULL)
+		return;
+
+	sim_cur->wakeup = sim_clock + cycles;
+	sim_cur->state = SIM_TD_SLEEP;
+	sim_block();
+}
+
+void
+mdx_sem_init(mdx_sem_t *sem, int count)
+{
+
+	sem->sem_count = count;
+	sem->sem_waiters = NULL;
+}
+
+static int
+sim_sem_wait(mdx_sem_t *sem, uint64_t wakeup)
+{
+	struct sim_thread **tp;
+
+	if (sem->sem_count > 0) {
+		sem->sem_count -= 1;
+		return (1);
+	}
+
+	if (sim_cur == NULL)
+		errx(1, "semaphore wait outside of a thread");
+
+	for (tp = (struct sim_thread **)&sem->sem_waiters; *tp != NULL;
+	    tp = &(*tp)->next)
+		continue;
+	sim_cur->next = NULL;
+	*tp = sim_cur;
+	sim_cur->sem = sem;
+	sim_cur->wakeup = wakeup;
+	sim_cur->timedout = 0;
+	sim_cur->state = SIM_TD_SEM;
+	sim_block();
+
+	return (sim_cur->timedout == 0);
+}
+
+/*
+ * Take a thread whose semaphore wait timed out off the wait list.
+ */
+static void
+sim_sem_timeout(struct sim_thread *st)
+{
+	struct sim_thread **tp;
+
+	for (tp = (struct sim_thread **)&st->sem->sem_waiters; *tp != st;
+	    tp = &(*tp)->next)
+		continue;
+	*tp = st->next;
+	st->next = NULL;
+	st->timedout = 1;
+	st->state = SIM_TD_READY;
+}
+
+void
+mdx_sem_wait(mdx_sem_t *sem)
+{
+
+	sim_sem_wait(sem, UINT64_MAX);
+}
+
+int
+mdx_sem_timedwait(mdx_sem_t *sem, int usec)
+{
+
+	return (sim_sem_wait(sem, sim_clock + (uint64_t)usec *
+	    SIM_CYCLES_PER_US));
+}
+
+int
+mdx_sem_trywait(mdx_sem_t *sem)
+{
+
+	if (sem->sem_count > 0) {
+		sem->sem_count -= 1;
+		return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Hand the semaphore over to the first waiter, if any. Also called by
+ * the interrupt handlers, from the scheduler context.
+ */
+int
+mdx_sem_post(mdx_sem_t *sem)
+{
+	struct sim_thread *st;
+
+	st = sem->sem_waiters;
+	if (st == NULL) {
+		sem->sem_count += 1;
+		return (0);
+	}
+
+	sem->sem_waiters = st->next;
+	st->next = NULL;
+	st->state = SIM_TD_READY;
+
+	return (1);
+}
+
+void
+mdx_usleep(uint32_t usec)
+{
+
+	sim_sleep((uint64_t)usec * SIM_CYCLES_PER_US);
+}
+
+void
+udelay(uint32_t usec)
+{
+
+	sim_sleep((uint64_t)usec * SIM_CYCLES_PER_US);
+}
+
+/*
+ * Interrupt handlers only run from the scheduler while all threads are
+ * blocked, so there is nothing to mask.
+ */
+void
+critical_enter(void)
+{
+
+}
+
+void
+critical_exit(void)
+{
+
+}
+
+void
+panic(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "sim: panic at %.3f ms: ",
+	    (double)sim_clock / (SIM_CYCLES_PER_US * 1000));
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+
+	exit(1);
+}
+
+static void
+sim_thread_start(void)
+{
+
+	sim_cur->entry(sim_cur->arg);
+	sim_cur->state = SIM_TD_EXITED;
+
+	sim_block();
+}
+
+int
+mdx_thread_setup(struct thread *td, const char *name, int prio,
+    uint32_t quantum, void *entry, void *arg)
+{
+	struct sim_thread *st;
+
+	if (sim_nthreads == SIM_NTHREADS)
+		return (-1);
+
+	st = &sim_threads[sim_nthreads++];
+	st->td = td;
+	st->entry = entry;
+	st->arg = arg;
+	st->state = SIM_TD_NEW;
+
+	td->td_name = name;
+	td->td_sim = st;
+
+	getcontext(&st->ctx);
+	st->ctx.uc_stack.ss_sp = malloc(SIM_STACK_SIZE);
+	st->ctx.uc_stack.ss_size = SIM_STACK_SIZE;
+	st->ctx.uc_link = NULL;
+	if (st->ctx.uc_stack.ss_sp == NULL)
+		return (-1);
+	makecontext(&st->ctx, sim_thread_start, 0);
+
+	return (0);
+}
+
+void
+mdx_sched_add(struct thread *td)
+{
+	struct sim_thread *st;
+
+	st = td->td_sim;
+	st->state = SIM_TD_READY;
+}
+
+/*
+ * Microbenchmarks of src/bench.c, timed with the host clock in ns.
+ */
+int
+bench_host_enabled(void)
+{
+
+	return (sim_bench);
+}
+
+uint32_t
+bench_host_cycles(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec));
+}
+
+void
+bench_host_done(void)
+{
+
+	sim_done = 1;
+	sim_block();
+}
+
+static void
+sim_main_thread(void *arg)
+{
+
+	fw_main();
+}
+
+/*
+ * Console output. A thread printing is held for the time the UART
+ * takes to send the characters, as the firmware busy-waits on it.
+ */
+int
+sim_printf(const char *fmt, ...)
+{
+	char buf[1024];
+	va_list ap;
+	int len;
+	int i;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len > (int)sizeof(buf) - 1)
+		len = sizeof(buf) - 1;
+
+	for (i = 0; i < len; i++)
+		sim_console_putc(buf[i]);
+
+	sim_sleep((uint64_t)len * SIM_UART_CHAR);
+
+	return (len);
+}
+
+/*
+ * As in board.c, raw bytes of binary frames.
+ */
+void
+board_console_write(const uint8_t *buf, int len)
+{
+
+	if (sim_pty >= 0)
+		write(sim_pty, buf, len);
+
+	sim_sleep((uint64_t)len * SIM_UART_CHAR);
+}
+
+/*
+ * Host stacks are not the firmware ones, nothing to report.
+ */
+void
+board_stacks(void)
+{
+
+}
+
+static void
+sim_trace_send(void)
+{
+	char *line;
+
+	if (sim_trace_next == sim_trace_nlines) {
+		sim_trace_end = sim_clock;
+		sim_done = 1;
+		return;
+	}
+
+	line = sim_trace[sim_trace_next++];
+	sim_line_start = sim_clock;
+	sim_line_rx = strlen(line);
+	sim_line_tx = 0;
+	sim_uart_input((const uint8_t *)line, sim_line_rx);
+}
+
+/*
+ * One record per trace line: time the first character was sent and
+ * the reply completed in us, characters sent and received, the line.
+ */
+static void
+sim_record(void)
+{
+	const char *line;
+
+	if (sim_records == NULL)
+		return;
+
+	line = sim_trace[sim_trace_next - 1];
+	fprintf(sim_records, "%.3f %.3f %d %d %s",
+	    (double)sim_line_start / SIM_CYCLES_PER_US,
+	    (double)sim_clock / SIM_CYCLES_PER_US,
+	    sim_line_rx, sim_line_tx, line);
+}
+
+/*
+ * Called once the firmware receive DMA is running.
+ */
+void
+sim_uart_ready(void)
+{
+
+	if (sim_trace == NULL || sim_trace_started)
+		return;
+
+	sim_trace_started = 1;
+	sim_trace_start = sim_clock;
+	sim_hw_start();
+	sim_trace_send();
+}
+
+void
+sim_console_putc(int c)
+{
+	char cr;
+
+	if (sim_pty >= 0) {
+		if (c == '\n') {
+			cr = '\r';
+			write(sim_pty, &cr, 1);
+		}
+		write(sim_pty, &c, 1);
+	} else if (sim_verbose)
+		putchar(c);
+
+	if (sim_trace == NULL)
+		return;
+	sim_line_tx += (c == '\n') ? 2 : 1;
+
+	/* The next trace line goes out once a command is complete. */
+	if (c != '\n') {
+		if (sim_line_len < SIM_LINE_LEN - 1)
+			sim_line[sim_line_len++] = c;
+		return;
+	}
+	sim_line[sim_line_len] = '\0';
+	sim_line_len = 0;
+	if (strcmp(sim_line, "COMPLETE") == 0 && sim_trace_started) {
+		sim_record();
+		sim_trace_send();
+	}
+}
+
+/*
+ * Load G-code lines, without comments and blank lines.
+ */
+static void
+sim_trace_load(const char *path)
+{
+	char buf[SIM_LINE_LEN];
+	FILE *fp;
+	char *p;
+	int len;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		err(1, "%s", path);
+
+	sim_trace = calloc(SIM_TRACE_NLINES, sizeof(char *));
+	if (sim_trace == NULL)
+		err(1, "calloc");
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		p = strchr(buf, ';');
+		if (p != NULL)
+			*p = '\0';
+		len = strcspn(buf, "\r\n");
+		while (len > 0 && (buf[len - 1] == ' ' || buf[len - 1] == '\t'))
+			len--;
+		if (len == 0)
+			continue;
+		if (sim_trace_nlines == SIM_TRACE_NLINES)
+			errx(1, "%s: too many lines", path);
+		buf[len++] = '\n';
+		buf[len] = '\0';
+		sim_trace[sim_trace_nlines++] = strdup(buf);
+	}
+
+	fclose(fp);
+}
+
+static void
+sim_pty_open(void)
+{
+	struct termios t;
+	int slave;
+
+	sim_pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if (sim_pty < 0 || grantpt(sim_pty) < 0 || unlockpt(sim_pty) < 0)
+		err(1, "pty");
+
+	/* Keep the slave open so that the master never sees a hang-up. */
+	slave = open(ptsname(sim_pty), O_RDWR | O_NOCTTY);
+	if (slave < 0)
+		err(1, "%s", ptsname(sim_pty));
+	tcgetattr(slave, &t);
+	cfmakeraw(&t);
+	tcsetattr(slave, TCSANOW, &t);
+
+	fprintf(stderr, "sim: console on %s\n", ptsname(sim_pty));
+}
+
+static uint64_t
+sim_realtime(void)
+{
+	static struct timespec t0;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (t0.tv_sec == 0 && t0.tv_nsec == 0)
+		t0 = ts;
+
+	return ((uint64_t)(ts.tv_sec - t0.tv_sec) * SIM_CPU_FREQ +
+	    (ts.tv_nsec - t0.tv_nsec) * (SIM_CPU_FREQ / 1000000) / 1000);
+}
+
+/*
+ * With the console on a pseudo-terminal the virtual clock does not run
+ * ahead of real time. Input is timestamped when it arrives. Returns
+ * the clock input arrived at, or next.
+ */
+static uint64_t
+sim_pace(uint64_t next)
+{
+	struct pollfd pfd;
+	uint8_t buf[256];
+	uint64_t now;
+	int timeout;
+	int len;
+
+	pfd.fd = sim_pty;
+	pfd.events = POLLIN;
+
+	now = sim_realtime();
+	timeout = 0;
+	if (next > now)
+		timeout = (next - now) / (SIM_CYCLES_PER_US * 1000);
+
+	if (poll(&pfd, 1, timeout) <= 0)
+		return (next);
+
+	len = read(sim_pty, buf, sizeof(buf));
+	if (len <= 0)
+		return (next);
+
+	now = sim_realtime();
+	if (now > sim_clock && now < next)
+		sim_clock = now;
+	sim_uart_input(buf, len);
+
+	return (sim_clock);
+}
+
+static void
+sim_run(void)
+{
+	struct sim_thread *st;
+	uint64_t next;
+	int ran;
+	int i;
+
+	while (sim_done == 0) {
+		ran = 0;
+		for (i = 0; i < sim_nthreads; i++) {
+			st = &sim_threads[i];
+			if (st->state != SIM_TD_READY)
+				continue;
+			sim_cur = st;
+			sim_hw_sync();
+			swapcontext(&sim_sched_ctx, &st->ctx);
+			sim_cur = NULL;
+			sim_hw_sync();
+			ran = 1;
+		}
+		if (ran)
+			continue;
+
+		/* Everybody waits: advance to the next event. */
+		next = sim_hw_next_event();
+		for (i = 0; i < sim_nthreads; i++) {
+			st = &sim_threads[i];
+			if ((st->state == SIM_TD_SLEEP ||
+			    st->state == SIM_TD_SEM) && st->wakeup < next)
+				next = st->wakeup;
+		}
+		if (next == UINT64_MAX)
+			errx(1, "all threads blocked at %.3f ms",
+			    (double)sim_clock / (SIM_CYCLES_PER_US * 1000));
+
+		if (sim_pty >= 0 && sim_pace(next) != next)
+			continue;
+
+		if (next > sim_clock)
+			sim_clock = next;
+		if (sim_limit && sim_clock > sim_limit)
+			errx(1, "time limit reached");
+
+		for (i = 0; i < sim_nthreads; i++) {
+			st = &sim_threads[i];
+			if (st->state == SIM_TD_SLEEP && st->wakeup <= sim_clock)
+				st->state = SIM_TD_READY;
+			if (st->state == SIM_TD_SEM && st->wakeup <= sim_clock)
+				sim_sem_timeout(st);
+		}
+		sim_hw_run();
+	}
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: pnpsim [-bv] [-l seconds] [-o timeline] "
+	    "[-p axis=steps] [-r records] [-s axis=steps] "
+	    "[-t trace.gcode]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *timeline;
+	struct thread td;
+	int ch;
+
+	timeline = NULL;
+
+	while ((ch = getopt(argc, argv, "bl:o:p:r:s:t:v")) != -1) {
+		switch (ch) {
+		case 'b':
+			sim_bench = 1;
+			sim_verbose = 1;
+			break;
+		case 'l':
+			sim_limit = strtoull(optarg, NULL, 10) * SIM_CPU_FREQ;
+			break;
+		case 'o':
+			timeline = fopen(optarg, "w");
+			if (timeline == NULL)
+				err(1, "%s", optarg);
+			break;
+		case 'p':
+			if (sim_hw_axis_opt(optarg, 0))
+				usage();
+			break;
+		case 'r':
+			sim_records = fopen(optarg, "w");
+			if (sim_records == NULL)
+				err(1, "%s", optarg);
+			break;
+		case 's':
+			if (sim_hw_axis_opt(optarg, 1))
+				usage();
+			break;
+		case 't':
+			sim_trace_load(optarg);
+			break;
+		case 'v':
+			sim_verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (sim_trace == NULL && sim_bench == 0)
+		sim_pty_open();
+	sim_hw_timeline(timeline);
+	sim_hw_init();
+
+	if (mdx_thread_setup(&td, "main", 1, 0, sim_main_thread, NULL))
+		errx(1, "can't create the main thread");
+	mdx_sched_add(&td);
+
+	sim_run();
+	if (sim_bench)
+		return (0);
+
+	printf("sim: %d lines in %.3f ms\n", sim_trace_nlines,
+	    (double)(sim_trace_end - sim_trace_start) /
+	    (SIM_CYCLES_PER_US * 1000));
+	sim_hw_report(stdout);
+	if (timeline != NULL)
+		fclose(timeline);
+	if (sim_records != NULL)
+		fclose(sim_records);
+
+	return (0);
+}
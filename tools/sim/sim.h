@@ -0,0 +1,69 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _SIM_H_
+#define	_SIM_H_
+
+#define	SIM_CPU_FREQ		168000000
+#define	SIM_CYCLES_PER_US	(SIM_CPU_FREQ / 1000000)
+
+/* One 8N1 character on the console at the rate in USART_BRR, in cycles. */
+#define	SIM_USART_CLK		42000000
+#define	SIM_UART_CHAR		sim_uart_char()
+
+/* Virtual clock, CPU cycles since reset. */
+extern uint64_t sim_clock;
+
+/* sim.c */
+void sim_console_putc(int c);
+void sim_uart_ready(void);
+
+/* sim_hw.c */
+void sim_hw_init(void);
+void sim_hw_sync(void);
+uint64_t sim_hw_next_event(void);
+void sim_hw_run(void);
+void sim_uart_input(const uint8_t *buf, int len);
+uint64_t sim_uart_char(void);
+int sim_hw_axis_opt(const char *arg, int home);
+void sim_hw_timeline(FILE *fp);
+void sim_hw_start(void);
+void sim_hw_report(FILE *fp);
+
+/* Firmware entry points. */
+struct stm32f4_gpio_softc;
+void arena_init(void);
+void gpio_config(struct stm32f4_gpio_softc *sc);
+int fw_main(void);
+void pnp_pwm_x_intr(void *arg, int irq);
+void pnp_pwm_y_intr(void *arg, int irq);
+void pnp_pwm_z_intr(void *arg, int irq);
+void pnp_pwm_h1_intr(void *arg, int irq);
+void pnp_pwm_h2_intr(void *arg, int irq);
+void gcode_usart_intr(void *arg, int irq);
+void gcode_dma_intr(void *arg, int irq);
+
+#endif /* !_SIM_H_ */
@@ -0,0 +1,541 @@
+/*-
+ * Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Simulated board: memory at the peripheral addresses used by src/,
+ * GPIO with the home switches and needle sensor, step timers and the
+ * console USART with its receive DMA.
+ */
+
+#include <sys/mman.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arm/stm/stm32f4.h>
+
+#include "sim.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define	MAP_FIXED_NOREPLACE	0x100000
+#endif
+
+#define	SIM_REG(addr)		(*(volatile uint32_t *)(uintptr_t)(addr))
+
+#define	SIM_DWT_CYCCNT		0xE0001004
+
+#define	SIM_GPIO_PORT(port)	(GPIO_BASE + (port) * 0x400)
+#define	SIM_GPIO_IDR		0x10
+#define	SIM_GPIO_ODR		0x14
+#define	SIM_GPIO_BSRR		0x18
+
+#define	SIM_TIM_CR1		0x00
+#define	SIM_TIM_CR1_CEN		(1 << 0)
+#define	SIM_TIM_CNT		0x24
+#define	SIM_TIM_PSC		0x28
+#define	SIM_TIM_ARR		0x2C
+#define	SIM_TIM_FREQ		84000000
+#define	SIM_PWM_FREQ_SCALE	100	/* See PLANNER_FREQ_SCALE. */
+
+#define	SIM_USART_IDLE		(1 << 4)
+#define	SIM_USART_TC		(1 << 6)
+#define	SIM_USART_IDLEIE	(1 << 4)
+#define	SIM_USART_IRQ		37
+
+#define	SIM_DMA_S2CR		(DMA2_BASE + 0x40)
+#define	SIM_DMA_CR_HTIE		(1 << 3)
+#define	SIM_DMA_CR_TCIE		(1 << 4)
+#define	SIM_DMA_IRQ		58
+
+#define	SIM_RX_SIZE		65536
+
+static const struct {
+	uintptr_t addr;
+	size_t size;
+	int fill;
+} sim_regions[] = {
+	{ 0x08060000, 0x00020000, 0xff },	/* Config flash sector. */
+	{ 0x40000000, 0x00030000, 0 },		/* Peripherals. */
+	{ 0xE0000000, 0x00010000, 0 },		/* Cortex-M4 private. */
+};
+
+struct stm32f4_flash_softc flash_sc = { FLASH_BASE };
+struct stm32f4_dma_softc dma1_sc;
+struct stm32f4_dma_softc dma2_sc = { DMA2_BASE };
+struct stm32f4_gpio_softc gpio_sc = { GPIO_BASE };
+struct stm32f4_pwm_softc pwm_x_sc = { TIM10_BASE };
+struct stm32f4_pwm_softc pwm_y_sc = { TIM4_BASE };
+struct stm32f4_pwm_softc pwm_z_sc = { TIM14_BASE };
+struct stm32f4_pwm_softc pwm_h1_sc = { TIM13_BASE };
+struct stm32f4_pwm_softc pwm_h2_sc = { TIM12_BASE };
+
+/* CCM arena, see the Makefile. */
+uint8_t sim_ccm[65536];
+
+/*
+ * Motors as wired on the board. X and Y home switches are active at and
+ * below the home position, the Z switch within a window around it.
+ * Positions are physical, in steps.
+ */
+struct sim_axis {
+	const char *name;
+	struct stm32f4_pwm_softc *pwm;
+	void (*intr)(void *arg, int irq);
+	int irq;
+	int dir_port;
+	int dir_pin;
+	int dir_invert;		/* Motor turns the other way round. */
+	int home_port;		/* -1 if none */
+	int home_pin;
+	int home_window;	/* 0 for a limit switch */
+	int64_t home;
+	int64_t pos;
+
+	uint64_t event;		/* Pending timer update, 0 if none. */
+	uint64_t armed;		/* When it was programmed. */
+	int dir;
+	uint64_t steps;		/* Since sim_hw_start(). */
+	uint64_t busy;		/* Cycles with a step pending, likewise. */
+};
+
+static struct sim_axis sim_axes[] = {
+	{ "X", &pwm_x_sc, pnp_pwm_x_intr, 25, PORT_E, 5, 0, PORT_C, 6, 0,
+	    0, 2000 },
+	{ "Y", &pwm_y_sc, pnp_pwm_y_intr, 30, PORT_C, 9, 0, PORT_C, 7, 0,
+	    0, 2000 },
+	{ "Z", &pwm_z_sc, pnp_pwm_z_intr, 45, PORT_E, 3, 0, PORT_B, 4, 40,
+	    0, 150 },
+	{ "H1", &pwm_h1_sc, pnp_pwm_h1_intr, 44, PORT_D, 1, 0, -1, 0, 0,
+	    0, 0 },
+	{ "H2", &pwm_h2_sc, pnp_pwm_h2_intr, 43, PORT_D, 0, 0, -1, 0, 0,
+	    0, 0 },
+};
+
+#define	SIM_NAXES	(sizeof(sim_axes) / sizeof(sim_axes[0]))
+
+static uint32_t sim_odr[PORT_NPORTS];
+
+/* Console receiver. */
+static uint8_t sim_rx[SIM_RX_SIZE];
+static int sim_rx_head;
+static int sim_rx_tail;
+static uint64_t sim_rx_event;
+static uint64_t sim_idle_event;
+static uint8_t *sim_dma_buf;
+static int sim_dma_size;
+static int sim_dma_pos;
+static int sim_dma_enabled;
+
+static FILE *sim_timeline;
+static uint32_t sim_timeline_count;
+
+/*
+ * Options -p (start position) and -s (home switch) as <axis>=<steps>.
+ */
+int
+sim_hw_axis_opt(const char *arg, int home)
+{
+	const char *val;
+	size_t len;
+	int i;
+
+	val = strchr(arg, '=');
+	if (val == NULL)
+		return (-1);
+	len = val - arg;
+
+	for (i = 0; i < SIM_NAXES; i++) {
+		if (strlen(sim_axes[i].name) != len ||
+		    strncasecmp(sim_axes[i].name, arg, len) != 0)
+			continue;
+		if (home)
+			sim_axes[i].home = strtoll(val + 1, NULL, 0);
+		else
+			sim_axes[i].pos = strtoll(val + 1, NULL, 0);
+		return (0);
+	}
+
+	return (-1);
+}
+
+void
+sim_hw_timeline(FILE *fp)
+{
+
+	sim_timeline = fp;
+}
+
+static int
+sim_at_home(struct sim_axis *ax)
+{
+	int64_t d;
+
+	if (ax->home_window == 0)
+		return (ax->pos <= ax->home);
+
+	d = ax->pos - ax->home;
+
+	return (d >= -ax->home_window && d <= ax->home_window);
+}
+
+/*
+ * Apply BSRR writes of the firmware to the outputs and refresh the
+ * input registers and the cycle counter.
+ */
+void
+sim_hw_sync(void)
+{
+	struct sim_axis *ax;
+	uint32_t inputs[PORT_NPORTS];
+	uint32_t bsrr;
+	uint32_t base;
+	int i;
+
+	for (i = 0; i < PORT_NPORTS; i++) {
+		base = SIM_GPIO_PORT(i);
+		bsrr = SIM_REG(base + SIM_GPIO_BSRR);
+		if (bsrr) {
+			sim_odr[i] |= bsrr & 0xffff;
+			sim_odr[i] &= ~(bsrr >> 16);
+			SIM_REG(base + SIM_GPIO_BSRR) = 0;
+		}
+		inputs[i] = 0;
+	}
+
+	for (i = 0; i < SIM_NAXES; i++) {
+		ax = &sim_axes[i];
+		if (ax->home_port >= 0 && sim_at_home(ax))
+			inputs[ax->home_port] |= (1 << ax->home_pin);
+	}
+
+	/* The needle sensor follows the needle. */
+	if (sim_odr[PORT_E] & (1 << 0))
+		inputs[PORT_B] |= (1 << 5);
+
+	/* Vacuum switches open (high) unless the nozzle holds a part. */
+	if ((sim_odr[PORT_E] & (1 << 2)) == 0)
+		inputs[PORT_B] |= (1 << 3);
+	if ((sim_odr[PORT_E] & (1 << 1)) == 0)
+		inputs[PORT_D] |= (1 << 4);
+
+	for (i = 0; i < PORT_NPORTS; i++) {
+		base = SIM_GPIO_PORT(i);
+		SIM_REG(base + SIM_GPIO_ODR) = sim_odr[i];
+		SIM_REG(base + SIM_GPIO_IDR) = sim_odr[i] | inputs[i];
+	}
+
+	SIM_REG(SIM_DWT_CYCCNT) = (uint32_t)sim_clock;
+}
+
+void
+pin_configure(struct stm32f4_gpio_softc *sc, const struct gpio_pin *cfg)
+{
+
+}
+
+void
+pin_set(struct stm32f4_gpio_softc *sc, uint32_t port, uint32_t pin,
+    uint32_t enable)
+{
+
+	if (enable)
+		sim_odr[port] |= (1 << pin);
+	else
+		sim_odr[port] &= ~(1 << pin);
+	sim_hw_sync();
+}
+
+int
+pin_get(struct stm32f4_gpio_softc *sc, uint32_t port, uint32_t pin)
+{
+
+	sim_hw_sync();
+
+	return ((SIM_REG(SIM_GPIO_PORT(port) + SIM_GPIO_IDR) >> pin) & 1);
+}
+
+/*
+ * One step pulse at freq / SIM_PWM_FREQ_SCALE steps/s: program the
+ * timer registers as the driver would and schedule the update event.
+ */
+void
+stm32f4_pwm_step(struct stm32f4_pwm_softc *sc, int chanset, uint32_t freq)
+{
+	struct sim_axis *ax;
+	uint64_t ticks;
+	uint32_t psc;
+	uint32_t arr;
+	int i;
+
+	for (i = 0; i < SIM_NAXES; i++)
+		if (sim_axes[i].pwm == sc)
+			break;
+	if (i == SIM_NAXES)
+		errx(1, "%s: unknown timer", __func__);
+	ax = &sim_axes[i];
+
+	if (freq == 0)
+		freq = 1;
+	ticks = (uint64_t)SIM_TIM_FREQ * SIM_PWM_FREQ_SCALE / freq;
+	if (ticks == 0)
+		ticks = 1;
+	psc = ticks / 65536;
+	arr = ticks / (psc + 1) - 1;
+	SIM_REG(sc->base + SIM_TIM_PSC) = psc;
+	SIM_REG(sc->base + SIM_TIM_ARR) = arr;
+	SIM_REG(sc->base + SIM_TIM_CR1) |= SIM_TIM_CR1_CEN;
+
+	sim_hw_sync();
+	ax->dir = ((sim_odr[ax->dir_port] >> ax->dir_pin) & 1) ^ ax->dir_invert;
+	/* A step programmed over a pending one replaces it. */
+	if (ax->event)
+		ax->busy += sim_clock - ax->armed;
+	ax->armed = sim_clock;
+	ax->event = sim_clock + (uint64_t)(psc + 1) * (arr + 1) * 2;
+}
+
+void
+stm32f4_pwm_intr(void *arg, int irq)
+{
+
+}
+
+void
+stm32f4_dma_setup(struct stm32f4_dma_softc *sc, struct stm32f4_dma_conf *conf)
+{
+
+	sim_dma_buf = (uint8_t *)conf->mem0;
+	sim_dma_size = conf->nbytes;
+	sim_dma_pos = 0;
+	SIM_REG(SIM_DMA_S2CR) = 0;
+}
+
+void
+stm32f4_dma_control(struct stm32f4_dma_softc *sc, int sid, int enable)
+{
+
+	sim_dma_enabled = enable;
+	if (enable == 0)
+		return;
+
+	if (sim_rx_head != sim_rx_tail && sim_rx_event == 0)
+		sim_rx_event = sim_clock + SIM_UART_CHAR;
+	sim_uart_ready();
+}
+
+/* Remaining transfers, counting down from the buffer size. */
+uint32_t
+stm32f4_dma_getcnt(struct stm32f4_dma_softc *sc, int sid)
+{
+
+	return (sim_dma_size - sim_dma_pos);
+}
+
+uint64_t
+sim_uart_char(void)
+{
+
+	return ((uint64_t)10 * SIM_REG(USART1_BASE + USART_BRR) *
+	    (SIM_CPU_FREQ / SIM_USART_CLK));
+}
+
+/*
+ * Queue console input. Characters arrive one by one at the line rate,
+ * the receiver goes idle one character time after the last one.
+ */
+void
+sim_uart_input(const uint8_t *buf, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		sim_rx[sim_rx_head] = buf[i];
+		sim_rx_head = (sim_rx_head + 1) % SIM_RX_SIZE;
+		if (sim_rx_head == sim_rx_tail)
+			errx(1, "console input overflow");
+	}
+
+	if (sim_dma_enabled && sim_rx_event == 0)
+		sim_rx_event = sim_clock + SIM_UART_CHAR;
+}
+
+uint64_t
+sim_hw_next_event(void)
+{
+	uint64_t next;
+	int i;
+
+	next = UINT64_MAX;
+	for (i = 0; i < SIM_NAXES; i++)
+		if (sim_axes[i].event && sim_axes[i].event < next)
+			next = sim_axes[i].event;
+	if (sim_rx_event && sim_rx_event < next)
+		next = sim_rx_event;
+	if (sim_idle_event && sim_idle_event < next)
+		next = sim_idle_event;
+
+	return (next);
+}
+
+static void
+sim_step(struct sim_axis *ax, int axis)
+{
+
+	ax->event = 0;
+	ax->busy += sim_clock - ax->armed;
+	ax->pos += ax->dir ? 1 : -1;
+	ax->steps += 1;
+
+	/* Same records as M915, for tools/capvcd.py. */
+	if (sim_timeline != NULL) {
+		fprintf(sim_timeline, "ok K:%08x %d %d %u\n",
+		    (uint32_t)sim_clock, axis, ax->dir, (uint32_t)ax->steps);
+		sim_timeline_count += 1;
+	}
+
+	/*
+	 * The handler runs at the update event, with no latency, and the
+	 * timer counts on.
+	 */
+	SIM_REG(ax->pwm->base + SIM_TIM_CNT) = 0;
+	sim_hw_sync();
+	ax->intr(ax->pwm, ax->irq);
+	sim_hw_sync();
+}
+
+/*
+ * Run the interrupt handlers of the events due at sim_clock.
+ */
+void
+sim_hw_run(void)
+{
+	struct sim_axis *ax;
+	int i;
+
+	sim_hw_sync();
+
+	for (i = 0; i < SIM_NAXES; i++) {
+		ax = &sim_axes[i];
+		if (ax->event && ax->event <= sim_clock)
+			sim_step(ax, i);
+	}
+
+	if (sim_rx_event && sim_rx_event <= sim_clock) {
+		sim_dma_buf[sim_dma_pos] = sim_rx[sim_rx_tail];
+		sim_dma_pos = (sim_dma_pos + 1) % sim_dma_size;
+		sim_rx_tail = (sim_rx_tail + 1) % SIM_RX_SIZE;
+		if (sim_rx_head != sim_rx_tail) {
+			sim_rx_event = sim_clock + SIM_UART_CHAR;
+		} else {
+			sim_rx_event = 0;
+			sim_idle_event = sim_clock + SIM_UART_CHAR;
+		}
+
+		/* Half and full buffer. */
+		if ((sim_dma_pos == sim_dma_size / 2 &&
+		    (SIM_REG(SIM_DMA_S2CR) & SIM_DMA_CR_HTIE)) ||
+		    (sim_dma_pos == 0 &&
+		    (SIM_REG(SIM_DMA_S2CR) & SIM_DMA_CR_TCIE))) {
+			gcode_dma_intr(NULL, SIM_DMA_IRQ);
+			sim_hw_sync();
+		}
+	}
+
+	if (sim_idle_event && sim_idle_event <= sim_clock) {
+		sim_idle_event = 0;
+		if (SIM_REG(USART1_BASE + USART_CR1) & SIM_USART_IDLEIE) {
+			SIM_REG(USART1_BASE + USART_SR) |= SIM_USART_IDLE;
+			gcode_usart_intr(NULL, SIM_USART_IRQ);
+			SIM_REG(USART1_BASE + USART_SR) &= ~SIM_USART_IDLE;
+		}
+		sim_hw_sync();
+	}
+}
+
+void
+sim_hw_init(void)
+{
+	void *addr;
+	int i;
+
+	for (i = 0; i < sizeof(sim_regions) / sizeof(sim_regions[0]); i++) {
+		addr = mmap((void *)sim_regions[i].addr, sim_regions[i].size,
+		    PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (addr != (void *)sim_regions[i].addr)
+			err(1, "can't map %#lx", sim_regions[i].addr);
+		memset(addr, sim_regions[i].fill, sim_regions[i].size);
+	}
+
+	sim_hw_sync();
+
+	/* As board_init(). */
+	SIM_REG(USART1_BASE + USART_BRR) = SIM_USART_CLK / 115200;
+	SIM_REG(USART1_BASE + USART_SR) |= SIM_USART_TC;
+	arena_init();
+	gpio_config(&gpio_sc);
+}
+
+/*
+ * Start of the trace: steps and busy time count from here, the time
+ * of a step pending since before from here as well.
+ */
+void
+sim_hw_start(void)
+{
+	struct sim_axis *ax;
+	int i;
+
+	for (i = 0; i < SIM_NAXES; i++) {
+		ax = &sim_axes[i];
+		ax->steps = 0;
+		ax->busy = 0;
+		if (ax->event)
+			ax->armed = sim_clock;
+	}
+}
+
+void
+sim_hw_report(FILE *fp)
+{
+	struct sim_axis *ax;
+	int i;
+
+	for (i = 0; i < SIM_NAXES; i++) {
+		ax = &sim_axes[i];
+		fprintf(fp, "sim: %s steps %llu busy %.3f ms position %lld\n",
+		    ax->name, (unsigned long long)ax->steps,
+		    (double)ax->busy / (SIM_CYCLES_PER_US * 1000),
+		    (long long)ax->pos);
+	}
+
+	if (sim_timeline != NULL)
+		fprintf(sim_timeline, "ok K:N:%u F:%u\n", sim_timeline_count,
+		    SIM_CPU_FREQ);
+}
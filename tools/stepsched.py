@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+#-
+# Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+"""Drive a stepper from the host with compressed step schedules.
+
+Usage: stepsched.py [-a axis] [-v steps/s] [-A steps/s^2] port steps
+
+Syncs to the firmware CYCCNT clock, computes the step times of a move
+with a smooth (cosine) acceleration profile on the host, compresses them
+into (interval, count, add) segments and streams the segments in binary
+frames, see src/frame.h. The move starts 100 ms after it is planned;
+the firmware steps autonomously from its segment queue.
+"""
+
+import argparse
+import math
+import struct
+import sys
+import time
+
+from pnpframe import (CLOCK, ERR_FULL, ERRORS, MAXLEN, QUEUE_STEP,
+                      SCHED_STATUS, STEP_CLOCK, Link)
+
+AXES = "XYZIJ"
+SEG = struct.Struct("<BIHh")
+TOLERANCE_US = 5
+
+
+class Clock:
+    """Firmware clock as a linear function of the host monotonic time."""
+
+    def __init__(self, link, samples=16):
+        self.link = link
+        pts = []
+        wrap = 0
+        last = None
+        for _ in range(samples):
+            t0 = time.monotonic()
+            _, data = link.request(CLOCK)
+            t1 = time.monotonic()
+            clk, self.nominal = struct.unpack("<II", data)
+            if last is not None and clk < last:
+                wrap += 1 << 32
+            last = clk
+            pts.append(((t0 + t1) / 2, clk + wrap))
+        # Least squares fit of the clock against the host time.
+        n = len(pts)
+        mt = sum(p[0] for p in pts) / n
+        mc = sum(p[1] for p in pts) / n
+        stt = sum((p[0] - mt) ** 2 for p in pts)
+        self.freq = sum((p[0] - mt) * (p[1] - mc) for p in pts) / stt
+        self.t0 = mt
+        self.c0 = mc
+
+    def now(self):
+        return self.c0 + (time.monotonic() - self.t0) * self.freq
+
+
+def profile(steps, vmax, accel):
+    """Step times in seconds, cosine shaped velocity ramps."""
+    # With v(t) = vmax (1 - cos(pi t / T)) / 2 the peak acceleration
+    # is pi vmax / 2T.
+    ta = math.pi * vmax / (2 * accel)
+    da = vmax * ta / 2
+    if 2 * da > steps:
+        vmax *= math.sqrt(steps / (2 * da))
+        ta = math.pi * vmax / (2 * accel)
+        da = steps / 2
+    tc = (steps - 2 * da) / vmax
+
+    def pos(t):
+        if t < ta:
+            return vmax / 2 * (t - ta / math.pi * math.sin(math.pi * t / ta))
+        if t < ta + tc:
+            return da + vmax * (t - ta)
+        u = t - ta - tc
+        return (da + vmax * tc + vmax / 2 *
+                (u + ta / math.pi * math.sin(math.pi * u / ta)))
+
+    total = 2 * ta + tc
+    times = []
+    lo = 0.0
+    for k in range(1, steps + 1):
+        hi = total
+        # Bisect for pos(t) = k, from the previous step on.
+        for _ in range(50):
+            mid = (lo + hi) / 2
+            if pos(mid) < k:
+                lo = mid
+            else:
+                hi = mid
+        times.append(hi)
+    return times
+
+
+def segment_end(last, interval, count, add):
+    return last + count * interval + add * count * (count - 1) // 2
+
+
+def fits(times, last, n, tol):
+    """(interval, add) reaching the first n steps within tol, or None."""
+    interval = round(times[0] - last)
+    if n == 1:
+        return (interval, 0) if interval >= 0 else None
+    add = round((times[n - 1] - last - n * interval) / (n * (n - 1) / 2))
+    if not -32768 <= add <= 32767:
+        return None
+    t = last
+    iv = interval
+    for j in range(n):
+        if j:
+            iv += add
+        t += iv
+        if iv < 0 or abs(t - times[j]) > tol:
+            return None
+    return interval, add
+
+
+def compress(times, last, tol):
+    """Greedy: the longest segment that fits, then the next one."""
+    segs = []
+    i = 0
+    while i < len(times):
+        rest = times[i:i + 65535]
+        best = (1, fits(rest, last, 1, tol))
+        n = 2
+        while n <= len(rest):
+            f = fits(rest, last, n, tol)
+            if f is None:
+                break
+            best = (n, f)
+            n *= 2
+        lo, hi = best[0], min(n, len(rest) + 1)
+        while hi - lo > 1:
+            mid = (lo + hi) // 2
+            f = fits(rest, last, mid, tol)
+            if f is None:
+                hi = mid
+            else:
+                lo, best = mid, (mid, f)
+        count, (interval, add) = best
+        segs.append((interval, count, add))
+        # Go on from where the firmware puts the last step.
+        last = segment_end(last, interval, count, add)
+        i += count
+    return segs
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-a", default="X", choices=list(AXES))
+    ap.add_argument("-v", type=float, default=20000, help="steps/s")
+    ap.add_argument("-A", type=float, default=100000, help="steps/s^2")
+    ap.add_argument("port")
+    ap.add_argument("steps", type=int)
+    args = ap.parse_args()
+
+    axis = AXES.index(args.a)
+    link = Link(args.port)
+    link.enable()
+    clock = Clock(link)
+    print("clock: %.0f Hz (nominal %d)" % (clock.freq, clock.nominal))
+
+    # Segments are relative, the move is placed in time once planned.
+    direction = 1 if args.steps > 0 else 0
+    times = [t * clock.freq
+             for t in profile(abs(args.steps), args.v, args.A)]
+    segs = compress(times, 0, TOLERANCE_US * clock.freq / 1e6)
+    print("%d steps in %d segments" % (len(times), len(segs)))
+
+    start = int(clock.now() + 0.1 * clock.freq)
+    err = link.check(STEP_CLOCK, struct.pack("<BI", axis,
+                                             start & 0xFFFFFFFF))
+    if err:
+        raise SystemExit("stepsched: axis %s: %s" % (args.a,
+                                                     ERRORS[err[1]]))
+
+    per = MAXLEN // SEG.size
+    i = 0
+    while i < len(segs):
+        batch = segs[i:i + per]
+        payload = b"".join(SEG.pack(axis | direction << 7, *s)
+                           for s in batch)
+        err = link.check(QUEUE_STEP, payload)
+        if err is None:
+            i += len(batch)
+            continue
+        if err[1] != ERR_FULL:
+            raise SystemExit("stepsched: segment %d: %s" %
+                             (i + err[2], ERRORS[err[1]]))
+        i += err[2]
+        time.sleep(0.01)
+
+    while True:
+        _, st = link.request(SCHED_STATUS, bytes([axis]))
+        _, free, active, pos, late, stopped = struct.unpack("<BBBiII", st)
+        if not active:
+            break
+        time.sleep(0.05)
+    print("position %d, %d late steps, %d stopped" % (pos, late, stopped))
+
+    return 1 if late or stopped else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
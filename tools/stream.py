@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+#-
+# Copyright (c) 2024 Ruslan Bukin <br@bsdpad.com>
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+"""Stream G-code with line numbers and checksums, many lines in flight.
+
+Usage: stream.py [-e rate] [-s baud] port file ...
+
+Every line goes out as N<line> <command>*<sum> and up to the receive
+window of the firmware (M110) is sent ahead of the lines answered. The
+firmware answers every line with OK or RESEND N:<line>. A RESEND for a
+line sent after the last rewind starts the stream again from the line
+asked for; one for a line sent before it only answers a line that was
+on its way. -e flips a bit in that fraction of the lines, to exercise
+the resend path.
+"""
+
+import argparse
+import random
+import re
+import sys
+import time
+
+from pnpframe import Link
+
+
+def numbered(n, cmd):
+    line = "N%d %s" % (n, cmd)
+    s = 0
+    for c in line.encode():
+        s ^= c
+    return "%s*%d\n" % (line, s)
+
+
+def load(path):
+    with open(path) as f:
+        return [l for l in (l.split(";")[0].strip() for l in f) if l]
+
+
+def corrupt(data):
+    """Flip a bit, not into a newline or a real-time character."""
+    while True:
+        i = random.randrange(len(data) - 1)
+        c = data[i] ^ 1 << random.randrange(8)
+        if c not in b"\n?!~\x18":
+            return data[:i] + bytes([c]) + data[i + 1:]
+
+
+def stream(link, cmds, error_rate):
+    replies = link.gcode(numbered(0, "M110").rstrip("\n"))
+    m = [re.match(r"ok N:0 W:(\d+)", r) for r in replies]
+    window = [int(x.group(1)) for x in m if x]
+    if not window:
+        raise SystemExit("stream: no line numbers in this firmware")
+    window = window[0]
+
+    nxt = 1			# Next line to send.
+    done = 0			# Lines complete.
+    inflight = []		# Lines sent, not answered: [size, rewind, line].
+    rewind = 0
+    resends = 0
+    last = 0			# Line of the last OK.
+
+    while done < len(cmds):
+        while nxt <= len(cmds):
+            data = numbered(nxt, cmds[nxt - 1]).encode()
+            if sum(x[0] for x in inflight) + len(data) > window:
+                break
+            if random.random() < error_rate:
+                data = corrupt(data)
+            link.write(data)
+            inflight.append([len(data), rewind, nxt])
+            nxt += 1
+
+        _, line = link.receive()
+        if line == "OK":
+            _, _, last = inflight.pop(0)
+        elif line in ("ERR: expected a letter", "ERR: job running"):
+            print("stream: line %d not run: %s" % (last, cmds[last - 1]))
+        elif line == "COMPLETE":
+            done += 1
+        elif line.startswith("RESEND N:"):
+            _, sent, _ = inflight.pop(0)
+            if sent == rewind:
+                nxt = int(line[9:])
+                rewind += 1
+                resends += 1
+        elif line.startswith("ERR:"):
+            pass
+        elif line:
+            print(line)
+
+    # Back to plain lines, for the tools that follow.
+    link.gcode("M110")
+    return resends
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-e", type=float, default=0, help="error rate")
+    ap.add_argument("-s", type=int, help="baud rate")
+    ap.add_argument("port")
+    ap.add_argument("files", nargs="+")
+    args = ap.parse_args()
+
+    link = Link(args.port)
+    if args.s and link.baud(args.s) != args.s:
+        print("stream: staying at %d baud" % link.rate)
+
+    for path in args.files:
+        cmds = load(path)
+        t0 = time.monotonic()
+        resends = stream(link, cmds, args.e)
+        print("%s: %d lines in %.3f s, %d resends" %
+              (path, len(cmds), time.monotonic() - t0, resends))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())